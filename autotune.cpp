@@ -0,0 +1,411 @@
+/** ***************************************************************************
+ * @file
+ *
+ * @brief times each operation with every kernel version, thread count and
+ *        band size on this machine, and keeps the fastest in a profile that
+ *        later runs load.
+ *****************************************************************************/
+
+#include "netPBM.h"
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <iomanip>
+#include <vector>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+
+/******************************************************************************
+ *                              Struct
+ *****************************************************************************/
+/**
+ * @brief One setting of the tunable knobs and how long an operation took
+ *        with it.
+ */
+struct tuning
+{
+    isaLevel level = ISA_SCALAR;    /**< Kernel version */
+    int threads = 0;                /**< Threads parallelFor uses */
+    int band = 0;                   /**< Rows per piece, 0 for one per thread */
+    double seconds = 0;             /**< Best time of the operation */
+};
+
+
+/******************************************************************************
+ *                              Globals
+ *****************************************************************************/
+/** Names of the instruction set levels, the same ones --isa takes */
+static const char* const isaNames[] = { "scalar", "sse4.2", "avx2",
+    "avx512" };
+static string tunedOption;      /**< operation useProfile loaded, or empty */
+static tuning tuned;            /**< threads and band of that operation */
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Returns the name of the profile for this machine. THPE01_PROFILE names
+ * it when it is set; otherwise it is .thpe01-hostname.tsv in the home
+ * directory, so each host a home directory is shared with keeps its own.
+ *
+ * @returns the name of the profile file
+ *
+ * @par Example:
+   @verbatim
+   profileName();
+
+   Output:
+   /home/heidi/.thpe01-lab12.tsv
+   @endverbatim
+ *
+ *****************************************************************************/
+static string profileName()
+{
+    const char* named = getenv("THPE01_PROFILE");
+    const char* home = getenv("HOME");
+    string host = "host";
+
+    if (named != nullptr && *named != '\0')
+        return named;
+
+#ifdef _WIN32
+    if (getenv("COMPUTERNAME") != nullptr)
+        host = getenv("COMPUTERNAME");
+    if (home == nullptr)
+        home = getenv("USERPROFILE");
+#else
+    char name[256] = "";
+    if (gethostname(name, sizeof(name) - 1) == 0 && name[0] != '\0')
+        host = name;
+#endif
+
+    return (home == nullptr ? string(".") : string(home)) + "/.thpe01-" +
+        host + ".tsv";
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Times an operation on a copy of the sample image with the knobs set as
+ * given, and keeps the best run. It runs at least three times, and fast
+ * operations run up to twenty times or a tenth of a second, so a short
+ * hiccup of the machine does not decide the winner. Copying the image is
+ * not timed.
+ *
+ * @param[in] sample - the image to process
+ * @param[in] option - image operation choice
+ * @param[in] parameter - the text given with the option, empty if none
+ * @param[in,out] setting - the knobs to use, its seconds are filled in
+ *
+ * @returns true if the operation ran, false if it failed
+ *
+ * @par Example:
+   @verbatim
+   timeOperation(sample, "--smooth", "", setting);
+   @endverbatim
+ *
+ *****************************************************************************/
+static bool timeOperation(image& sample, string option, string parameter,
+    tuning& setting)
+{
+    pixel** planes[3] = { sample.redgray, sample.green, sample.blue };
+    double total = 0;
+    int run, k;
+    bool ok = true;
+
+    kernels = kernelsFor(setting.level);
+    setThreadCount(setting.threads);
+    setBandRows(setting.band);
+
+    setting.seconds = 1e30;
+    for (run = 0; (run < 3 || (run < 20 && total < 0.1)) && ok; run++)
+    {
+        image copy = sample;
+        pixel** copies[3] = { nullptr, nullptr, nullptr };
+
+        for (k = 0; k < 3 && ok; k++)
+        {
+            ok = (copies[k] = alloc2d(sample.rows, sample.cols)) != nullptr;
+            if (ok)
+                copy2d(planes[k], copies[k], sample.rows, sample.cols);
+        }
+        copy.redgray = copies[0];
+        copy.green = copies[1];
+        copy.blue = copies[2];
+
+        auto start = chrono::steady_clock::now();
+        ok = ok && applyOperation(copy, option, parameter);
+        chrono::duration<double> took = chrono::steady_clock::now() - start;
+
+        setting.seconds = min(setting.seconds, took.count());
+        total += took.count();
+        freeImage(copy);
+    }
+
+    return ok;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Finds the fastest settings of each operation on this machine and saves
+ * them as the profile of this host. The sample is a synthetic 1920x1080
+ * color image of flat blocks, ramps and noise, about what a photo or a scan
+ * holds. Starting from the default, which is the best kernels the processor
+ * has, every thread and one piece per thread, the knobs are tuned one at a
+ * time: the kernel version from scalar up, then the thread count in powers
+ * of two, then the rows parallelFor hands a thread at a time. A setting
+ * has to be 3% faster than the best so far to replace it, so noise does not
+ * pick an odd one.
+ *
+ * The profile, named by profileName, is a tab separated file with one line
+ * per operation. Every later run loads the line of its operation in
+ * globalOptions, so tuning costs nothing once it is done. A table of the
+ * winners is left in lastReport.
+ *
+ * @returns 0 after the profile is written, 1 if it could not be
+ *
+ * @par Example:
+   @verbatim
+   tuneOperations();
+
+   lastReport:
+   option       isa     threads  band  Mpixel/s  speedup
+   --smooth     avx512  1        64    412.3     1.08
+   @endverbatim
+ *
+ *****************************************************************************/
+int tuneOperations()
+{
+    const char* const operations[][2] = { { "--negate", "" },
+        { "--brighten", "40" }, { "--grayscale", "" }, { "--contrast", "" },
+        { "--smooth", "" }, { "--sharpen", "" }, { "--equalize", "" },
+        { "--clahe", "" }, { "--median", "1" }, { "--erode", "3x3" },
+        { "--dilate", "3x3" }, { "--open", "3x3" }, { "--close", "3x3" },
+        { "--boxblur", "5" }, { "--stddev", "5" }, { "--unsharp", "" },
+        { "--edges", "" }, { "--bilateral", "" } };
+    const int bands[] = { 16, 64, 256 };
+    int hardware = threadCount(), threads, level, r, c;
+    unsigned int noise = 1;
+    string profileFile = profileName(), temporary = profileFile + ".tmp";
+    vector<int> counts;
+    error_code error;
+    ofstream fout;
+    ostringstream table;
+    image sample;
+
+    lastReport = "";
+    for (threads = 1; threads < hardware; threads *= 2)
+        counts.push_back(threads);      // powers of two, then all of them
+    counts.push_back(hardware);
+
+    sample.magicNumber = "P6";
+    sample.rows = 1080;
+    sample.cols = 1920;
+    sample.redgray = alloc2d(sample.rows, sample.cols);
+    sample.green = alloc2d(sample.rows, sample.cols);
+    sample.blue = alloc2d(sample.rows, sample.cols);
+    if (sample.redgray == nullptr || sample.green == nullptr ||
+        sample.blue == nullptr)
+    {
+        freeImage(sample);
+        return 1;
+    }
+
+    for (r = 0; r < sample.rows; r++)   // blocks, ramps and a little noise
+    {
+        for (c = 0; c < sample.cols; c++)
+        {
+            int base = ((r / 96 + c / 128) % 3) * 80 + (r + c) % 40;
+            noise = noise * 1103515245 + 12345;
+            sample.redgray[r][c] = (pixel)crop(base + (int)(noise >> 28));
+            sample.green[r][c] = (pixel)crop(base + 20 - (int)(noise >> 29));
+            sample.blue[r][c] = (pixel)crop(255 - base + (int)(noise >> 27));
+        }
+    }
+
+    if (!openOutput(temporary, fout))
+    {
+        lastFailure = "Unable to write the profile " + profileFile;
+        freeImage(sample);
+        return 1;
+    }
+
+    fout << "option\tisa\tthreads\tband\tmpixels\n";
+    table << left << setw(13) << "option" << setw(8) << "isa" << setw(9)
+        << "threads" << setw(6) << "band" << setw(10) << "Mpixel/s"
+        << "speedup" << '\n';
+
+    for (auto& operation : operations)
+    {
+        tuning best, trial;
+        double first;
+
+        best.level = detectIsa();
+        best.threads = hardware;
+        if (!timeOperation(sample, operation[0], operation[1], best) ||
+            !timeOperation(sample, operation[0], operation[1], best))
+            continue;                   // the first time warms the caches
+        first = best.seconds;
+
+        for (level = ISA_SCALAR; level <= (int)detectIsa(); level++)
+        {
+            trial = best;
+            trial.level = (isaLevel)level;
+            if (trial.level != best.level && timeOperation(sample,
+                operation[0], operation[1], trial) &&
+                trial.seconds < best.seconds * 0.97)
+                best = trial;
+        }
+
+        for (int threads : counts)
+        {
+            trial = best;
+            trial.threads = threads;
+            if (trial.threads != best.threads && timeOperation(sample,
+                operation[0], operation[1], trial) &&
+                trial.seconds < best.seconds * 0.97)
+                best = trial;
+        }
+
+        for (int band : bands)
+        {
+            trial = best;
+            trial.band = band;
+            if (timeOperation(sample, operation[0], operation[1], trial) &&
+                trial.seconds < best.seconds * 0.97)
+                best = trial;
+        }
+
+        fout << operation[0] << '\t' << isaNames[best.level] << '\t'
+            << best.threads << '\t' << best.band << '\t' << fixed
+            << setprecision(1) << sample.rows * sample.cols / best.seconds /
+            1e6 << '\n';
+        table << left << setw(13) << operation[0] << setw(8)
+            << isaNames[best.level] << setw(9) << best.threads << setw(6)
+            << best.band << setw(10) << fixed << setprecision(1)
+            << sample.rows * sample.cols / best.seconds / 1e6
+            << setprecision(2) << first / best.seconds << '\n';
+    }
+    finishOutput(temporary, fout);
+
+    kernels = kernelsFor(detectIsa());
+    setThreadCount(0);
+    setBandRows(0);
+    freeImage(sample);
+
+    lastReport = table.str();
+    fs::rename(temporary, profileFile, error);
+    if (!fout || error)
+    {
+        lastFailure = "Unable to write the profile " + profileFile;
+        return 1;
+    }
+
+    lastReport += "Saved the profile " + profileFile + '\n';
+
+    return 0;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Loads the line of an operation in the profile of this host, if there is
+ * one. The kernels are picked right away, for the whole run, since every
+ * version gives the same result and swapping them while the pipeline reads
+ * would race. The thread count and band size are only kept, and
+ * tunedOperation sets them around the operation itself, so reading,
+ * writing and the other commands still use every thread. Kernels the
+ * processor does not have are never used, in case the profile was made on
+ * another machine, and the kernels are kept when --isa picked them.
+ *
+ * @param[in] option - image operation choice
+ * @param[in] keepIsa - true to keep the kernels that are in use
+ *
+ * @returns true if the profile had a line for the operation, false
+ *          otherwise
+ *
+ * @par Example:
+   @verbatim
+   useProfile("--smooth", false);
+   @endverbatim
+ *
+ *****************************************************************************/
+bool useProfile(string option, bool keepIsa)
+{
+    ifstream fin(profileName());
+    string line, field;
+    isaLevel level;
+
+    getline(fin, line);                 // skip the column names
+    while (getline(fin, line))
+    {
+        vector<string> fields;
+        istringstream columns(line);
+
+        while (getline(columns, field, '\t'))
+            fields.push_back(field);
+        if (fields.size() < 4 || fields[0] != option)
+            continue;
+
+        if (!keepIsa && isaFromName(fields[1], level) && level <= detectIsa())
+            kernels = kernelsFor(level);
+        tunedOption = option;
+        tuned.threads = atoi(fields[2].c_str());
+        tuned.band = atoi(fields[3].c_str());
+        return true;
+    }
+
+    return false;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Applies an operation with the thread count and band size the profile
+ * loaded by useProfile has for it, and puts back the ones that were set
+ * before, so they govern only the operation. Without a profile line for
+ * the operation it is the same as applyOperation.
+ *
+ * @param[in,out] picture - structure for image information
+ * @param[in] option - image operation choice
+ * @param[in] parameter - the text given with the option, empty if none
+ *
+ * @returns the result of applyOperation
+ *
+ * @par Example:
+   @verbatim
+   useProfile("--smooth", false);
+   tunedOperation(image, "--smooth", "");
+   @endverbatim
+ *
+ *****************************************************************************/
+bool tunedOperation(image& picture, string option, string parameter)
+{
+    int threads, band;
+    bool ok;
+
+    if (option != tunedOption)
+        return applyOperation(picture, option, parameter);
+
+    threads = setThreadCount(tuned.threads);
+    band = setBandRows(tuned.band);
+    ok = applyOperation(picture, option, parameter);
+    setThreadCount(threads);
+    setBandRows(band);
+
+    return ok;
+}
@@ -0,0 +1,331 @@
+/** ***************************************************************************
+ * @file
+ *
+ * @brief edge preserving bilateral filter, as a fast approximation from a
+ *        few box filters and as the exact brute force version.
+ *****************************************************************************/
+
+#include "netPBM.h"
+#include <cstdio>
+#include <vector>
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Approximates the bilateral filter of one color plane with box filters
+ * over a set of quantized gray levels. The range 0..255 is split into
+ * levels about sigmaR apart. For each level, every pixel gets a weight from
+ * how close it is to the level, and the box sums of the weights and of the
+ * weighted pixels give the filtered value a pixel with that gray level
+ * would have. Each pixel is then interpolated between the two levels on
+ * either side of it. The weights come from a lookup table per level, so no
+ * weight planes are stored.
+ *
+ * The box sums slide down each strip of rows like unsharpPlane does, with
+ * one running sum of weights and one of weighted pixels per column, so a
+ * level costs about as much as one box blur no matter how large the radius
+ * is. A strip only visits the levels next to the gray values in its own
+ * rows. The box is clipped at the edges of the image.
+ *
+ * @param[in,out] plane - the color plane to filter
+ * @param[in] rows - number of rows in the plane
+ * @param[in] cols - number of columns in the plane
+ * @param[in] radius - radius of the box
+ * @param[in] sigmaR - standard deviation of the range weights
+ *
+ * @returns true if the plane was filtered, false if memory ran out
+ *
+ * @par Example:
+   @verbatim
+   bilateralPlane(image.redgray, image.rows, image.cols, 5, 30.0);
+   @endverbatim
+ *
+ *****************************************************************************/
+static bool bilateralPlane(pixel**& plane, int rows, int cols, int radius,
+    double sigmaR)
+{
+    int levels = min(max((int)ceil(255 / sigmaR) + 1, 2), 256);
+    double step = 255.0 / (levels - 1);
+    vector<int> weights((size_t)levels * 256), weighted((size_t)levels * 256);
+    int lowLevel[256];
+    float upper[256];
+    pixel** result = alloc2d(rows, cols);
+    int k, v;
+
+    if (result == nullptr)
+        return false;
+
+    for (k = 0; k < levels; k++)        // weight of each gray at each level
+    {
+        for (v = 0; v < 256; v++)
+        {
+            double distance = (v - k * step) / sigmaR;
+            weights[k * 256 + v] = (int)(1024 * exp(-distance * distance / 2)
+                + 0.5);
+            weighted[k * 256 + v] = weights[k * 256 + v] * v;
+        }
+    }
+
+    for (v = 0; v < 256; v++)           // the levels on either side of v
+    {
+        lowLevel[v] = min((int)(v / step), levels - 2);
+        upper[v] = (float)(v / step - lowLevel[v]);
+    }
+
+    parallelFor(0, rows, [&](int rowStart, int rowEnd)
+        {
+            vector<float> sums((size_t)(rowEnd - rowStart) * cols, 0.0f);
+            vector<int> weightColumns(cols), pixelColumns(cols);
+            vector<int> rowFirst(rowEnd - rowStart, levels);
+            vector<int> rowLast(rowEnd - rowStart, 0);
+            int first = levels, last = 0;
+
+            for (int r = rowStart; r < rowEnd; r++)     // levels each row needs
+            {
+                for (int c = 0; c < cols; c++)
+                {
+                    rowFirst[r - rowStart] = min(rowFirst[r - rowStart],
+                        lowLevel[plane[r][c]]);
+                    rowLast[r - rowStart] = max(rowLast[r - rowStart],
+                        lowLevel[plane[r][c]] + 1);
+                }
+                first = min(first, rowFirst[r - rowStart]);
+                last = max(last, rowLast[r - rowStart]);
+            }
+
+            for (int level = first; level <= last; level++)
+            {
+                const int* weight = &weights[level * 256];
+                const int* times = &weighted[level * 256];
+
+                fill(weightColumns.begin(), weightColumns.end(), 0);
+                fill(pixelColumns.begin(), pixelColumns.end(), 0);
+                for (int y = max(rowStart - radius, 0);
+                    y <= min(rowStart + radius, rows - 1); y++)
+                {
+                    for (int c = 0; c < cols; c++)
+                    {
+                        weightColumns[c] += weight[plane[y][c]];
+                        pixelColumns[c] += times[plane[y][c]];
+                    }
+                }
+
+                for (int r = rowStart; r < rowEnd; r++)
+                {
+                    const pixel* row = plane[r];
+                    float* sum = &sums[(size_t)(r - rowStart) * cols];
+                    long long weightBox = 0, pixelBox = 0;
+
+                    if (r > rowStart)   // slide the column sums down a row
+                    {
+                        if (r + radius < rows)
+                        {
+                            const pixel* entering = plane[r + radius];
+                            for (int c = 0; c < cols; c++)
+                            {
+                                weightColumns[c] += weight[entering[c]];
+                                pixelColumns[c] += times[entering[c]];
+                            }
+                        }
+                        if (r - radius - 1 >= 0)
+                        {
+                            const pixel* leaving = plane[r - radius - 1];
+                            for (int c = 0; c < cols; c++)
+                            {
+                                weightColumns[c] -= weight[leaving[c]];
+                                pixelColumns[c] -= times[leaving[c]];
+                            }
+                        }
+                    }
+
+                    if (level < rowFirst[r - rowStart] ||
+                        level > rowLast[r - rowStart])
+                        continue;       // no pixel of this row is near level
+
+                    for (int x = 0; x <= min(radius, cols - 1); x++)
+                    {
+                        weightBox += weightColumns[x];
+                        pixelBox += pixelColumns[x];
+                    }
+
+                    for (int c = 0; c < cols; c++)
+                    {
+                        int low = lowLevel[row[c]];
+
+                        if (low == level || low + 1 == level)
+                            sum[c] += (low == level ? 1 - upper[row[c]] :
+                                upper[row[c]]) * pixelBox / weightBox;
+
+                        if (c + radius + 1 < cols)
+                        {
+                            weightBox += weightColumns[c + radius + 1];
+                            pixelBox += pixelColumns[c + radius + 1];
+                        }
+                        if (c - radius >= 0)
+                        {
+                            weightBox -= weightColumns[c - radius];
+                            pixelBox -= pixelColumns[c - radius];
+                        }
+                    }
+                }
+            }
+
+            for (int r = rowStart; r < rowEnd; r++)
+            {
+                const float* sum = &sums[(size_t)(r - rowStart) * cols];
+                for (int c = 0; c < cols; c++)
+                    result[r][c] = (pixel)crop((int)(sum[c] + 0.5f));
+            }
+        });
+
+    free2d(plane, rows);
+    plane = result;
+
+    return true;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * The exact bilateral filter of one color plane, by brute force. Every
+ * pixel becomes the weighted mean of the pixels within 3 * sigmaS of it,
+ * each weighted by a Gaussian of its distance and a Gaussian of its
+ * difference in gray level. The window is clipped at the edges of the
+ * image. The work grows with the square of sigmaS, so this is only meant
+ * for checking the approximation on small images.
+ *
+ * @param[in,out] plane - the color plane to filter
+ * @param[in] rows - number of rows in the plane
+ * @param[in] cols - number of columns in the plane
+ * @param[in] sigmaS - standard deviation of the spatial weights
+ * @param[in] sigmaR - standard deviation of the range weights
+ *
+ * @returns true if the plane was filtered, false if memory ran out
+ *
+ * @par Example:
+   @verbatim
+   exactBilateralPlane(image.redgray, image.rows, image.cols, 3.0, 30.0);
+   @endverbatim
+ *
+ *****************************************************************************/
+static bool exactBilateralPlane(pixel**& plane, int rows, int cols,
+    double sigmaS, double sigmaR)
+{
+    int radius = (int)ceil(3 * sigmaS);
+    int size = 2 * radius + 1;
+    vector<double> spatial((size_t)size * size);
+    double range[256];
+    pixel** result = alloc2d(rows, cols);
+    int x, y, v;
+
+    if (result == nullptr)
+        return false;
+
+    for (y = -radius; y <= radius; y++)
+    {
+        for (x = -radius; x <= radius; x++)
+            spatial[(y + radius) * size + x + radius] =
+                exp(-(x * x + y * y) / (2 * sigmaS * sigmaS));
+    }
+    for (v = 0; v < 256; v++)
+        range[v] = exp(-v * v / (2 * sigmaR * sigmaR));
+
+    parallelFor(0, rows, [&](int rowStart, int rowEnd)
+        {
+            for (int r = rowStart; r < rowEnd; r++)
+            {
+                for (int c = 0; c < cols; c++)
+                {
+                    double weights = 0, sum = 0;
+                    int center = plane[r][c];
+
+                    for (int j = max(r - radius, 0);
+                        j <= min(r + radius, rows - 1); j++)
+                    {
+                        const double* near =
+                            &spatial[(j - r + radius) * size + radius - c];
+                        for (int i = max(c - radius, 0);
+                            i <= min(c + radius, cols - 1); i++)
+                        {
+                            double weight = near[i] *
+                                range[abs(plane[j][i] - center)];
+                            weights += weight;
+                            sum += weight * plane[j][i];
+                        }
+                    }
+
+                    result[r][c] = (pixel)crop((int)(sum / weights + 0.5));
+                }
+            }
+        });
+
+    free2d(plane, rows);
+    plane = result;
+
+    return true;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Bilateral filter. Smooths an image like a blur, except that pixels on the
+ * other side of an edge are weighted by how different they are, so edges
+ * stay sharp. The parameter is written "sigma_s,sigma_r": sigma_s is the
+ * spatial standard deviation in pixels and sigma_r the range standard
+ * deviation in gray levels; missing values are 3 and 30. The spatial
+ * Gaussian is approximated by a box of the same standard deviation, which
+ * bilateralPlane evaluates at a few gray levels. Adding ",exact" runs the
+ * brute force filter instead, so the approximation can be checked with
+ * --compare. Each color is filtered on its own.
+ *
+ * @param[in,out] image - structure for image information
+ * @param[in] settings - sigma_s, sigma_r and optionally exact, "3,30,exact"
+ *
+ * @returns true if every plane was filtered, false if memory ran out
+ *
+ * @par Example:
+   @verbatim
+   bilateral(image, "4,20")
+
+   Output:
+   a smoothed image with its edges kept
+   @endverbatim
+ *
+ *****************************************************************************/
+bool bilateral(image& image, string settings)
+{
+    pixel** planes[3] = { image.redgray, image.green, image.blue };
+    double sigmaS = 3, sigmaR = 30;
+    bool exact = settings.find(",exact") != string::npos;
+    bool ok = true;
+    int radius, k;
+
+    sscanf(settings.c_str(), "%lf,%lf", &sigmaS, &sigmaR);
+    sigmaS = max(0.5, min(sigmaS, 100.0));
+    sigmaR = max(1.0, min(sigmaR, 255.0));
+    radius = max(1, (int)sqrt(3 * sigmaS * sigmaS + 0.25));   // rounded
+
+    for (k = 0; k < 3 && ok; k++)
+    {
+        if (planes[k] == nullptr)
+            continue;
+        if (exact)
+            ok = exactBilateralPlane(planes[k], image.rows, image.cols,
+                sigmaS, sigmaR);
+        else
+            ok = bilateralPlane(planes[k], image.rows, image.cols, radius,
+                sigmaR);
+    }
+
+    image.redgray = planes[0];
+    image.green = planes[1];
+    image.blue = planes[2];
+
+    return ok;
+}
@@ -0,0 +1,443 @@
+/** ***************************************************************************
+ * @file
+ *
+ * @brief operations on P1/P4 bitmaps stored one bit per pixel, done 64
+ *        pixels at a time on whole words.
+ *
+ * Pixel c of a row is bit 63 - c % 64 of word c / 64, so the first pixel is
+ * the high bit just as in a P4 file, and 1 is black. The bits past the last
+ * column of a row are always kept 0, which lets whole words be counted and
+ * compared without masking.
+ *****************************************************************************/
+
+#include "netPBM.h"
+#include <vector>
+
+
+/**
+ * @brief moves the pixels of a packed row by offset: pixel c of dest gets
+ *        pixel c + offset of source, and pixels from outside the row are 0
+ */
+static void shiftPixels(const unsigned long long* source,
+    unsigned long long* dest, int words, int offset)
+{
+    int whole = abs(offset) / 64, part = abs(offset) % 64;
+    int i, j;
+
+    for (i = 0; i < words; i++)
+    {
+        unsigned long long word = 0;
+
+        if (offset >= 0)    // toward the first pixel, the high bits
+        {
+            j = i + whole;
+            if (j < words)
+                word = source[j] << part;
+            if (part != 0 && j + 1 < words)
+                word |= source[j + 1] >> (64 - part);
+        }
+        else
+        {
+            j = i - whole;
+            if (j >= 0)
+                word = source[j] >> part;
+            if (part != 0 && j - 1 >= 0)
+                word |= source[j - 1] << (64 - part);
+        }
+
+        dest[i] = word;
+    }
+}
+
+
+/**
+ * @brief mask of the bits of the last word of a row that hold pixels
+ */
+static unsigned long long lastWordMask(int cols)
+{
+    return cols % 64 == 0 ? ~0ULL : ~0ULL << (64 - cols % 64);
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Applies an operation to a bitmap without unpacking it, when the operation
+ * has a bitmap version: "--negate", "--crop", "--erode", "--dilate",
+ * "--open", "--close", "--and", "--or" and "--xor". Any other operation
+ * returns false so the caller can expand the bitmap with expandBitmap and
+ * run the usual version. Whether a bitmap operation worked is set in ok.
+ *
+ * @param[in,out] picture - image structure holding a bitmap
+ * @param[in] option - the operation option, for example "--negate"
+ * @param[in] parameter - the text given with the option, empty if none
+ * @param[out] ok - false if the bitmap operation failed, true otherwise
+ *
+ * @returns true if the operation was done on the bitmap, false otherwise
+ *
+ * @par Example:
+   @verbatim
+   if (!bitmapOperation(image, "--smooth", "", ok))
+       expandBitmap(image);
+   @endverbatim
+ *
+ *****************************************************************************/
+bool bitmapOperation(image& picture, string option, string parameter,
+    bool& ok)
+{
+    int words = (picture.cols + 63) / 64;
+    unsigned long long last = lastWordMask(picture.cols);
+
+    ok = true;
+    if (option == "--negate")
+    {
+        parallelFor(0, picture.rows, [&](int rowStart, int rowEnd)
+            {
+                for (int r = rowStart; r < rowEnd; r++)
+                {
+                    for (int w = 0; w < words; w++)
+                        picture.bits[r][w] = ~picture.bits[r][w];
+                    picture.bits[r][words - 1] &= last;
+                }
+            });
+    }
+    else if (option == "--crop")
+        ok = cropImage(picture, parameter);
+    else if (option == "--erode" || option == "--dilate" ||
+        option == "--open" || option == "--close")
+        ok = morphology(picture, option, parameter);
+    else if (option == "--and" || option == "--or" || option == "--xor")
+        ok = maskBits(picture, option, parameter);
+    else
+        return false;
+
+    return true;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Unpacks a bitmap into the three color planes, 0 for black and 255 for
+ * white, so the operations that only work on pixels can run on it. The image
+ * becomes a P2 or P5 image, like a grayscale file that was read in.
+ *
+ * @param[in,out] picture - image structure holding a bitmap
+ *
+ * @returns true if the bitmap was unpacked, false if memory ran out
+ *
+ * @par Example:
+   @verbatim
+   expandBitmap(image);
+   @endverbatim
+ *
+ *****************************************************************************/
+bool expandBitmap(image& picture)
+{
+    picture.redgray = alloc2d(picture.rows, picture.cols);
+    picture.green = alloc2d(picture.rows, picture.cols);
+    picture.blue = alloc2d(picture.rows, picture.cols);
+
+    if (picture.redgray == nullptr || picture.green == nullptr ||
+        picture.blue == nullptr)
+    {
+        freeImage(picture);
+        return false;
+    }
+
+    parallelFor(0, picture.rows, [&](int rowStart, int rowEnd)
+        {
+            for (int r = rowStart; r < rowEnd; r++)
+            {
+                const unsigned long long* bits = picture.bits[r];
+
+                for (int c = 0; c < picture.cols; c++)
+                    picture.redgray[r][c] = (bits[c / 64] >> (63 - c % 64)) & 1 ?
+                        0 : 255;
+                memcpy(picture.green[r], picture.redgray[r], picture.cols);
+                memcpy(picture.blue[r], picture.redgray[r], picture.cols);
+            }
+        });
+
+    freeBits(picture.bits, picture.rows);
+    picture.magicNumber = picture.magicNumber == "P1" ? "P2" : "P5";
+
+    return true;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Erodes or dilates a bitmap with a rectangle, 64 pixels per word operation.
+ * The results match the grayscale operations on the unpacked bitmap: erode
+ * takes the darkest pixel under the rectangle, so a pixel is black if any
+ * pixel under the rectangle is black, which is the OR of the bits. Dilate is
+ * the AND of the bits, done as the OR of the negated bits, negated back.
+ *
+ * Across each row the OR of width pixels is built by doubling: OR-ing a row
+ * with itself moved by 1 pixel gives runs of 2, moving that by 2 gives runs
+ * of 4, and so on, and a last move covers what is left, so a row takes about
+ * log2(width) passes over its words. Down the columns the same doubling
+ * ORs each row with the row 1, 2, 4, ... below it, a pass over the whole
+ * bitmap at a time between two buffers, so tall rectangles take about
+ * log2(height) passes too. The rows start top rows down in those buffers,
+ * below empty rows, so the runs down the columns come out centered. Each
+ * row is first moved right by half the width, into a buffer wide enough to
+ * keep its last pixels, so the runs across it come out centered. Pixels outside the bitmap never change the result; the
+ * border where the rectangle does not fit is set black by borderBits.
+ *
+ * @param[in,out] picture - image structure holding a bitmap
+ * @param[in] width - width of the rectangle
+ * @param[in] height - height of the rectangle
+ * @param[in] dilate - true to dilate, false to erode
+ *
+ * @returns true if the bitmap was filtered, false if memory ran out
+ *
+ * @par Example:
+   @verbatim
+   morphBits(image, 5, 5, false);
+   @endverbatim
+ *
+ *****************************************************************************/
+bool morphBits(image& picture, int width, int height, bool dilate)
+{
+    int rows = picture.rows, words = (picture.cols + 63) / 64;
+    int top = (height - 1) / 2, left = (width - 1) / 2;
+    int wide = (picture.cols + left + 63) / 64;     // room for the shift
+    unsigned long long flip = dilate ? ~0ULL : 0;
+    unsigned long long last = lastWordMask(picture.cols);
+    unsigned long long** across = allocBits(rows + top, picture.cols);
+    unsigned long long** down = allocBits(rows + top, picture.cols);
+    unsigned long long** result = allocBits(rows, picture.cols);
+    int length = 1;
+
+    if (across == nullptr || down == nullptr || result == nullptr)
+    {
+        freeBits(across, rows + top);
+        freeBits(down, rows + top);
+        freeBits(result, rows);
+        return false;
+    }
+
+    parallelFor(0, rows, [&](int rowStart, int rowEnd)     // along the rows
+        {
+            vector<unsigned long long> run(wide), moved(wide);
+
+            for (int r = rowStart; r < rowEnd; r++)
+            {
+                int length = 1;
+
+                for (int w = 0; w < wide; w++)
+                    moved[w] = w < words ? picture.bits[r][w] ^ flip : 0;
+                moved[words - 1] &= last;
+                shiftPixels(&moved[0], &run[0], wide, -left);   // center it
+
+                while (length < width)      // OR of length pixels from c - left
+                {
+                    int step = min(length, width - length);
+                    shiftPixels(&run[0], &moved[0], wide, step);
+                    for (int w = 0; w < wide; w++)
+                        run[w] |= moved[w];
+                    length += step;
+                }
+
+                memcpy(across[r + top], &run[0],
+                    words * sizeof(unsigned long long));
+            }
+        });
+
+    while (length < height)         // OR of length rows from r - top
+    {
+        int step = min(length, height - length);
+
+        parallelFor(0, rows + top, [&](int rowStart, int rowEnd)
+            {
+                for (int r = rowStart; r < rowEnd; r++)
+                {
+                    for (int w = 0; w < words; w++)
+                        down[r][w] = across[r][w] |
+                            (r + step < rows + top ? across[r + step][w] : 0);
+                }
+            });
+        swap(across, down);
+        length += step;
+    }
+
+    parallelFor(0, rows, [&](int rowStart, int rowEnd)
+        {
+            for (int r = rowStart; r < rowEnd; r++)
+            {
+                for (int w = 0; w < words; w++)
+                    result[r][w] = across[r][w] ^ flip;
+                result[r][words - 1] &= last;
+            }
+        });
+
+    freeBits(across, rows + top);
+    freeBits(down, rows + top);
+    freeBits(picture.bits, rows);
+    picture.bits = result;
+
+    return true;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Sets the pixels around the edge of a bitmap to black, the bitmap version
+ * of clearBorder. The bands may be wider on some sides than others.
+ *
+ * @param[in,out] picture - image structure holding a bitmap
+ * @param[in] top - number of rows to set at the top
+ * @param[in] left - number of columns to set on the left
+ * @param[in] bottom - number of rows to set at the bottom
+ * @param[in] right - number of columns to set on the right
+ *
+ * @par Example:
+   @verbatim
+   borderBits(image, 1, 1, 1, 1);
+   @endverbatim
+ *
+ *****************************************************************************/
+void borderBits(image& picture, int top, int left, int bottom, int right)
+{
+    int words = (picture.cols + 63) / 64;
+    unsigned long long last = lastWordMask(picture.cols);
+    vector<unsigned long long> edges(words, 0), all(words, ~0ULL);
+    int r, c, w;
+
+    all[words - 1] = last;
+    for (c = 0; c < picture.cols; c++)  // the side bands of the middle rows
+        if (c < left || c >= picture.cols - right)
+            edges[c / 64] |= 1ULL << (63 - c % 64);
+
+    for (r = 0; r < picture.rows; r++)
+    {
+        bool whole = r < top || r >= picture.rows - bottom;
+        for (w = 0; w < words; w++)
+            picture.bits[r][w] |= whole ? all[w] : edges[w];
+    }
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Combines a bitmap with a mask bitmap of the same size read from a file,
+ * a word at a time: "--and" keeps the black pixels that are black in both,
+ * "--or" the pixels black in either and "--xor" the pixels black in only
+ * one. A mask that cannot be read, is not a bitmap, or is a different size
+ * leaves the bitmap alone, with the reason in lastFailure.
+ *
+ * @param[in,out] picture - image structure holding a bitmap
+ * @param[in] option - "--and", "--or" or "--xor"
+ * @param[in] maskFile - name of the P1/P4 mask file
+ *
+ * @returns true if the mask was applied, false otherwise
+ *
+ * @par Example:
+   @verbatim
+   maskBits(image, "--and", "mask.pbm");
+   @endverbatim
+ *
+ *****************************************************************************/
+bool maskBits(image& picture, string option, string maskFile)
+{
+    int words = (picture.cols + 63) / 64;
+    image mask;
+    ifstream fin;
+
+    if (!openInput(maskFile, fin) || !readImage(fin, mask))
+        return false;
+
+    if (mask.bits == nullptr || mask.rows != picture.rows ||
+        mask.cols != picture.cols)
+    {
+        lastFailure = maskFile + " is not a " + to_string(picture.cols) +
+            "x" + to_string(picture.rows) + " bitmap";
+        freeImage(mask);
+        return false;
+    }
+
+    parallelFor(0, picture.rows, [&](int rowStart, int rowEnd)
+        {
+            for (int r = rowStart; r < rowEnd; r++)
+            {
+                unsigned long long* row = picture.bits[r];
+                const unsigned long long* other = mask.bits[r];
+
+                if (option == "--and")
+                    for (int w = 0; w < words; w++)
+                        row[w] &= other[w];
+                else if (option == "--or")
+                    for (int w = 0; w < words; w++)
+                        row[w] |= other[w];
+                else
+                    for (int w = 0; w < words; w++)
+                        row[w] ^= other[w];
+            }
+        });
+
+    freeImage(mask);
+
+    return true;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Cuts the columns [left, left + width) of every kept row out of a bitmap.
+ * Each output word is put together from the two input words it straddles
+ * with one shift each, so a row is copied 64 pixels at a time.
+ *
+ * @param[in,out] picture - image structure holding a bitmap
+ * @param[in] top - first row to keep
+ * @param[in] left - first column to keep
+ * @param[in] width - number of columns to keep
+ * @param[in] height - number of rows to keep
+ *
+ * @returns true if the bitmap was cropped, false if memory ran out
+ *
+ * @par Example:
+   @verbatim
+   cropBits(image, 10, 20, 64, 32);
+   @endverbatim
+ *
+ *****************************************************************************/
+bool cropBits(image& picture, int top, int left, int width, int height)
+{
+    int words = (picture.cols + 63) / 64, kept = (width + 63) / 64;
+    unsigned long long last = lastWordMask(width);
+    unsigned long long** result = allocBits(height, width);
+
+    if (result == nullptr)
+        return false;
+
+    parallelFor(0, height, [&](int rowStart, int rowEnd)
+        {
+            vector<unsigned long long> moved(words);
+
+            for (int r = rowStart; r < rowEnd; r++)
+            {
+                shiftPixels(picture.bits[top + r], &moved[0], words, left);
+                memcpy(result[r], &moved[0], kept * sizeof(unsigned long long));
+                result[r][kept - 1] &= last;
+            }
+        });
+
+    freeBits(picture.bits, picture.rows);
+    picture.bits = result;
+    picture.rows = height;
+    picture.cols = width;
+
+    return true;
+}
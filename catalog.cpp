@@ -0,0 +1,477 @@
+/** ***************************************************************************
+ * @file
+ *
+ * @brief lists the size, type and comments of many images from their
+ *        headers alone, and keeps them in an index that later scans reuse.
+ *****************************************************************************/
+
+#include "netPBM.h"
+#include <filesystem>
+#include <sys/stat.h>
+#include <unordered_map>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Returns true if a file name looks like an image thpe01 reads: .ppm, .pgm,
+ * .pbm, .pnm, .pam or .qoi, optionally followed by .gz or .zst. Only files found
+ * in a directory are filtered this way; a file named on the command line
+ * is always read.
+ *
+ * @param[in] path - path of the file
+ *
+ * @returns true if the name has an image extension, false otherwise
+ *
+ * @par Example:
+   @verbatim
+   isImageName("scans/a.ppm.gz");
+
+   Output:
+   true
+   @endverbatim
+ *
+ *****************************************************************************/
+static bool isImageName(const fs::path& path)
+{
+    const string types[] = { ".ppm", ".pgm", ".pbm", ".pnm", ".pam",
+        ".qoi" };
+    fs::path name = path.filename();
+    string extension;
+
+    if (name.extension() == ".gz" || name.extension() == ".zst")
+        name = name.stem();
+
+    extension = name.extension().string();
+    transform(extension.begin(), extension.end(), extension.begin(),
+        [](unsigned char ch) { return (char)tolower(ch); });
+
+    return find(begin(types), end(types), extension) != end(types);
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Escapes the backslashes, tabs and line breaks of a field so it fits in
+ * one column of a tab separated line.
+ *
+ * @param[in] text - the field
+ *
+ * @returns the escaped field
+ *
+ * @par Example:
+   @verbatim
+   escapeField("# one\n# two");
+
+   Output:
+   # one\n# two
+   @endverbatim
+ *
+ *****************************************************************************/
+static string escapeField(const string& text)
+{
+    string escaped;
+
+    for (char ch : text)
+    {
+        if (ch == '\\')
+            escaped += "\\\\";
+        else if (ch == '\t')
+            escaped += "\\t";
+        else if (ch == '\n')
+            escaped += "\\n";
+        else if (ch == '\r')
+            escaped += "\\r";
+        else
+            escaped += ch;
+    }
+
+    return escaped;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Undoes escapeField.
+ *
+ * @param[in] text - the escaped field
+ *
+ * @returns the field as it was before it was escaped
+ *
+ * @par Example:
+   @verbatim
+   unescapeField("# one\\n# two");
+   @endverbatim
+ *
+ *****************************************************************************/
+static string unescapeField(const string& text)
+{
+    string field;
+    size_t i;
+
+    for (i = 0; i < text.size(); i++)
+    {
+        if (text[i] != '\\' || i + 1 == text.size())
+        {
+            field += text[i];
+            continue;
+        }
+
+        i++;
+        if (text[i] == 't')
+            field += '\t';
+        else if (text[i] == 'n')
+            field += '\n';
+        else if (text[i] == 'r')
+            field += '\r';
+        else
+            field += text[i];
+    }
+
+    return field;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Writes the information of one image as a tab separated line: path, last
+ * write time, file size, magic number, columns, rows, max value and the
+ * comment. The comment keeps the '#' of each line, and its line breaks are
+ * escaped.
+ *
+ * @param[in] fout - reference to output stream
+ * @param[in] info - the information to write
+ *
+ * @par Example:
+   @verbatim
+   writeInfo(cout, info);
+
+   Output:
+   scans/a.ppm  1697712000  921615  P6  640  480  255  # scanner 2
+   @endverbatim
+ *
+ *****************************************************************************/
+static void writeInfo(ostream& fout, const imageInfo& info)
+{
+    fout << escapeField(info.path) << '\t' << info.modified << '\t'
+        << info.size << '\t' << info.magicNumber << '\t' << info.cols << '\t'
+        << info.rows << '\t' << info.maxValue << '\t'
+        << escapeField(info.comment) << '\n';
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Reads a line written by writeInfo back into an imageInfo.
+ *
+ * @param[in] line - the tab separated line
+ * @param[out] info - the information on the line
+ *
+ * @returns true if the line has every field, false otherwise
+ *
+ * @par Example:
+   @verbatim
+   parseInfo(line, info);
+   @endverbatim
+ *
+ *****************************************************************************/
+static bool parseInfo(const string& line, imageInfo& info)
+{
+    vector<string> fields;
+    istringstream columns(line);
+    string field;
+
+    while (getline(columns, field, '\t'))
+        fields.push_back(field);
+    if (fields.size() == 7)         // an empty comment leaves no field
+        fields.push_back("");
+    if (fields.size() != 8)
+        return false;
+
+    info.path = unescapeField(fields[0]);
+    info.modified = atoll(fields[1].c_str());
+    info.size = atoll(fields[2].c_str());
+    info.magicNumber = fields[3];
+    info.cols = atoi(fields[4].c_str());
+    info.rows = atoi(fields[5].c_str());
+    info.maxValue = atoi(fields[6].c_str());
+    info.comment = unescapeField(fields[7]);
+
+    return info.path != "" && info.cols > 0 && info.rows > 0;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Reads the type, size, max value and comment of an image from its header,
+ * without reading any pixels, so only the first few KB of the file are
+ * read. Compressed files are read through the same decompression as
+ * openInput. The file size and last write time are not filled in here.
+ *
+ * @param[in] fileName - name of the image file
+ * @param[out] info - the information in the header
+ *
+ * @returns true if the file starts with an image header, false otherwise
+ *
+ * @par Example:
+   @verbatim
+   readImageInfo("scans/a.ppm", info);
+   @endverbatim
+ *
+ *****************************************************************************/
+bool readImageInfo(string fileName, imageInfo& info)
+{
+    const string types[] = { "P1", "P2", "P3", "P4", "P5", "P6", "P7",
+        "qoif" };
+    ifstream fin(fileName, ios::in | ios::binary);
+    image header;
+
+    if (!fin.is_open() || !attachDecompressor(fileName, fin))
+        return false;
+
+    readHeader(fin, header);
+    if (!fin || header.cols <= 0 || header.rows <= 0 ||
+        find(begin(types), end(types), header.magicNumber) == end(types))
+        return false;
+
+    info.path = fileName;
+    info.magicNumber = header.magicNumber;
+    info.cols = header.cols;
+    info.rows = header.rows;
+    info.maxValue = (header.magicNumber == "P1" ||
+        header.magicNumber == "P4") ? 1 : header.maxValue;
+    info.comment = header.comment.empty() ? "" : header.comment.substr(1);
+
+    return true;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Returns the last write time of a file in seconds since 1970, the same on
+ * every platform and compiler, so an index can be read by other tools and
+ * moved between machines. The file clock of std::filesystem counts from an
+ * epoch and in ticks the library chooses, so the time is read with stat.
+ *
+ * @param[in] file - path of the file
+ *
+ * @returns the Unix time of the last write, or -1 if it could not be read
+ *
+ * @par Example:
+   @verbatim
+   modifiedTime("scans/a.ppm");
+
+   Output:
+   1697712000
+   @endverbatim
+ *
+ *****************************************************************************/
+static long long modifiedTime(const fs::path& file)
+{
+#ifdef _WIN32
+    struct _stat64 status;
+    if (_wstat64(file.c_str(), &status) != 0)
+        return -1;
+#else
+    struct stat status;
+    if (stat(file.c_str(), &status) != 0)
+        return -1;
+#endif
+
+    return (long long)status.st_mtime;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Writes the header information of every image in a list of files and
+ * directories to listing, one tab separated line each after a line of
+ * column names.
+ * Directories are searched recursively for files with image extensions.
+ * The headers are read in parallel. The modified column is the Unix time of
+ * the last write, in seconds.
+ *
+ * When an index file is given, images whose size and last write time match
+ * their entry in it are not opened at all. The index is then rewritten with
+ * the images just scanned, the entries of other images that still exist,
+ * and without the ones that were deleted, so each scan of a large tree only
+ * reads the headers of new and changed files. The index is written to a
+ * temporary file and renamed, so an interrupted scan leaves the old one.
+ * A count of the headers read and reused is left in lastReport, and the
+ * files that could not be listed in lastFailure, one line each.
+ *
+ * @param[in] paths - files and directories to scan
+ * @param[in] indexFile - name of the index file, empty for none
+ * @param[in,out] listing - the stream the lines are written to
+ *
+ * @returns 0 after the scan, 1 if a file could not be read, was not an
+ *          image or the index could not be written
+ *
+ * @par Example:
+   @verbatim
+   catalogImages({ "scans" }, "scans.tsv", cout);
+
+   Output:
+   path  modified  size  magic  cols  rows  maxvalue  comment
+   scans/a.ppm  1697712000  921615  P6  640  480  255  # scanner 2
+   @endverbatim
+ *
+ *****************************************************************************/
+int catalogImages(vector<string> paths, string indexFile, ostream& listing)
+{
+    unordered_map<string, imageInfo> index;
+    vector<imageInfo> found;
+    vector<char> fresh, valid;
+    error_code error;
+    ifstream fin;
+    ofstream fout;
+    string line, problems, temporary = indexFile + ".tmp";
+    size_t i, read = 0;
+    int status = 0;
+
+    if (indexFile != "")
+    {
+        fin.open(indexFile);
+        getline(fin, line);                 // skip the column names
+        while (getline(fin, line))
+        {
+            imageInfo info;
+            if (parseInfo(line, info))
+                index[info.path] = info;
+        }
+        fin.close();
+    }
+
+    for (const string& path : paths)        // find the files
+    {
+        vector<fs::path> files;
+
+        if (fs::is_directory(path, error))
+        {
+            fs::recursive_directory_iterator walk(path,
+                fs::directory_options::skip_permission_denied, error), last;
+            for (; walk != last; walk.increment(error))
+            {
+                if (walk->is_regular_file(error) && isImageName(walk->path()))
+                    files.push_back(walk->path());
+            }
+            sort(files.begin(), files.end());
+        }
+        else
+            files.push_back(path);
+
+        for (const fs::path& file : files)
+        {
+            imageInfo info;
+            info.path = file.string();
+            info.size = (long long)fs::file_size(file, error);
+            if (error)
+            {
+                problems += "Unable to read " + info.path + '\n';
+                status = 1;
+                continue;
+            }
+            info.modified = modifiedTime(file);
+            found.push_back(info);
+        }
+    }
+
+    fresh.assign(found.size(), 0);
+    valid.assign(found.size(), 1);
+    for (i = 0; i < found.size(); i++)     // reuse the unchanged entries
+    {
+        auto entry = index.find(found[i].path);
+        if (entry != index.end() && entry->second.size == found[i].size &&
+            entry->second.modified == found[i].modified)
+            found[i] = entry->second;
+        else
+            fresh[i] = 1;
+    }
+
+    parallelFor(0, (int)found.size(), [&](int first, int last)
+        {
+            for (int k = first; k < last; k++)
+            {
+                imageInfo info = found[k];
+                if (fresh[k] && !(valid[k] = readImageInfo(info.path, info)))
+                    continue;
+                if (fresh[k])
+                {
+                    info.size = found[k].size;
+                    info.modified = found[k].modified;
+                    found[k] = info;
+                }
+            }
+        });
+
+    listing << "path\tmodified\tsize\tmagic\tcols\trows\tmaxvalue\tcomment\n";
+    for (i = 0; i < found.size(); i++)
+    {
+        if (!valid[i])
+        {
+            problems += found[i].path + " is not an image\n";
+            status = 1;
+            continue;
+        }
+        writeInfo(listing, found[i]);
+        read += fresh[i];
+    }
+    listing.flush();
+
+    lastReport = to_string(found.size()) + " files, " + to_string(read) +
+        " headers read, " + to_string(count(fresh.begin(), fresh.end(), 0)) +
+        " from the index\n";
+    lastFailure = problems.substr(0, problems.size() - (problems != ""));
+
+    if (indexFile == "")
+        return status;
+
+    for (i = 0; i < found.size(); i++)      // this scan replaces its entries
+        index.erase(found[i].path);
+
+    if (!openOutput(temporary, fout))
+    {
+        lastFailure = problems + "Unable to write the index " + indexFile;
+        return 1;
+    }
+
+    fout << "path\tmodified\tsize\tmagic\tcols\trows\tmaxvalue\tcomment\n";
+    for (i = 0; i < found.size(); i++)
+    {
+        if (valid[i])
+            writeInfo(fout, found[i]);
+    }
+    for (auto& entry : index)               // other images, unless deleted
+    {
+        if (fs::exists(entry.first, error))
+            writeInfo(fout, entry.second);
+    }
+    finishOutput(temporary, fout);
+
+    fs::rename(temporary, indexFile, error);
+    if (!fout || error)
+    {
+        lastFailure = problems + "Unable to write the index " + indexFile;
+        return 1;
+    }
+
+    return status;
+}
@@ -0,0 +1,178 @@
+/** ***************************************************************************
+ * @file
+ *
+ * @brief blends an overlay image with an alpha channel onto an image.
+ *****************************************************************************/
+
+#include "netPBM.h"
+#include <cstdio>
+#include <vector>
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Blends one row of an overlay onto a row of an image that has its own
+ * alpha plane. The image colors are premultiplied by the image alpha, the
+ * overlay is blended onto them and onto the alpha by the overRow kernel,
+ * and the colors are divided by the new alpha again. Pixels where the
+ * overlay is transparent are left exactly as they were.
+ *
+ * @param[in] over - the overlay color planes, already at the first column
+ * @param[in] overAlpha - the overlay alpha, already at the first column
+ * @param[in,out] base - the image color planes, already at the first column
+ * @param[in,out] baseAlpha - the image alpha, already at the first column
+ * @param[in] opaque - a row of 255s at least width long
+ * @param[in] width - number of pixels to blend
+ *
+ * @par Example:
+   @verbatim
+   overTransparentRow(over, overAlpha, base, baseAlpha, opaque, width);
+   @endverbatim
+ *
+ *****************************************************************************/
+static void overTransparentRow(const pixel* over[3], const pixel* overAlpha,
+    pixel* base[3], pixel* baseAlpha, const pixel* opaque, int width)
+{
+    int k, c, x;
+
+    for (k = 0; k < 3; k++)
+    {
+        if (base[k] == nullptr)
+            continue;
+
+        for (c = 0; c < width; c++)     // premultiply the image colors
+        {
+            if (overAlpha[c] == 0)
+                continue;
+            x = base[k][c] * baseAlpha[c] + 128;
+            base[k][c] = (pixel)((x + (x >> 8)) >> 8);
+        }
+        kernels.overRow(over[k], overAlpha, base[k], width);
+    }
+
+    kernels.overRow(opaque, overAlpha, baseAlpha, width);
+
+    for (k = 0; k < 3; k++)             // and divide the new alpha out
+    {
+        if (base[k] == nullptr)
+            continue;
+
+        for (c = 0; c < width; c++)
+        {
+            if (overAlpha[c] != 0 && baseAlpha[c] != 0)
+                base[k][c] = (pixel)min((base[k][c] * 255 + baseAlpha[c] / 2)
+                    / baseAlpha[c], 255);
+        }
+    }
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Blends an overlay image, such as an annotation or a watermark, onto the
+ * image with the over operator. The parameter is the overlay file name,
+ * optionally followed by "@col,row" for where its top left corner goes,
+ * which may be off the image; only the part that lands on the image is
+ * blended. An overlay without alpha covers the image. Otherwise each color
+ * row is blended by the overRow kernel picked for this processor, which
+ * works in fixed point on the premultiplied overlay and skips the spans
+ * where the overlay is fully transparent. When the image has alpha too,
+ * its alpha becomes the combined coverage of both. The rows are split
+ * across threads.
+ *
+ * @param[in,out] picture - structure for image information
+ * @param[in] overlay - the overlay file and offset, such as "logo.pam@20,10"
+ *
+ * @returns true if the overlay was blended, false if it could not be read,
+ *          missed the image or memory ran out, with the reason in
+ *          lastFailure
+ *
+ * @par Example:
+   @verbatim
+   overlayImage(image, "logo.pam@20,10");
+
+   Output:
+   the image with the logo on it, 20 columns from the left, 10 rows down
+   @endverbatim
+ *
+ *****************************************************************************/
+bool overlayImage(image& picture, string overlay)
+{
+    string fileName = overlay;
+    size_t at = overlay.rfind('@');
+    int left = 0, top = 0, first, last, width;
+    image layer;
+    ifstream fin;
+
+    if (at != string::npos && sscanf(overlay.c_str() + at + 1, "%d,%d", &left,
+        &top) == 2)
+        fileName = overlay.substr(0, at);
+
+    if (!openInput(fileName, fin))
+        return false;
+    if (!readImage(fin, layer))
+    {
+        lastFailure = fileName + " is not a readable image";
+        return false;
+    }
+    if ((layer.bits != nullptr && !expandBitmap(layer)) ||
+        (layer.maxValue > 255 && !narrowImage(layer)))
+    {
+        freeImage(layer);
+        return false;
+    }
+
+    first = max(left, 0);
+    last = min(left + layer.cols, picture.cols);
+    width = last - first;
+    if (width <= 0 || max(top, 0) >= min(top + layer.rows, picture.rows))
+    {
+        lastFailure = fileName + " is outside the image";
+        freeImage(layer);
+        return false;
+    }
+
+    parallelFor(max(top, 0), min(top + layer.rows, picture.rows),
+        [&](int rowStart, int rowEnd)
+        {
+            vector<pixel> opaque(width, 255);
+
+            for (int r = rowStart; r < rowEnd; r++)
+            {
+                int y = r - top, x = first - left;
+                const pixel* over[3] = { layer.redgray[y] + x,
+                    layer.green[y] + x, layer.blue[y] + x };
+                pixel* base[3] = { picture.redgray[r] + first,
+                    picture.green == nullptr ? nullptr :
+                    picture.green[r] + first, picture.blue == nullptr ?
+                    nullptr : picture.blue[r] + first };
+
+                if (layer.alpha == nullptr)     // an opaque overlay covers
+                {
+                    for (int k = 0; k < 3; k++)
+                        if (base[k] != nullptr)
+                            memcpy(base[k], over[k], width);
+                    if (picture.alpha != nullptr)
+                        memset(picture.alpha[r] + first, 255, width);
+                }
+                else if (picture.alpha == nullptr)
+                {
+                    for (int k = 0; k < 3; k++)
+                        if (base[k] != nullptr)
+                            kernels.overRow(over[k], layer.alpha[y] + x,
+                                base[k], width);
+                }
+                else
+                    overTransparentRow(over, layer.alpha[y] + x, base,
+                        picture.alpha[r] + first, opaque.data(), width);
+            }
+        });
+
+    freeImage(layer);
+
+    return true;
+}
@@ -0,0 +1,689 @@
+/** ***************************************************************************
+ * @file
+ *
+ * @brief reads and writes gzip and zstd compressed images on the fly, with
+ *        decompression on a thread of its own.
+ *****************************************************************************/
+
+#include "netPBM.h"
+#include <atomic>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+
+/******************************************************************************
+ *                              Constants
+ *****************************************************************************/
+const size_t chunkSize = 262144;   /**< bytes handed between the threads */
+
+
+/******************************************************************************
+ *                              Class
+ *****************************************************************************/
+/**
+ * @brief A stream buffer that reads a compressed file. A thread of its own
+ *        reads and decompresses the file into chunks and passes them through
+ *        a bounded queue, so decompression runs while the image is parsed
+ *        and processed. An empty chunk marks the end of the data.
+ */
+class decompressBuffer : public streambuf
+{
+public:
+    /**
+     * @brief starts decompressing a file on a new thread
+     * @param[in] source - the open compressed file, closed with the buffer
+     * @param[in] format - compression of the file
+     * @param[in,out] reader - the stream the buffer is read through
+     */
+    decompressBuffer(FILE* source, compression format, istream& reader) :
+        file(source), stream(reader), chunks(4), stopping(false),
+        broken(false)
+    {
+        worker = thread([this, format] { decompress(format); });
+    }
+
+    /**
+     * @brief stops the thread, which may be waiting on a full queue, and
+     *        closes the file
+     */
+    ~decompressBuffer() override
+    {
+        vector<char>* chunk = current;
+
+        stopping = true;
+        while (chunk == nullptr || !chunk->empty())  // up to the end marker
+        {
+            delete chunk;
+            chunk = chunks.pop();
+        }
+        delete chunk;
+
+        worker.join();
+        fclose(file);
+    }
+
+protected:
+    /**
+     * @brief moves to the next chunk when the current one is used up. When
+     *        the file is damaged or ends early, the end of what could be
+     *        decompressed sets badbit on the stream, and lastFailure says
+     *        why. Readers that use the buffer directly see it as well.
+     * @returns the next character, or EOF at the end of the data
+     */
+    int_type underflow() override
+    {
+        if (current == nullptr || !current->empty())
+        {
+            delete current;
+            current = chunks.pop();
+        }
+
+        if (current->empty())           // the end marker
+        {
+            if (broken && !stream.bad())
+            {
+                lastFailure = "The compressed data is damaged or ends early";
+                stream.setstate(ios::badbit);
+            }
+            return traits_type::eof();
+        }
+
+        setg(current->data(), current->data(),
+            current->data() + current->size());
+        return traits_type::to_int_type(*gptr());
+    }
+
+private:
+    /**
+     * @brief passes a full chunk to the reader and starts a new one
+     * @param[in,out] chunk - the chunk to pass on, replaced by an empty one
+     * @returns false once the reader has stopped reading
+     */
+    bool deliver(vector<char>*& chunk)
+    {
+        chunks.push(chunk);
+        chunk = new vector<char>();
+        chunk->reserve(chunkSize);
+        return !stopping;
+    }
+
+    /**
+     * @brief the thread that reads and decompresses the file
+     * @param[in] format - compression of the file
+     */
+    void decompress([[maybe_unused]] compression format)
+    {
+        vector<char>* chunk = new vector<char>();
+
+        chunk->reserve(chunkSize);
+
+#ifdef HAVE_ZLIB
+        if (format == COMPRESS_GZIP && !readGzip(chunk))
+            broken = !stopping;
+#endif
+#ifdef HAVE_ZSTD
+        if (format == COMPRESS_ZSTD && !readZstd(chunk))
+            broken = !stopping;
+#endif
+
+        if (!chunk->empty())
+            chunks.push(chunk);
+        else
+            delete chunk;
+        chunks.push(new vector<char>());    // end of the data
+    }
+
+#ifdef HAVE_ZLIB
+    /**
+     * @brief decompresses a gzip file into chunks. The file may hold several
+     *        members, which are read one after another.
+     * @param[in,out] chunk - the chunk being filled
+     * @returns true if the data ended at the end of a member, false if it
+     *          is damaged, ends early or the reader stopped first
+     */
+    bool readGzip(vector<char>*& chunk)
+    {
+        vector<char> input(65536);
+        z_stream z = {};
+        int status = Z_OK;
+        size_t have, produced;
+        bool ok;
+
+        ok = inflateInit2(&z, 15 + 32) == Z_OK;    // gzip or zlib header
+        while (ok && (have = fread(input.data(), 1, input.size(), file)) > 0)
+        {
+            z.next_in = (Bytef*)input.data();
+            z.avail_in = (uInt)have;
+            while (ok && z.avail_in > 0)
+            {
+                if (status == Z_STREAM_END)     // another member follows
+                    inflateReset(&z);
+
+                produced = chunk->size();
+                chunk->resize(chunkSize);
+                z.next_out = (Bytef*)chunk->data() + produced;
+                z.avail_out = (uInt)(chunkSize - produced);
+                status = inflate(&z, Z_NO_FLUSH);
+                chunk->resize(chunkSize - z.avail_out);
+                ok = status == Z_OK || status == Z_STREAM_END;
+                if (ok && chunk->size() == chunkSize)
+                    ok = deliver(chunk);
+            }
+        }
+        inflateEnd(&z);
+
+        return ok && status == Z_STREAM_END && !ferror(file);
+    }
+#endif
+
+#ifdef HAVE_ZSTD
+    /**
+     * @brief decompresses a zstd file into chunks
+     * @param[in,out] chunk - the chunk being filled
+     * @returns true if the data ended at the end of a frame, false if it
+     *          is damaged, ends early or the reader stopped first
+     */
+    bool readZstd(vector<char>*& chunk)
+    {
+        vector<char> input(ZSTD_DStreamInSize());
+        ZSTD_DStream* z = ZSTD_createDStream();
+        size_t have, hint = 0;
+        bool ok = z != nullptr;
+
+        while (ok && (have = fread(input.data(), 1, input.size(), file)) > 0)
+        {
+            ZSTD_inBuffer in = { input.data(), have, 0 };
+            while (ok && in.pos < in.size)
+            {
+                ZSTD_outBuffer out = { nullptr, chunkSize, chunk->size() };
+
+                chunk->resize(chunkSize);
+                out.dst = chunk->data();
+                hint = ZSTD_decompressStream(z, &out, &in);
+                ok = !ZSTD_isError(hint);
+                chunk->resize(out.pos);
+                if (ok && chunk->size() == chunkSize)
+                    ok = deliver(chunk);
+            }
+        }
+        ZSTD_freeDStream(z);
+
+        return ok && hint == 0 && !ferror(file);
+    }
+#endif
+
+    FILE* file;                             /**< the compressed file */
+    istream& stream;                        /**< the stream reading it */
+    boundedQueue<vector<char>*> chunks;     /**< decompressed chunks */
+    vector<char>* current = nullptr;        /**< chunk being read */
+    atomic<bool> stopping;                  /**< set when reading stops */
+    atomic<bool> broken;                    /**< set if the data is bad */
+    thread worker;                          /**< decompresses the file */
+};
+
+
+/**
+ * @brief A stream buffer that compresses what is written to it into a file.
+ *        The data is compressed a buffer at a time, and the end of the
+ *        compressed stream is written by finish, or when the buffer is
+ *        destroyed if finish was not called.
+ */
+class compressBuffer : public streambuf
+{
+public:
+    /**
+     * @brief starts a compressed stream in a file
+     * @param[in] target - the open file, closed with the buffer
+     * @param[in] format - compression to write
+     */
+    compressBuffer(FILE* target, compression format) : file(target),
+        kind(format), pending(chunkSize), packed(chunkSize)
+    {
+#ifdef HAVE_ZLIB
+        if (kind == COMPRESS_GZIP)  // level 6 with a gzip header
+            deflateInit2(&gzip, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16,
+                8, Z_DEFAULT_STRATEGY);
+#endif
+#ifdef HAVE_ZSTD
+        if (kind == COMPRESS_ZSTD)
+            zstd = ZSTD_createCStream();
+#endif
+        setp(pending.data(), pending.data() + pending.size());
+    }
+
+    /**
+     * @brief finishes the compressed stream if that was not done, and frees
+     *        the compressor
+     */
+    ~compressBuffer() override
+    {
+        finish();
+#ifdef HAVE_ZLIB
+        if (kind == COMPRESS_GZIP)
+            deflateEnd(&gzip);
+#endif
+#ifdef HAVE_ZSTD
+        if (kind == COMPRESS_ZSTD)
+            ZSTD_freeCStream(zstd);
+#endif
+    }
+
+    /**
+     * @brief writes the end of the compressed stream and closes the file;
+     *        only the first call does anything
+     * @returns true if the whole stream reached the file, false otherwise
+     */
+    bool finish()
+    {
+        if (file != nullptr)
+        {
+            finished = compress(true);
+            finished = fflush(file) == 0 && finished;
+            finished = fclose(file) == 0 && finished;
+            file = nullptr;
+        }
+
+        return finished;
+    }
+
+protected:
+    /**
+     * @brief compresses the full buffer and stores one more character
+     * @param[in] ch - the character that did not fit
+     * @returns ch, or EOF if the file could not be written
+     */
+    int_type overflow(int_type ch) override
+    {
+        if (!compress(false))
+            return traits_type::eof();
+
+        if (!traits_type::eq_int_type(ch, traits_type::eof()))
+        {
+            *pptr() = traits_type::to_char_type(ch);
+            pbump(1);
+        }
+
+        return traits_type::not_eof(ch);
+    }
+
+    /**
+     * @brief compresses what has been written so far
+     * @returns 0, or -1 if the file could not be written
+     */
+    int sync() override
+    {
+        return compress(false) ? 0 : -1;
+    }
+
+private:
+    /**
+     * @brief compresses the buffer and writes what the compressor returns
+     * @param[in] finish - true to end the compressed stream
+     * @returns true if the file was written, false otherwise
+     */
+    bool compress([[maybe_unused]] bool finish)
+    {
+        size_t size = pptr() - pbase();
+        bool done = false;
+
+        if (file == nullptr)            // written to after finish
+            return false;
+
+        setp(pending.data(), pending.data() + pending.size());
+
+#ifdef HAVE_ZLIB
+        if (kind == COMPRESS_GZIP)
+        {
+            gzip.next_in = (Bytef*)pending.data();
+            gzip.avail_in = (uInt)size;
+            while (!done)
+            {
+                gzip.next_out = (Bytef*)packed.data();
+                gzip.avail_out = (uInt)packed.size();
+                if (deflate(&gzip, finish ? Z_FINISH : Z_NO_FLUSH) ==
+                    Z_STREAM_ERROR || !write(packed.size() - gzip.avail_out))
+                    return false;
+                done = gzip.avail_out != 0;
+            }
+        }
+#endif
+
+#ifdef HAVE_ZSTD
+        if (kind == COMPRESS_ZSTD)
+        {
+            ZSTD_inBuffer in = { pending.data(), size, 0 };
+            size_t left;
+
+            while (!done)
+            {
+                ZSTD_outBuffer out = { packed.data(), packed.size(), 0 };
+                left = ZSTD_compressStream2(zstd, &out, &in,
+                    finish ? ZSTD_e_end : ZSTD_e_continue);
+                if (ZSTD_isError(left) || !write(out.pos))
+                    return false;
+                done = finish ? left == 0 : in.pos == in.size;
+            }
+        }
+#endif
+
+        return done || size == 0;
+    }
+
+    /**
+     * @brief writes the start of the packed buffer to the file
+     * @param[in] size - number of bytes to write
+     * @returns true if they were written, false otherwise
+     */
+    bool write(size_t size)
+    {
+        return fwrite(packed.data(), 1, size, file) == size;
+    }
+
+    FILE* file;                 /**< the compressed file, nullptr once closed */
+    bool finished = false;      /**< finish wrote the whole stream */
+    compression kind;           /**< compression being written */
+    vector<char> pending;       /**< data waiting to be compressed */
+    vector<char> packed;        /**< compressed data waiting to be written */
+#ifdef HAVE_ZLIB
+    z_stream gzip = {};         /**< state of the gzip compressor */
+#endif
+#ifdef HAVE_ZSTD
+    ZSTD_CStream* zstd = nullptr;   /**< state of the zstd compressor */
+#endif
+};
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Deletes the compression buffer of a stream when the stream is destroyed.
+ * The buffer is kept in the stream's pword slot, so it lives exactly as
+ * long as the ifstream or ofstream that uses it.
+ *
+ * @param[in] event - what is happening to the stream
+ * @param[in,out] stream - the stream
+ * @param[in] index - the pword slot holding the buffer
+ *
+ * @par Example:
+   @verbatim
+   fin.register_callback(releaseBuffer, bufferSlot);
+   @endverbatim
+ *
+ *****************************************************************************/
+static void releaseBuffer(ios_base::event event, ios_base& stream, int index)
+{
+    if (event != ios_base::erase_event)
+        return;
+
+    delete (streambuf*)stream.pword(index);
+    stream.pword(index) = nullptr;
+}
+
+
+/**
+ * @brief the pword slot that holds the compression buffer of a stream
+ */
+static const int bufferSlot = ios_base::xalloc();
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Returns the name of a compression format for messages.
+ *
+ * @param[in] format - compression format
+ *
+ * @returns "gzip", "zstd" or "none"
+ *
+ * @par Example:
+   @verbatim
+   compressionName(COMPRESS_GZIP);
+
+   Output:
+   gzip
+   @endverbatim
+ *
+ *****************************************************************************/
+static string compressionName(compression format)
+{
+    if (format == COMPRESS_GZIP)
+        return "gzip";
+    if (format == COMPRESS_ZSTD)
+        return "zstd";
+
+    return "none";
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Returns true if this build can read and write a compression format. gzip
+ * needs HAVE_ZLIB and zstd needs HAVE_ZSTD to be defined, with the library
+ * linked in.
+ *
+ * @param[in] format - compression format
+ *
+ * @returns true if the format is supported, false otherwise
+ *
+ * @par Example:
+   @verbatim
+   compressionBuilt(COMPRESS_ZSTD);
+   @endverbatim
+ *
+ *****************************************************************************/
+static bool compressionBuilt(compression format)
+{
+#ifdef HAVE_ZLIB
+    if (format == COMPRESS_GZIP)
+        return true;
+#endif
+#ifdef HAVE_ZSTD
+    if (format == COMPRESS_ZSTD)
+        return true;
+#endif
+
+    return format == COMPRESS_NONE;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Finds the compression of a file from the extension of its name, .gz for
+ * gzip and .zst for zstd.
+ *
+ * @param[in] fileName - name of the file
+ *
+ * @returns the compression the name asks for
+ *
+ * @par Example:
+   @verbatim
+   compressionFromName("result.ppm.gz");
+
+   Output:
+   COMPRESS_GZIP
+   @endverbatim
+ *
+ *****************************************************************************/
+compression compressionFromName(string fileName)
+{
+    size_t length = fileName.size();
+
+    if (length > 3 && fileName.compare(length - 3, 3, ".gz") == 0)
+        return COMPRESS_GZIP;
+    if (length > 4 && fileName.compare(length - 4, 4, ".zst") == 0)
+        return COMPRESS_ZSTD;
+
+    return COMPRESS_NONE;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Looks at the first bytes of an open input file for the gzip or zstd
+ * magic number, whatever the file is called. A compressed file is closed
+ * in fin and read again through a decompressBuffer, which fin then reads
+ * from, so the readers see the decompressed image. The buffer is deleted
+ * with fin. For a compression this build does not support, lastFailure
+ * says so.
+ *
+ * @param[in] fileName - name of the open file
+ * @param[in,out] fin - the stream the file is open in
+ *
+ * @returns true if fin can be read, false otherwise
+ *
+ * @par Example:
+   @verbatim
+   attachDecompressor("image.ppm.gz", fin);
+   @endverbatim
+ *
+ *****************************************************************************/
+bool attachDecompressor(string fileName, ifstream& fin)
+{
+    unsigned char magic[4] = { 0, 0, 0, 0 };
+    compression format = COMPRESS_NONE;
+    FILE* file;
+
+    fin.read((char*)magic, 4);
+    fin.clear();
+    fin.seekg(0);
+
+    if (magic[0] == 0x1f && magic[1] == 0x8b)
+        format = COMPRESS_GZIP;
+    else if (magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f &&
+        magic[3] == 0xfd)
+        format = COMPRESS_ZSTD;
+
+    if (format == COMPRESS_NONE)
+        return true;
+
+    if (!compressionBuilt(format))
+    {
+        lastFailure = fileName + " is compressed with " +
+            compressionName(format) + ", which this build can not read";
+        return false;
+    }
+
+    file = fopen(fileName.c_str(), "rb");
+    if (file == nullptr)
+    {
+        lastFailure = "Unable to open input file: " + fileName;
+        return false;
+    }
+
+    fin.close();
+    fin.pword(bufferSlot) = new decompressBuffer(file, format, fin);
+    fin.register_callback(releaseBuffer, bufferSlot);
+    static_cast<istream&>(fin).rdbuf((streambuf*)fin.pword(bufferSlot));
+
+    return true;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Compresses everything written to fout when the file name ends in .gz or
+ * .zst. The file is closed in fout and written through a compressBuffer
+ * instead. finishOutput writes the end of the compressed stream; if it is
+ * not called, that happens when fout is destroyed, unchecked. A
+ * compression this build does not support fails with the reason in
+ * lastFailure.
+ *
+ * @param[in] fileName - name of the open file
+ * @param[in,out] fout - the stream the file is open in
+ *
+ * @returns true if fout can be written, false otherwise
+ *
+ * @par Example:
+   @verbatim
+   attachCompressor("result.ppm.zst", fout);
+   @endverbatim
+ *
+ *****************************************************************************/
+bool attachCompressor(string fileName, ofstream& fout)
+{
+    compression format = compressionFromName(fileName);
+    FILE* file;
+
+    if (format == COMPRESS_NONE)
+        return true;
+
+    if (!compressionBuilt(format))
+    {
+        lastFailure = "This build can not write " + compressionName(format) +
+            " files: " + fileName;
+        fout.close();
+        remove(fileName.c_str());
+        return false;
+    }
+
+    file = fopen(fileName.c_str(), "wb");
+    if (file == nullptr)
+    {
+        lastFailure = "Unable to open the file: " + fileName;
+        return false;
+    }
+
+    fout.close();
+    fout.pword(bufferSlot) = new compressBuffer(file, format);
+    fout.register_callback(releaseBuffer, bufferSlot);
+    static_cast<ostream&>(fout).rdbuf((streambuf*)fout.pword(bufferSlot));
+
+    return true;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Ends a file written through fout and reports whether all of it reached
+ * the disk. A compressed file gets the end of its compressed stream, which
+ * otherwise would only be written when fout is destroyed, and is closed;
+ * any other file is closed. fout fails when this does not work, and the
+ * reason is left in lastFailure.
+ *
+ * @param[in] fileName - name of the file, for the message
+ * @param[in,out] fout - the stream the file was opened in by openOutput
+ *
+ * @returns true if the whole file was written, false otherwise
+ *
+ * @par Example:
+   @verbatim
+   writeImage(fout, image, "--binary");
+   finishOutput("result.ppm.gz", fout);
+   @endverbatim
+ *
+ *****************************************************************************/
+bool finishOutput(string fileName, ofstream& fout)
+{
+    compressBuffer* buffer = (compressBuffer*)fout.pword(bufferSlot);
+
+    if (buffer == nullptr)
+        fout.close();
+    else if (!fout.flush() || !buffer->finish())
+        fout.setstate(ios::badbit);
+
+    if (!fout)
+        lastFailure = "Unable to write " + fileName;
+
+    return bool(fout);
+}
@@ -0,0 +1,330 @@
+/** ***************************************************************************
+ * @file
+ *
+ * @brief compares two images with max abs difference, MSE, PSNR and SSIM.
+ *****************************************************************************/
+
+#include "netPBM.h"
+#include <iomanip>
+#include <mutex>
+#include <vector>
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Reads two images, reports how far apart they are in lastReport and
+ * optionally writes the absolute difference of every sample as a binary
+ * image. The images must have the same size; when they cannot be compared
+ * lastReport is empty and lastFailure says why. Bitmaps are unpacked to gray pixels first, and 16 bit
+ * samples are reduced to 8 bits.
+ *
+ * @param[in] firstFile - name of the first image file
+ * @param[in] secondFile - name of the second image file
+ * @param[in] diffBase - basename of the difference image, empty for none
+ *
+ * @returns 0 after the comparison, 1 if an image could not be read or the
+ *          images could not be compared
+ *
+ * @par Example:
+   @verbatim
+   compareImages("BalloonsA.ppm", "BalloonsB.ppm", "diff");
+
+   lastReport:
+   Max abs diff: 255
+   MSE: 1234.5678
+   PSNR: 17.2159 dB
+   SSIM: 0.4321
+   @endverbatim
+ *
+ *****************************************************************************/
+int compareImages(string firstFile, string secondFile, string diffBase)
+{
+    image first, second, diff;
+    imageDifference result;
+    ifstream fin1, fin2;
+    ofstream fout;
+    ostringstream report;
+    int status = 0;
+
+    lastReport = "";
+    if (!openInput(firstFile, fin1) || !readImage(fin1, first) ||
+        !openInput(secondFile, fin2) || !readImage(fin2, second))
+    {
+        return 1;
+    }
+
+    if ((first.bits != nullptr && !expandBitmap(first)) ||
+        (second.bits != nullptr && !expandBitmap(second)) ||
+        !narrowImage(first) || !narrowImage(second))
+    {
+        lastFailure = "Unable to allocate memory for the comparison";
+        return 1;
+    }
+
+    if (first.rows != second.rows || first.cols != second.cols)
+    {
+        lastFailure = "The images are not the same size: " +
+            to_string(first.cols) + "x" + to_string(first.rows) + " and " +
+            to_string(second.cols) + "x" + to_string(second.rows);
+        return 1;
+    }
+
+    if (diffBase != "")
+    {
+        diff.magicNumber = "P6";
+        diff.rows = first.rows;
+        diff.cols = first.cols;
+        diff.redgray = alloc2d(diff.rows, diff.cols);
+        diff.green = alloc2d(diff.rows, diff.cols);
+        diff.blue = alloc2d(diff.rows, diff.cols);
+    }
+
+    if (!measureDifference(first, second, result,
+        diffBase != "" ? &diff : nullptr))
+    {
+        lastFailure = "Unable to allocate memory for the comparison";
+        return 1;
+    }
+
+    report << "Max abs diff: " << result.maxDiff << '\n';
+    report << "MSE: " << fixed << setprecision(4) << result.mse << '\n';
+    if (result.mse == 0)
+        report << "PSNR: inf dB\n";
+    else
+        report << "PSNR: " << result.psnr << " dB\n";
+    report << "SSIM: " << result.ssim << '\n';
+    lastReport = report.str();
+
+    if (diffBase != "")
+    {
+        if (openOutput(diffBase + ".ppm", fout))
+        {
+            writeBinary(fout, diff);
+            finishOutput(diffBase + ".ppm", fout);
+        }
+        freeImage(diff);
+        if (!fout)
+            status = 1;
+    }
+
+    freeImage(first);
+    freeImage(second);
+
+    return status;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Measures the difference between two images of the same size. The rows of
+ * each plane are split across threads, and each thread runs the diffRow
+ * kernel picked for this processor, which takes the absolute differences,
+ * squares and sums them, and tracks the largest one many samples at a time.
+ * Each thread keeps its own totals and adds them to the result once, so the
+ * threads only share a lock at the very end. The structural similarity is
+ * measured on the luma with structuralSimilarity.
+ *
+ * @param[in] first - the first image
+ * @param[in] second - the second image
+ * @param[out] result - the max abs difference, MSE, PSNR and SSIM
+ * @param[out] diff - image that receives the absolute differences, or
+ *                    nullptr when they are not wanted
+ *
+ * @returns true if the difference was measured, false if memory ran out
+ *
+ * @par Example:
+   @verbatim
+   measureDifference(first, second, result, nullptr);
+   @endverbatim
+ *
+ *****************************************************************************/
+bool measureDifference(image& first, image& second, imageDifference& result, image* diff)
+{
+    pixel** planeA[3] = { first.redgray, first.green, first.blue };
+    pixel** planeB[3] = { second.redgray, second.green, second.blue };
+    pixel** planeD[3] = { nullptr, nullptr, nullptr };
+    unsigned long long sumSquares = 0;
+    int maxDiff = 0, k;
+    double samples;
+    mutex totals;
+
+    if (diff != nullptr)
+    {
+        if (diff->redgray == nullptr || diff->green == nullptr ||
+            diff->blue == nullptr)
+            return false;
+        planeD[0] = diff->redgray;
+        planeD[1] = diff->green;
+        planeD[2] = diff->blue;
+    }
+
+    for (k = 0; k < 3; k++)     // a grayscale image uses its one plane
+    {
+        if (planeA[k] == nullptr)
+            planeA[k] = first.redgray;
+        if (planeB[k] == nullptr)
+            planeB[k] = second.redgray;
+    }
+
+    parallelFor(0, first.rows, [&](int rowStart, int rowEnd)
+        {
+            unsigned long long localSquares = 0;
+            int localMax = 0;
+
+            for (int r = rowStart; r < rowEnd; r++)
+            {
+                for (int p = 0; p < 3; p++)
+                {
+                    kernels.diffRow(planeA[p][r], planeB[p][r],
+                        planeD[p] == nullptr ? nullptr : planeD[p][r],
+                        first.cols, localSquares, localMax);
+                }
+            }
+
+            lock_guard<mutex> lock(totals);
+            sumSquares += localSquares;
+            maxDiff = max(maxDiff, localMax);
+        });
+
+    samples = 3.0 * first.rows * first.cols;
+    result.maxDiff = maxDiff;
+    result.mse = samples > 0 ? sumSquares / samples : 0;
+    result.psnr = result.mse > 0 ? 10.0 * log10(255.0 * 255.0 / result.mse) : 0;
+
+    return structuralSimilarity(first, second, result.ssim);
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Measures the mean structural similarity (SSIM) of the luma of two images
+ * over 8x8 windows placed every 4 pixels. The luma uses the same weights as
+ * grayscale. For each band of 8 rows the column sums of x, y, x*x, y*y and
+ * x*y are built once, so each window only adds up 8 columns, and the bands
+ * are split across threads. The usual constants (0.01 * 255)^2 and
+ * (0.03 * 255)^2 keep flat windows stable. An image smaller than a window
+ * is measured as one window.
+ *
+ * @param[in] first - the first image
+ * @param[in] second - the second image
+ * @param[out] ssim - the mean SSIM, 1 for identical images
+ *
+ * @returns true if the SSIM was measured, false if memory ran out
+ *
+ * @par Example:
+   @verbatim
+   structuralSimilarity(first, second, similarity);
+   @endverbatim
+ *
+ *****************************************************************************/
+bool structuralSimilarity(image& first, image& second, double& ssim)
+{
+    const double c1 = (0.01 * 255) * (0.01 * 255);
+    const double c2 = (0.03 * 255) * (0.03 * 255);
+    int rows = first.rows, cols = first.cols;
+    int window = min(8, min(rows, cols)), stride = max(window / 2, 1);
+    int bands = (rows - window) / stride + 1;
+    pixel** lumaA = alloc2d(rows, cols);
+    pixel** lumaB = alloc2d(rows, cols);
+    double total = 0;
+    long long windows = 0;
+    mutex totals;
+
+    if (lumaA == nullptr || lumaB == nullptr)
+    {
+        free2d(lumaA, rows);
+        free2d(lumaB, rows);
+        return false;
+    }
+
+    parallelFor(0, rows, [&](int rowStart, int rowEnd)
+        {
+            image* pictures[2] = { &first, &second };
+            pixel** lumas[2] = { lumaA, lumaB };
+
+            for (int i = 0; i < 2; i++)
+            {
+                image& p = *pictures[i];
+                for (int r = rowStart; r < rowEnd; r++)
+                {
+                    for (int c = 0; c < cols; c++)
+                    {
+                        if (p.green == nullptr)
+                            lumas[i][r][c] = p.redgray[r][c];
+                        else        // round(0.3 r + 0.6 g + 0.1 b)
+                            lumas[i][r][c] = (pixel)((3 * p.redgray[r][c] +
+                                6 * p.green[r][c] + p.blue[r][c] + 5) / 10);
+                    }
+                }
+            }
+        });
+
+    parallelFor(0, bands, [&](int bandStart, int bandEnd)
+        {
+            vector<long long> sx(cols), sy(cols), sxx(cols), syy(cols), sxy(cols);
+            double localTotal = 0;
+            long long localWindows = 0;
+            double n = (double)window * window;
+
+            for (int band = bandStart; band < bandEnd; band++)
+            {
+                int top = band * stride;
+
+                for (int c = 0; c < cols; c++)  // column sums of the band
+                {
+                    long long x, y;
+                    sx[c] = sy[c] = sxx[c] = syy[c] = sxy[c] = 0;
+                    for (int r = top; r < top + window; r++)
+                    {
+                        x = lumaA[r][c];
+                        y = lumaB[r][c];
+                        sx[c] += x;
+                        sy[c] += y;
+                        sxx[c] += x * x;
+                        syy[c] += y * y;
+                        sxy[c] += x * y;
+                    }
+                }
+
+                for (int left = 0; left + window <= cols; left += stride)
+                {
+                    long long ax = 0, ay = 0, axx = 0, ayy = 0, axy = 0;
+                    double mx, my, vx, vy, cov;
+
+                    for (int c = left; c < left + window; c++)
+                    {
+                        ax += sx[c];
+                        ay += sy[c];
+                        axx += sxx[c];
+                        ayy += syy[c];
+                        axy += sxy[c];
+                    }
+
+                    mx = ax / n;
+                    my = ay / n;
+                    vx = axx / n - mx * mx;
+                    vy = ayy / n - my * my;
+                    cov = axy / n - mx * my;
+                    localTotal += ((2 * mx * my + c1) * (2 * cov + c2)) /
+                        ((mx * mx + my * my + c1) * (vx + vy + c2));
+                    localWindows++;
+                }
+            }
+
+            lock_guard<mutex> lock(totals);
+            total += localTotal;
+            windows += localWindows;
+        });
+
+    free2d(lumaA, rows);
+    free2d(lumaB, rows);
+
+    ssim = windows > 0 ? total / windows : 1;
+    return true;
+}
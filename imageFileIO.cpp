@@ -1,342 +1,1587 @@
-/** ***************************************************************************
- * @file
- *
- * @brief handles all input/output operations such as read and write.
- *****************************************************************************/
-
-#include "netPBM.h"
-
- /** ***************************************************************************
-  * @author Heidi Anderson
-  *
-  * @par Description:
-  * Writes out image data in Binary
-  *
-  * @param[in,out] fin - reference to ifstream
-  * @param[in,out] image - image structure
-  *
-  * @par Example:
-    @verbatim
-    asciiOrBinary(fin, image);
-    @endverbatim
-  * 
-  *****************************************************************************/
-void asciiOrBinary(ifstream& fin, image& image)
-{
-    if (image.magicNumber == "P3" || image.magicNumber == "P2") // ascii
-    {
-        readAscii(fin, image);  // call to read ascii file
-    }
-    if (image.magicNumber == "P5" || image.magicNumber == "P6") // binary
-    {
-        readBinary(fin, image); // call to read binary file
-    }
-}
-
-
-/** ***************************************************************************
- * @author Heidi Anderson
- *
- * @par Description:
- * Opens an ifstream for file input
- *
- * @param[in] fileName - name of file to be opened
- * @param[in,out] fin - reference to ifstream
- *
- * @returns true for success, false otherwise
- * 
- * @par Example:
-   @verbatim
-   openInput(InputFile.ppm, fin);
-   @endverbatim
- *
- *****************************************************************************/
-bool openInput(string fileName, ifstream& fin)
-{
-    fin.open(fileName, ios::in | ios::binary); // open input
-
-    if (!fin.is_open())
-    {
-        cout << "Unable to open input file: " << fileName << endl;
-        return false;
-    }
-
-    return true;
-}
-
-
-
-/** ***************************************************************************
- * @author Heidi Anderson
- *
- * @par Description:
- * Opens an ofstream for file output
- *
- * @param[in,out] fout - reference to ofstream
- * @param[in] fileName - name of file to be opened
- *
- * @returns true for success, false otherwise
- * 
- * @par Example:
-   @verbatim
-   openOutput(outputFile.ppm, fout);
-   @endverbatim
- * 
- *****************************************************************************/
-bool openOutput(string fileName, ofstream& fout)
-{
-    fout.open(fileName, ios::binary);   // open output
-
-    if (!fout.is_open())
-    {
-        cout << "Unable to open the file: " << fileName << endl;
-        return false;
-    }
-
-    return true;
-
-}
-
-
-/** ***************************************************************************
- * @author Heidi Anderson
- *
- * @par Description:
- * Determines how to write output.
- *
- * @param[in] outputType - type of output, ascii/binary
- * @param[in,out] outputFile - name of output file
- * @param[in,out] fout - reference to ofstream
- * @param[in,out] image - image structure
- * @param[in,out] option - image operation choice
- *
- * @par Example:
-   @verbatim
-   output("--ascii", outputFile.ppm, fout, image, "--negate");
-   @endverbatim
- * 
- *****************************************************************************/
-void output(char* outputType, string outputFile, ofstream& fout, image& image, string option)
-{
-    if (!openOutput(outputFile, fout))  // error check
-    {
-        exit(0);
-    }
-
-    if (strcmp(outputType, "--ascii") == 0) // compare strings
-    {
-        writeAscii(fout, image, option);
-    }
-
-    if (strcmp(outputType, "--binary") == 0)    // compare strings
-    {
-        writeBinary(fout, image, option);
-    }
-}
-
-
-/** ***************************************************************************
- * @author Heidi Anderson
- *
- * @par Description:
- * Reads in ASCII image data
- *
- * @param[in] fin - reference to ifstream
- * @param[out] image - image structure
- *
- * @par Example:
-   @verbatim
-   readAscii(fin, image);
-   @endverbatim
- * 
- *****************************************************************************/
-void readAscii(ifstream& fin, image& image)
-{
-    int r, c, temp;
-
-    for (r = 0; r < image.rows; ++r)    // for loop to step through pixels
-    {
-        for (c = 0; c < image.cols; ++c)
-        {
-            fin >> temp;
-            image.redgray[r][c] = temp;
-
-            fin >> temp;
-            image.green[r][c] = temp;
-
-            fin >> temp;
-            image.blue[r][c] = temp;
-        }
-
-    }
-}
-
-
-/** ***************************************************************************
- * @author Heidi Anderson
- *
- * @par Description:
- * Reads in Binary image data
- *
- * @param[in] fin - reference to ifstream
- * @param[out] image - image structure
- * 
- * @par Example:
-   @verbatim
-   readBinary(fin, image);
-   @endverbatim
- *
- *****************************************************************************/
-void readBinary(ifstream& fin, image& image)
-{
-    int r, c;
-
-    for (r = 0; r < image.rows; ++r)    // for loop to read pixels
-    {
-        for (c = 0; c < image.cols; ++c)
-        {
-            fin.read((char*)&image.redgray[r][c], sizeof(pixel));
-            fin.read((char*)&image.green[r][c], sizeof(pixel));
-            fin.read((char*)&image.blue[r][c], sizeof(pixel));
-        }
-
-    }
-}
-
-
-/** ***************************************************************************
- * @author Heidi Anderson
- *
- * @par Description:
- * Reads header
- *
- * @param[in] fin - reference to ifstream
- * @param[out] image - image structure
- *
- * @par Example:
-   @verbatim
-   readHeader(fin, image);
-   @endverbatim
- *
- *****************************************************************************/
-void readHeader(ifstream& fin, image& image)
-{
-    string comment;
-    string placeHold;
-
-    fin >> image.magicNumber;   // get magic number
-    fin.ignore();
-
-    while (fin.peek() == '#')   // get comments
-    {
-        getline(fin, comment);
-        image.comment = image.comment + '\n' + comment;
-    }
-
-    fin >> image.cols >> image.rows;
-    fin >> placeHold;
-    fin.ignore();
-
-}
-
-
-/** ***************************************************************************
- * @author Heidi Anderson
- *
- * @par Description:
- * Writes out image data in ASCII
- *
- * @param[in] fout - reference to ofstream
- * @param[in] image - image structure
- * @param[in] option - operation to be applied to the image
- * 
- * @par Example:
-   @verbatim
-   writeAscii(fin, image);
-   @endverbatim
- * 
- *****************************************************************************/
-void writeAscii(ofstream& fout, image& image, string option)
-{
-    int r, c;
-
-    if (option == "--grayscale" || option == "--contrast")  // write header
-        fout << "P2";
-    else
-        fout << "P3";
-
-    fout << image.comment << "\n";
-    fout << image.cols << " " << image.rows << "\n";
-    fout << "255" << "\n";
-
-    for (r = 0; r < image.rows; r++)    // write out pixels
-    {
-        for (c = 0; c < image.cols; c++)
-        {
-            if (image.magicNumber == "P2")
-            {
-                fout << (int)image.redgray[r][c] << "\n";
-
-            }
-            else
-            {
-                fout << (int)image.redgray[r][c] << " "
-                    << (int)image.green[r][c] << " "
-                    << (int)image.blue[r][c] << "\n";
-            }
-        }
-    }
-}
-
-
-/** ***************************************************************************
- * @author Heidi Anderson
- *
- * @par Description:
- * Writes out image data in Binary
- *
- * @param[in] fout - reference to ofstream
- * @param[in] image - image structure
- * @param[in] option - image operation choice
- * 
- * @par Example:
-   @verbatim
-   writeBinary(fin, image, "--negate");
-   @endverbatim
- * 
- *****************************************************************************/
-void writeBinary(ofstream& fout, image& image, string option)
- {
-    int r, c;
-
-    if (option == "--grayscale" || option == "--contrast")  // write header
-        fout << "P5";
-    else
-        fout << "P6";
-
-    fout << image.comment << "\n";
-    fout << image.cols << " " << image.rows << "\n";
-    fout << "255" << "\n";
-
-
-    for (r = 0; r < image.rows; r++)        // write out pixels
-    {
-        for (c = 0; c < image.cols; c++)
-        {
-            if (image.redgray != nullptr)
-            {
-                fout.write((char*)&image.redgray[r][c], sizeof(pixel));
-            }
-
-            if (image.green != nullptr)
-            {
-                fout.write((char*)&image.green[r][c], sizeof(pixel));
-            }
-
-            if (image.blue != nullptr)
-            {
-                fout.write((char*)&image.blue[r][c], sizeof(pixel));
-            }
-        }
-    }
+/** ***************************************************************************
+ * @file
+ *
+ * @brief handles all input/output operations such as read and write.
+ *****************************************************************************/
+
+#include "netPBM.h"
+#include <vector>
+
+
+/******************************************************************************
+ *                              Templates
+ *****************************************************************************/
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Copies the samples of an ASCII image, in file order, into three planes of
+ * 8 or 16 bit samples. P2 has one sample per pixel that is copied into all
+ * three planes.
+ *
+ * @param[in] samples - the samples as they were parsed
+ * @param[out] red - the red/gray plane
+ * @param[out] green - the green plane
+ * @param[out] blue - the blue plane
+ * @param[in] rows - rows in the image
+ * @param[in] cols - columns in the image
+ * @param[in] channels - 1 for P2, 3 for P3
+ *
+ * @par Example:
+   @verbatim
+   splitSamples(samples, image.redgray, image.green, image.blue, image.rows,
+       image.cols, 3);
+   @endverbatim
+ *
+ *****************************************************************************/
+template <class T>
+static void splitSamples(const sample16* samples, T** red, T** green,
+    T** blue, int rows, int cols, int channels)
+{
+    size_t offset;
+    int r, c;
+
+    for (r = 0; r < rows; ++r)      // for loop to step through pixels
+    {
+        for (c = 0; c < cols; ++c)
+        {
+            offset = ((size_t)r * cols + c) * channels;
+            red[r][c] = (T)samples[offset];
+            green[r][c] = (T)samples[offset + channels / 3];
+            blue[r][c] = (T)samples[offset + channels / 3 * 2];
+        }
+    }
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Writes the pixels of an ASCII image from planes of 8 or 16 bit samples,
+ * one pixel per line. A nullptr green plane writes the gray plane alone.
+ *
+ * @param[in] fout - reference to output stream
+ * @param[in] red - the red/gray plane
+ * @param[in] green - the green plane, nullptr for grayscale
+ * @param[in] blue - the blue plane
+ * @param[in] rows - rows in the image
+ * @param[in] cols - columns in the image
+ *
+ * @par Example:
+   @verbatim
+   writeSamples(fout, image.redgray, image.green, image.blue, image.rows,
+       image.cols);
+   @endverbatim
+ *
+ *****************************************************************************/
+template <class T>
+static void writeSamples(ostream& fout, T** red, T** green, T** blue,
+    int rows, int cols)
+{
+    int r, c;
+
+    for (r = 0; r < rows; r++)      // write out pixels
+    {
+        for (c = 0; c < cols; c++)
+        {
+            if (green == nullptr)   // grayscale has one plane
+            {
+                fout << (int)red[r][c] << "\n";
+
+            }
+            else
+            {
+                fout << (int)red[r][c] << " "
+                    << (int)green[r][c] << " "
+                    << (int)blue[r][c] << "\n";
+            }
+        }
+    }
+}
+
+ /** ***************************************************************************
+  * @author Heidi Anderson
+  *
+  * @par Description:
+  * Reads the image data with the reader that matches the magic number found
+  * by readHeader: ascii, binary, bitmap, PAM or QOI.
+  *
+  * @param[in,out] fin - reference to input stream
+  * @param[in,out] image - image structure
+  *
+  * @par Example:
+    @verbatim
+    asciiOrBinary(fin, image);
+    @endverbatim
+  * 
+  *****************************************************************************/
+void asciiOrBinary(istream& fin, image& image)
+{
+    if (image.magicNumber == "P3" || image.magicNumber == "P2") // ascii
+    {
+        readAscii(fin, image);  // call to read ascii file
+    }
+    if (image.magicNumber == "P5" || image.magicNumber == "P6") // binary
+    {
+        if (image.maxValue > 255)
+            readBinary16(fin, image);   // two bytes a sample
+        else
+            readBinary(fin, image);     // call to read binary file
+    }
+    if (image.magicNumber == "P1" || image.magicNumber == "P4") // bitmap
+    {
+        readBitmap(fin, image); // call to read bitmap file
+    }
+    if (image.magicNumber == "P7")      // portable arbitrary map
+    {
+        readPam(fin, image);    // call to read pam file
+    }
+    if (image.magicNumber == "qoif")    // quite ok image format
+    {
+        readQoi(fin, image);    // call to read qoi file
+    }
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Opens an ifstream for file input. A file compressed with gzip or zstd is
+ * found by its magic number and decompressed as it is read. When the file
+ * cannot be opened lastFailure says why.
+ *
+ * @param[in] fileName - name of file to be opened
+ * @param[in,out] fin - reference to ifstream
+ *
+ * @returns true for success, false otherwise
+ * 
+ * @par Example:
+   @verbatim
+   openInput(InputFile.ppm, fin);
+   @endverbatim
+ *
+ *****************************************************************************/
+bool openInput(string fileName, ifstream& fin)
+{
+    fin.open(fileName, ios::in | ios::binary); // open input
+
+    if (!fin.is_open())
+    {
+        lastFailure = "Unable to open input file: " + fileName;
+        return false;
+    }
+
+    return attachDecompressor(fileName, fin);
+}
+
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Opens an ofstream for file output. A name ending in .gz or .zst writes a
+ * gzip or zstd compressed file. When the file cannot be opened lastFailure
+ * says why.
+ *
+ * @param[in,out] fout - reference to ofstream
+ * @param[in] fileName - name of file to be opened
+ *
+ * @returns true for success, false otherwise
+ * 
+ * @par Example:
+   @verbatim
+   openOutput(outputFile.ppm, fout);
+   @endverbatim
+ * 
+ *****************************************************************************/
+bool openOutput(string fileName, ofstream& fout)
+{
+    fout.open(fileName, ios::binary);   // open output
+
+    if (!fout.is_open())
+    {
+        lastFailure = "Unable to open the file: " + fileName;
+        return false;
+    }
+
+    return attachCompressor(fileName, fout);
+
+}
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Counts the samples in a piece of ASCII image data. A sample is a run of
+ * characters that are not whitespace, and a '#' starts a comment that runs
+ * to the end of the line. The piece must start at the beginning of a line or
+ * right after the header so it does not begin inside a comment or a number.
+ *
+ * @param[in] begin - first character of the piece
+ * @param[in] end - one past the last character of the piece
+ *
+ * @returns the number of samples in the piece
+ *
+ * @par Example:
+   @verbatim
+   countAsciiSamples(text, text + size);
+   @endverbatim
+ *
+ *****************************************************************************/
+size_t countAsciiSamples(const char* begin, const char* end)
+{
+    size_t count = 0;
+    bool inToken = false;
+
+    while (begin < end)
+    {
+        if (*begin == '#')              // skip comment to end of line
+        {
+            while (begin < end && *begin != '\n')
+                begin++;
+            inToken = false;
+        }
+        else if (*begin == ' ' || (*begin >= '\t' && *begin <= '\r'))
+        {
+            inToken = false;
+            begin++;
+        }
+        else
+        {
+            if (!inToken)
+                count++;
+            inToken = true;
+            begin++;
+        }
+    }
+
+    return count;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Determines how to write output. A file that cannot be opened is reported
+ * to the caller instead of ending the program. The file is ended by
+ * finishOutput, so a compressed file is complete, and any error in writing
+ * it known, when this returns.
+ *
+ * @param[in] outputType - type of output, ascii/binary/qoi
+ * @param[in,out] outputFile - name of output file
+ * @param[in,out] fout - reference to ofstream
+ * @param[in,out] image - image structure
+ *
+ * @returns true if the image was written, false otherwise
+ *
+ * @par Example:
+   @verbatim
+   output("--ascii", outputFile.ppm, fout, image);
+   @endverbatim
+ * 
+ *****************************************************************************/
+bool output(char* outputType, string outputFile, ofstream& fout, image& image)
+{
+    if (!openOutput(outputFile, fout))  // error check
+    {
+        return false;
+    }
+
+    writeImage(fout, image, outputType);
+
+    return finishOutput(outputFile, fout);
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Picks the name of the output file from the basename, the output type and
+ * the image that will be written: .qoi for QOI, .pbm for a bitmap, .pam
+ * for a binary image with alpha, .pgm for one gray plane and .ppm for
+ * color. A basename ending in .gz or .zst
+ * keeps that ending after the image extension, so the file is compressed.
+ *
+ * @param[in] baseName - name of the output file without an extension
+ * @param[in] outputType - type of output, ascii/binary/qoi
+ * @param[in] image - image structure that will be written
+ *
+ * @returns the name of the output file
+ *
+ * @par Example:
+   @verbatim
+   outputName("result", "--binary", image);
+
+   Output:
+   result.ppm
+   @endverbatim
+ *
+ *****************************************************************************/
+string outputName(string baseName, string outputType, image& image)
+{
+    compression format = compressionFromName(baseName);
+    string suffix;
+
+    if (format != COMPRESS_NONE)    // result.gz becomes result.ppm.gz
+    {
+        suffix = format == COMPRESS_GZIP ? ".gz" : ".zst";
+        baseName.resize(baseName.size() - suffix.size());
+    }
+
+    if (outputType == "--qoi")
+        return baseName + ".qoi" + suffix;
+    if (image.bits != nullptr)                  // P1/P4 bitmap result
+        return baseName + ".pbm" + suffix;
+    if (image.alpha != nullptr && outputType == "--binary")
+        return baseName + ".pam" + suffix;      // P7 with alpha
+    if (image.green == nullptr && image.green16 == nullptr)
+        return baseName + ".pgm" + suffix;      // grayscale result
+
+    return baseName + ".ppm" + suffix;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Adds one character of an ASCII sample to the value read so far. The
+ * value never passes maxValue by more than one digit, so it cannot
+ * overflow however long the run of digits is.
+ *
+ * @param[in,out] value - the sample so far, 0 before its first digit
+ * @param[in] ch - the next character of the sample
+ * @param[in] maxValue - the largest sample the image holds
+ *
+ * @returns true if ch is a digit and the value is still at most maxValue,
+ *          false if the sample is malformed
+ *
+ * @par Example:
+   @verbatim
+   addSampleDigit(value, '7', 255);
+   @endverbatim
+ *
+ *****************************************************************************/
+static bool addSampleDigit(int& value, int ch, int maxValue)
+{
+    if (ch < '0' || ch > '9')
+        return false;
+
+    value = value * 10 + (ch - '0');
+
+    return value <= maxValue;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Parses up to count samples from a piece of ASCII image data. Samples and
+ * comments are split the same way as countAsciiSamples, and the digits of
+ * each sample are converted to a 16 bit value, which holds any max value.
+ * A sample with a character that is not a digit, or with a value over
+ * maxValue, stops the parse and clears valid.
+ *
+ * @param[in] begin - first character of the piece
+ * @param[in] end - one past the last character of the piece
+ * @param[out] samples - array the samples are stored in
+ * @param[in] count - the most samples to parse
+ * @param[in] maxValue - the largest sample the image holds
+ * @param[out] valid - false if a malformed sample was found
+ *
+ * @returns the number of characters read, up to the end of the last sample
+ *          parsed
+ *
+ * @par Example:
+   @verbatim
+   parseAsciiSamples(text, text + size, samples, rows * cols * 3, 255, ok);
+   @endverbatim
+ *
+ *****************************************************************************/
+size_t parseAsciiSamples(const char* begin, const char* end, sample16* samples, size_t count, int maxValue, bool& valid)
+{
+    const char* next = begin;
+    size_t n = 0;
+    int value;
+
+    valid = true;
+    while (next < end && n < count && valid)
+    {
+        if (*next == '#')               // skip comment to end of line
+        {
+            while (next < end && *next != '\n')
+                next++;
+        }
+        else if (*next == ' ' || (*next >= '\t' && *next <= '\r'))
+        {
+            next++;
+        }
+        else                            // convert one sample
+        {
+            value = 0;
+            while (valid && next < end && *next != '#' && *next != ' ' &&
+                (*next < '\t' || *next > '\r'))
+                valid = addSampleDigit(value, *next++, maxValue);
+            samples[n++] = (sample16)value;
+        }
+    }
+
+    return next - begin;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Reads in ASCII image data. P3 has three samples per pixel and P2 has one
+ * that is copied into all three planes, 8 or 16 bit by the max value. When
+ * the stream is a file, the rest of it is read into memory and split into
+ * pieces that start at line boundaries. The samples in each piece are
+ * counted in parallel, a prefix sum of the counts gives each piece its place
+ * in the sample array, and the pieces are then parsed in parallel.
+ * Afterwards the stream is positioned just past the last sample, so another
+ * image may follow. A stream that cannot seek, like stdin, is parsed
+ * serially with the same rules. Either way a sample that is not all digits
+ * or is over the max value, or fewer samples than the image has, fails the
+ * stream.
+ *
+ * @param[in] fin - reference to input stream
+ * @param[out] image - image structure
+ *
+ * @par Example:
+   @verbatim
+   readAscii(fin, image);
+   @endverbatim
+ * 
+ *****************************************************************************/
+void readAscii(istream& fin, image& image)
+{
+    int channels = (image.magicNumber == "P2") ? 1 : 3;
+    size_t total = (size_t)image.rows * image.cols * channels;
+    sample16* samples = new (nothrow) sample16[total]();
+    streampos start = fin.tellg();
+    streambuf* buf = fin.rdbuf();
+    size_t i, n, size, consumed;
+    int ch, pieces, value;
+    bool valid = true;
+
+    if (samples == nullptr)
+    {
+        lastFailure = "Unable to allocate the ASCII buffer";
+        fin.setstate(ios::failbit);
+        return;
+    }
+
+    if (start != streampos(-1))     // a file, parse it in parallel pieces
+    {
+        fin.seekg(0, ios::end);
+        size = (size_t)(fin.tellg() - start);
+        fin.seekg(start);
+
+        vector<char> text(size + 1);
+        fin.read(text.data(), size);
+        size = (size_t)fin.gcount();
+
+        // about 1 MB per piece, each starting at the beginning of a line
+        pieces = (int)min((size_t)threadCount(), size / 1048576 + 1);
+        vector<size_t> bounds(pieces + 1, size);
+        vector<size_t> counts(pieces + 1, 0);
+        vector<size_t> stops(pieces, 0);
+        vector<char> good(pieces, 1);
+        bounds[0] = 0;
+        for (i = 1; i < (size_t)pieces; i++)
+        {
+            bounds[i] = max(bounds[i - 1], size * i / pieces);
+            while (bounds[i] < size && text[bounds[i] - 1] != '\n')
+                bounds[i]++;
+        }
+
+        parallelFor(0, pieces, [&](int first, int last)
+            {
+                for (int k = first; k < last; k++)
+                    counts[k + 1] = countAsciiSamples(&text[bounds[k]],
+                        &text[bounds[k + 1]]);
+            });
+
+        for (i = 1; i <= (size_t)pieces; i++)   // prefix sum gives offsets
+            counts[i] += counts[i - 1];
+
+        parallelFor(0, pieces, [&](int first, int last)
+            {
+                for (int k = first; k < last; k++)
+                {
+                    bool ok = true;
+                    if (counts[k] < total)
+                        stops[k] = bounds[k] + parseAsciiSamples(
+                            &text[bounds[k]], &text[bounds[k + 1]],
+                            samples + counts[k], total - counts[k],
+                            image.maxValue, ok);
+                    good[k] = ok;
+                }
+            });
+        valid = count(good.begin(), good.end(), 0) == 0;
+
+        consumed = size;                // the piece holding the last sample
+        for (i = 0; i < (size_t)pieces; i++)
+        {
+            if (counts[i] < total && counts[i + 1] >= total)
+                consumed = stops[i];
+        }
+
+        fin.clear();
+        fin.seekg(start + (streamoff)consumed);
+        if (counts[pieces] < total)     // the data ends before the last pixel
+            fin.setstate(ios::failbit);
+    }
+    else                            // a pipe, parse serially from the buffer
+    {
+        n = 0;
+        while (n < total && valid && (ch = buf->sgetc()) != EOF)
+        {
+            if (ch == '#')
+            {
+                while (ch != '\n' && ch != EOF)
+                    ch = buf->snextc();
+            }
+            else if (ch == ' ' || (ch >= '\t' && ch <= '\r'))
+            {
+                buf->sbumpc();
+            }
+            else
+            {
+                value = 0;
+                while (valid && ch != EOF && ch != '#' && ch != ' ' &&
+                    (ch < '\t' || ch > '\r'))
+                {
+                    valid = addSampleDigit(value, ch, image.maxValue);
+                    ch = buf->snextc();
+                }
+                samples[n++] = (sample16)value;
+            }
+        }
+        if (n < total)                  // the data ends before the last pixel
+            fin.setstate(ios::failbit);
+    }
+
+    if (!valid)
+    {
+        lastFailure = "A sample is not a number up to the max value";
+        fin.setstate(ios::failbit);
+    }
+
+    if (image.maxValue > 255)
+        splitSamples(samples, image.redgray16, image.green16, image.blue16,
+            image.rows, image.cols, channels);
+    else
+        splitSamples(samples, image.redgray, image.green, image.blue,
+            image.rows, image.cols, channels);
+
+    delete[] samples;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Reads in Binary image data a row at a time. P6 rows are split into the
+ * three planes by the deinterleaveRow kernel picked for this processor. P5
+ * has one sample per pixel that is copied into all three planes.
+ *
+ * @param[in] fin - reference to input stream
+ * @param[out] image - image structure
+ * 
+ * @par Example:
+   @verbatim
+   readBinary(fin, image);
+   @endverbatim
+ *
+ *****************************************************************************/
+void readBinary(istream& fin, image& image)
+{
+    int r;
+    vector<pixel> packed((size_t)image.cols * 3);
+
+    for (r = 0; r < image.rows; ++r)    // for loop to read pixels
+    {
+        if (image.magicNumber == "P5")  // one gray sample per pixel
+        {
+            fin.read((char*)image.redgray[r], image.cols);
+            memcpy(image.green[r], image.redgray[r], image.cols);
+            memcpy(image.blue[r], image.redgray[r], image.cols);
+        }
+        else
+        {
+            fin.read((char*)packed.data(), packed.size());
+            kernels.deinterleaveRow(packed.data(), image.redgray[r],
+                image.green[r], image.blue[r], image.cols);
+        }
+    }
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Reads in Binary image data with 16 bit samples, max value over 255, a row
+ * at a time. The samples are stored big endian, most significant byte
+ * first, so each row is read whole and its bytes are swapped in place by
+ * the swapRow kernel picked for this processor. P6 rows are then split into
+ * the three planes, and a P5 row is copied into all three planes.
+ *
+ * @param[in] fin - reference to input stream
+ * @param[out] image - image structure with 16 bit planes
+ *
+ * @par Example:
+   @verbatim
+   readBinary16(fin, image);
+   @endverbatim
+ *
+ *****************************************************************************/
+void readBinary16(istream& fin, image& image)
+{
+    int channels = image.magicNumber == "P5" ? 1 : 3;
+    size_t count = (size_t)image.cols * channels;
+    vector<sample16> packed(count);
+    int r, c;
+
+    for (r = 0; r < image.rows; ++r)    // for loop to read pixels
+    {
+        fin.read((char*)packed.data(), count * sizeof(sample16));
+        kernels.swapRow(packed.data(), packed.data(), (int)count);
+
+        for (c = 0; c < image.cols; ++c)
+        {
+            image.redgray16[r][c] = packed[(size_t)c * channels];
+            image.green16[r][c] = packed[(size_t)c * channels + channels / 3];
+            image.blue16[r][c] = packed[(size_t)c * channels +
+                channels / 3 * 2];
+        }
+    }
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Reads the pixels of a P1 or P4 bitmap into packed rows of 64 bit words,
+ * one bit per pixel with the first pixel in the high bit, so a mask takes an
+ * eighth of the memory of a grayscale image. P4 rows are whole bytes in the
+ * same order, so eight bytes at a time become one word. P1 pixels are the
+ * characters 0 and 1, which may run together without spaces, and comments
+ * may appear between them. Bits past the last column of a row are cleared.
+ *
+ * @param[in] fin - reference to input stream
+ * @param[out] image - image structure with the bitmap allocated
+ *
+ * @par Example:
+   @verbatim
+   readBitmap(fin, image);
+   @endverbatim
+ *
+ *****************************************************************************/
+void readBitmap(istream& fin, image& image)
+{
+    int words = (image.cols + 63) / 64, bytes = (image.cols + 7) / 8;
+    unsigned long long last = image.cols % 64 == 0 ? ~0ULL :
+        ~0ULL << (64 - image.cols % 64);
+    vector<unsigned char> packed((size_t)words * 8);
+    streambuf* in = fin.rdbuf();
+    int r, c, w, k, ch;
+
+    for (r = 0; r < image.rows; r++)
+    {
+        if (image.magicNumber == "P4")
+        {
+            fin.read((char*)packed.data(), bytes);
+            memset(packed.data() + bytes, 0, packed.size() - bytes);
+            for (w = 0; w < words; w++)
+            {
+                unsigned long long word = 0;
+                for (k = 0; k < 8; k++)
+                    word = (word << 8) | packed[w * 8 + k];
+                image.bits[r][w] = word;
+            }
+        }
+        else
+        {
+            for (c = 0; c < image.cols; c++)
+            {
+                ch = in->sgetc();
+                while (ch != EOF && ch != '0' && ch != '1')
+                {
+                    if (ch == '#')          // comment to the end of the line
+                        while (ch != EOF && ch != '\n')
+                            ch = in->snextc();
+                    else
+                        ch = in->snextc();
+                }
+                if (ch == EOF)
+                    break;
+                if (ch == '1')
+                    image.bits[r][c / 64] |= 1ULL << (63 - c % 64);
+                in->sbumpc();
+            }
+        }
+        image.bits[r][words - 1] &= last;
+    }
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Reads header. Netpbm headers are text, a QOI header is detected by its
+ * "qoif" magic bytes and read as binary. P1 and P4 bitmap headers end after
+ * the size, since a bitmap has no max value. A P7 PAM header is a line for
+ * each keyword up to ENDHDR; the tuple type is not needed, since the depth
+ * tells gray, gray with alpha, RGB and RGB with alpha apart.
+ *
+ * @param[in] fin - reference to input stream
+ * @param[out] image - image structure
+ *
+ * @par Example:
+   @verbatim
+   readHeader(fin, image);
+   @endverbatim
+ *
+ *****************************************************************************/
+void readHeader(istream& fin, image& image)
+{
+    string comment, keyword;
+    unsigned char qoiHeader[10];
+
+    if (fin.peek() == 'q')      // QOI files start with "qoif"
+    {
+        image.magicNumber.resize(4);
+        fin.read(&image.magicNumber[0], 4);
+        fin.read((char*)qoiHeader, sizeof(qoiHeader));
+
+        // width and height are stored big endian, then channels, colorspace
+        image.cols = (qoiHeader[0] << 24) | (qoiHeader[1] << 16) |
+            (qoiHeader[2] << 8) | qoiHeader[3];
+        image.rows = (qoiHeader[4] << 24) | (qoiHeader[5] << 16) |
+            (qoiHeader[6] << 8) | qoiHeader[7];
+        return;
+    }
+
+    fin >> image.magicNumber;   // get magic number
+    fin.ignore();
+
+    while (fin.peek() == '#')   // get comments
+    {
+        getline(fin, comment);
+        image.comment = image.comment + '\n' + comment;
+    }
+
+    if (image.magicNumber == "P7")  // PAM keywords
+    {
+        while (fin >> keyword && keyword != "ENDHDR")
+        {
+            if (keyword[0] == '#')
+            {
+                getline(fin, comment);
+                image.comment = image.comment + '\n' + keyword + comment;
+            }
+            else if (keyword == "WIDTH")
+                fin >> image.cols;
+            else if (keyword == "HEIGHT")
+                fin >> image.rows;
+            else if (keyword == "DEPTH")
+                fin >> image.depth;
+            else if (keyword == "MAXVAL")
+                fin >> image.maxValue;
+            else
+                getline(fin, comment);  // TUPLTYPE and unknown keywords
+        }
+        fin.ignore();
+        return;
+    }
+
+    fin >> image.cols >> image.rows;
+    if (image.magicNumber != "P1" && image.magicNumber != "P4")
+        fin >> image.maxValue;  // bitmaps have no max value
+    fin.ignore();
+
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Reads the pixels of an image whose planes are allocated, and checks that
+ * the reader got all of them. A stream that failed means a malformed
+ * sample or data that ended early; the image is then freed and the reason
+ * left in lastFailure.
+ *
+ * @param[in] fin - reference to input stream
+ * @param[in,out] image - image structure with the planes allocated
+ *
+ * @returns true if every pixel was read, false otherwise
+ *
+ * @par Example:
+   @verbatim
+   return readRaster(fin, image);
+   @endverbatim
+ *
+ *****************************************************************************/
+static bool readRaster(istream& fin, image& image)
+{
+    asciiOrBinary(fin, image);
+    if (fin)
+        return true;
+
+    if (lastFailure == "")
+        lastFailure = "The image data ends before the last pixel";
+    freeImage(image);
+
+    return false;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Reads one complete image, header and pixel data, from a stream. The Netpbm
+ * format allows several images to be concatenated in one stream, so any
+ * whitespace left after the previous image is skipped first. The color
+ * planes, or the packed rows of a P1/P4 bitmap, are allocated here and
+ * released with freeImage. A max value over 255 gets 16 bit planes; a max
+ * value under 255 is treated as 255, so the samples are used as they are.
+ * A P7 image with an alpha channel also gets an alpha plane. PAM images are
+ * read with up to four 8 bit samples per pixel.
+ *
+ * @param[in] fin - reference to input stream
+ * @param[out] image - image structure
+ *
+ * Whitespace and comment lines before the magic number are skipped, as an
+ * image may end with comments after its pixel data. When that last comment
+ * has no line break, a magic number glued to the end of its text starts the
+ * next image.
+ *
+ * @returns true if an image was read, false at the end of the stream or,
+ *          with the reason in lastFailure, if the header is not one of an
+ *          image that can be read, the planes could not be allocated or
+ *          the pixel data is malformed or ends early
+ *
+ * @par Example:
+   @verbatim
+   while (readImage(cin, image))
+   @endverbatim
+ *
+ *****************************************************************************/
+bool readImage(istream& fin, image& image)
+{
+    int ch, last;
+
+    lastFailure = "";
+    fin >> ws;
+    while (fin.peek() == '#')   // skip comments trailing the last image
+    {
+        last = '#';
+        while ((ch = fin.get()) != EOF && ch != '\n')
+        {
+            // a file ending without a line break leaves the magic number
+            // of the next image in the stream at the end of its comment
+            if (ch == 'P' && last != ' ' && last != '\t' &&
+                fin.peek() >= '1' && fin.peek() <= '7')
+            {
+                fin.unget();
+                break;
+            }
+            last = ch;
+        }
+        fin >> ws;
+    }
+    if (fin.peek() == EOF)  // no more images in the stream
+    {
+        return false;
+    }
+
+    readHeader(fin, image);
+    if (!fin || (image.magicNumber != "qoif" &&
+        (image.magicNumber.size() != 2 || image.magicNumber[0] != 'P' ||
+        image.magicNumber[1] < '1' || image.magicNumber[1] > '7')) ||
+        image.rows <= 0 || image.cols <= 0 || image.maxValue <= 0 ||
+        image.maxValue > 65535)
+    {
+        if (lastFailure == "")  // unless the stream said why
+            lastFailure = "The data is not a readable image";
+        return false;
+    }
+
+    if (image.magicNumber == "P7" && (image.depth < 1 || image.depth > 4 ||
+        image.maxValue > 255))
+    {
+        lastFailure = "Only PAM images with 1 to 4 samples of 8 bits can be "
+            "read";
+        return false;
+    }
+
+    if (image.maxValue < 255)   // 8 bit samples are kept as they are read
+    {
+        image.maxValue = 255;
+    }
+
+    if (image.magicNumber == "P1" || image.magicNumber == "P4")
+    {
+        image.bits = allocBits(image.rows, image.cols);   // one bit a pixel
+        if (image.bits == nullptr)
+        {
+            lastFailure = "Unable to allocate memory for the image";
+            return false;
+        }
+        return readRaster(fin, image);
+    }
+
+    if (image.maxValue > 255)   // two bytes a sample
+    {
+        image.redgray16 = allocPlane<sample16>(image.rows, image.cols);
+        image.green16 = allocPlane<sample16>(image.rows, image.cols);
+        image.blue16 = allocPlane<sample16>(image.rows, image.cols);
+        if (image.redgray16 == nullptr || image.green16 == nullptr ||
+            image.blue16 == nullptr)
+        {
+            lastFailure = "Unable to allocate memory for the image";
+            freeImage(image);
+            return false;
+        }
+        return readRaster(fin, image);
+    }
+
+    image.redgray = alloc2d(image.rows, image.cols);
+    image.green = alloc2d(image.rows, image.cols);
+    image.blue = alloc2d(image.rows, image.cols);
+    if (image.depth == 2 || image.depth == 4)   // gray or RGB with alpha
+        image.alpha = alloc2d(image.rows, image.cols);
+    if (image.redgray == nullptr || image.green == nullptr ||
+        image.blue == nullptr ||
+        ((image.depth == 2 || image.depth == 4) && image.alpha == nullptr))
+    {
+        lastFailure = "Unable to allocate memory for the image";
+        freeImage(image);
+        return false;
+    }
+
+    return readRaster(fin, image);
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Reads in the pixels of a P7 PAM image a row at a time. Each pixel has
+ * depth samples: gray, gray and alpha, RGB, or RGB and alpha. RGB rows are
+ * split into the planes by the deinterleaveRow kernel, a gray sample is
+ * copied into all three planes as for P5, and the last sample goes to the
+ * alpha plane when there is one.
+ *
+ * @param[in] fin - reference to input stream
+ * @param[out] image - image structure with the planes allocated
+ *
+ * @par Example:
+   @verbatim
+   readPam(fin, image);
+   @endverbatim
+ *
+ *****************************************************************************/
+void readPam(istream& fin, image& image)
+{
+    int depth = image.depth;
+    vector<pixel> packed((size_t)image.cols * depth);
+    const pixel* sample;
+    int r, c;
+
+    for (r = 0; r < image.rows; ++r)    // for loop to read pixels
+    {
+        fin.read((char*)packed.data(), packed.size());
+        if (depth == 3)
+        {
+            kernels.deinterleaveRow(packed.data(), image.redgray[r],
+                image.green[r], image.blue[r], image.cols);
+            continue;
+        }
+
+        for (c = 0; c < image.cols; ++c)
+        {
+            sample = &packed[(size_t)c * depth];
+            image.redgray[r][c] = sample[0];
+            image.green[r][c] = sample[depth < 3 ? 0 : 1];
+            image.blue[r][c] = sample[depth < 3 ? 0 : 2];
+            if (image.alpha != nullptr)
+                image.alpha[r][c] = sample[depth - 1];
+        }
+    }
+}
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Reads in QOI image data. The decoder follows the QOI specification: every
+ * chunk either repeats the previous pixel, looks a pixel up in the 64 entry
+ * index of recently seen pixels, stores a small difference from the previous
+ * pixel, or stores the full pixel. The stream buffer is read directly so the
+ * decoder runs at memory speed. The alpha channel is decoded but dropped.
+ * Data that ends before the last pixel fails the stream instead of being
+ * decoded as runs.
+ *
+ * @param[in] fin - reference to input stream
+ * @param[out] image - image structure
+ *
+ * @par Example:
+   @verbatim
+   readQoi(fin, image);
+   @endverbatim
+ *
+ *****************************************************************************/
+void readQoi(istream& fin, image& image)
+{
+    streambuf* buf = fin.rdbuf();
+    unsigned char index[64][4] = { { 0 } };
+    unsigned char px[4] = { 0, 0, 0, 255 };
+    int r, c, b1, b2, hash, run = 0;
+    int vg;
+    bool ended = false;
+    auto next = [&]()                   // the next byte, noting the end
+        {
+            int ch = buf->sbumpc();
+            ended = ended || ch == EOF;
+            return ch;
+        };
+
+    for (r = 0; r < image.rows; ++r)    // for loop to decode pixels
+    {
+        for (c = 0; c < image.cols; ++c)
+        {
+            if (run > 0)
+            {
+                run--;
+            }
+            else
+            {
+                b1 = next();
+
+                if (b1 == 0xfe)                 // QOI_OP_RGB
+                {
+                    px[0] = (unsigned char)next();
+                    px[1] = (unsigned char)next();
+                    px[2] = (unsigned char)next();
+                }
+                else if (b1 == 0xff)            // QOI_OP_RGBA
+                {
+                    px[0] = (unsigned char)next();
+                    px[1] = (unsigned char)next();
+                    px[2] = (unsigned char)next();
+                    px[3] = (unsigned char)next();
+                }
+                else if ((b1 & 0xc0) == 0x00)   // QOI_OP_INDEX
+                {
+                    memcpy(px, index[b1], 4);
+                }
+                else if ((b1 & 0xc0) == 0x40)   // QOI_OP_DIFF
+                {
+                    px[0] += ((b1 >> 4) & 0x03) - 2;
+                    px[1] += ((b1 >> 2) & 0x03) - 2;
+                    px[2] += (b1 & 0x03) - 2;
+                }
+                else if ((b1 & 0xc0) == 0x80)   // QOI_OP_LUMA
+                {
+                    b2 = next();
+                    vg = (b1 & 0x3f) - 32;
+                    px[0] += vg - 8 + ((b2 >> 4) & 0x0f);
+                    px[1] += vg;
+                    px[2] += vg - 8 + (b2 & 0x0f);
+                }
+                else                            // QOI_OP_RUN
+                {
+                    run = (b1 & 0x3f);
+                }
+
+                if (ended)                      // the data stopped early
+                {
+                    fin.setstate(ios::failbit);
+                    return;
+                }
+
+                hash = (px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64;
+                memcpy(index[hash], px, 4);
+            }
+
+            image.redgray[r][c] = px[0];
+            image.green[r][c] = px[1];
+            image.blue[r][c] = px[2];
+        }
+    }
+
+    fin.ignore(8);  // end marker
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Writes out image data in ASCII
+ *
+ * @param[in] fout - reference to output stream
+ * @param[in] image - image structure
+ * 
+ * @par Example:
+   @verbatim
+   writeAscii(fout, image);
+   @endverbatim
+ * 
+ *****************************************************************************/
+void writeAscii(ostream& fout, image& image)
+{
+    bool wide = image.maxValue > 255;
+
+    if (image.bits != nullptr)      // P1 bitmap
+    {
+        writeBitmap(fout, image, "--ascii");
+        return;
+    }
+
+    if ((wide ? (void*)image.green16 : (void*)image.green) == nullptr)
+        writeHeader(fout, image, "P2");     // grayscale has one plane
+    else
+        writeHeader(fout, image, "P3");
+
+    if (wide)
+        writeSamples(fout, image.redgray16, image.green16, image.blue16,
+            image.rows, image.cols);
+    else
+        writeSamples(fout, image.redgray, image.green, image.blue,
+            image.rows, image.cols);
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Writes out image data in Binary a row at a time. The three planes are
+ * packed into RGB triples by the interleaveRow kernel picked for this
+ * processor, and a grayscale plane is written as it is. 16 bit samples are
+ * written by writeBinary16, and an image with alpha by writePam.
+ *
+ * @param[in] fout - reference to output stream
+ * @param[in] image - image structure
+ * 
+ * @par Example:
+   @verbatim
+   writeBinary(fout, image);
+   @endverbatim
+ * 
+ *****************************************************************************/
+void writeBinary(ostream& fout, image& image)
+ {
+    int r;
+    vector<pixel> packed((size_t)image.cols * 3);
+
+    if (image.bits != nullptr)      // P4 bitmap
+    {
+        writeBitmap(fout, image, "--binary");
+        return;
+    }
+
+    if (image.alpha != nullptr)     // P7 with an alpha channel
+    {
+        writePam(fout, image);
+        return;
+    }
+
+    if (image.maxValue > 255)       // two bytes a sample
+    {
+        writeBinary16(fout, image);
+        return;
+    }
+
+    if (image.green == nullptr)     // write header, grayscale has one plane
+        writeHeader(fout, image, "P5");
+    else
+        writeHeader(fout, image, "P6");
+
+    for (r = 0; r < image.rows; r++)        // write out pixels
+    {
+        if (image.green == nullptr)         // grayscale has one plane
+        {
+            fout.write((char*)image.redgray[r], image.cols);
+        }
+        else
+        {
+            kernels.interleaveRow(image.redgray[r], image.green[r],
+                image.blue[r], packed.data(), image.cols);
+            fout.write((char*)packed.data(), packed.size());
+        }
+    }
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Writes out image data with 16 bit samples in Binary a row at a time. The
+ * planes are packed into a row of samples, RGB triples or gray, and the
+ * bytes of the row are swapped by the swapRow kernel so each sample is
+ * written big endian, most significant byte first, as the format requires.
+ *
+ * @param[in] fout - reference to output stream
+ * @param[in] image - image structure with 16 bit planes
+ *
+ * @par Example:
+   @verbatim
+   writeBinary16(fout, image);
+   @endverbatim
+ *
+ *****************************************************************************/
+void writeBinary16(ostream& fout, image& image)
+{
+    int channels = image.green16 == nullptr ? 1 : 3;
+    size_t count = (size_t)image.cols * channels;
+    vector<sample16> packed(count);
+    int r, c;
+
+    writeHeader(fout, image, channels == 1 ? "P5" : "P6");
+
+    for (r = 0; r < image.rows; r++)        // write out pixels
+    {
+        for (c = 0; c < image.cols; c++)
+        {
+            packed[(size_t)c * channels] = image.redgray16[r][c];
+            if (channels == 3)
+            {
+                packed[(size_t)c * 3 + 1] = image.green16[r][c];
+                packed[(size_t)c * 3 + 2] = image.blue16[r][c];
+            }
+        }
+
+        kernels.swapRow(packed.data(), packed.data(), (int)count);
+        fout.write((char*)packed.data(), count * sizeof(sample16));
+    }
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Writes out an image with an alpha plane as a P7 PAM image a row at a
+ * time, RGB_ALPHA for color and GRAYSCALE_ALPHA for one gray plane. The
+ * alpha samples are not premultiplied, as the format requires.
+ *
+ * @param[in] fout - reference to output stream
+ * @param[in] image - image structure with an alpha plane
+ *
+ * @par Example:
+   @verbatim
+   writePam(fout, image);
+
+   Output:
+   P7
+   WIDTH 640
+   HEIGHT 480
+   DEPTH 4
+   MAXVAL 255
+   TUPLTYPE RGB_ALPHA
+   ENDHDR
+   @endverbatim
+ *
+ *****************************************************************************/
+void writePam(ostream& fout, image& image)
+{
+    int depth = image.green == nullptr ? 2 : 4;
+    vector<pixel> packed((size_t)image.cols * depth);
+    pixel* sample;
+    int r, c;
+
+    fout << "P7" << image.comment << "\n";
+    fout << "WIDTH " << image.cols << "\nHEIGHT " << image.rows << "\n";
+    fout << "DEPTH " << depth << "\nMAXVAL " << image.maxValue << "\n";
+    fout << "TUPLTYPE " << (depth == 2 ? "GRAYSCALE_ALPHA" : "RGB_ALPHA")
+        << "\nENDHDR\n";
+
+    for (r = 0; r < image.rows; r++)        // write out pixels
+    {
+        for (c = 0; c < image.cols; c++)
+        {
+            sample = &packed[(size_t)c * depth];
+            sample[0] = image.redgray[r][c];
+            if (depth == 4)
+            {
+                sample[1] = image.green[r][c];
+                sample[2] = image.blue[r][c];
+            }
+            sample[depth - 1] = image.alpha[r][c];
+        }
+        fout.write((char*)packed.data(), packed.size());
+    }
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Writes the header of a graymap or pixmap: the magic number, the comment,
+ * the size and the max value, each on its own line. The header is the same
+ * length for P5 and P6, which lets the shard workers find where their rows
+ * go before they know which one will be written.
+ *
+ * @param[in] fout - reference to output stream
+ * @param[in] image - image structure
+ * @param[in] magicNumber - "P2", "P3", "P5" or "P6"
+ *
+ * @par Example:
+   @verbatim
+   writeHeader(fout, image, "P6");
+
+   Output:
+   P6
+   640 480
+   255
+   @endverbatim
+ *
+ *****************************************************************************/
+void writeHeader(ostream& fout, image& image, string magicNumber)
+{
+    fout << magicNumber;
+    fout << image.comment << "\n";
+    fout << image.cols << " " << image.rows << "\n";
+    fout << image.maxValue << "\n";
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Writes a bitmap as P1 or P4. P4 rows are the high bytes of each word in
+ * order, written with one write per row. P1 rows are 0 and 1 characters
+ * with a line break every 70 pixels, the longest line the format allows.
+ *
+ * @param[in] fout - reference to output stream
+ * @param[in] image - image structure holding a bitmap
+ * @param[in] outputType - "--ascii" for P1 or "--binary" for P4
+ *
+ * @par Example:
+   @verbatim
+   writeBitmap(fout, image, "--binary");
+   @endverbatim
+ *
+ *****************************************************************************/
+void writeBitmap(ostream& fout, image& image, string outputType)
+{
+    int words = (image.cols + 63) / 64, bytes = (image.cols + 7) / 8;
+    vector<char> line((size_t)words * 8 + image.cols + image.cols / 70 + 1);
+    int r, c, w, k, n;
+
+    fout << (outputType == "--ascii" ? "P1" : "P4");
+    fout << image.comment << "\n";
+    fout << image.cols << " " << image.rows << "\n";
+
+    for (r = 0; r < image.rows; r++)
+    {
+        n = 0;
+        if (outputType == "--ascii")
+        {
+            for (c = 0; c < image.cols; c++)
+            {
+                line[n++] = (image.bits[r][c / 64] >> (63 - c % 64)) & 1 ?
+                    '1' : '0';
+                if (c % 70 == 69 || c == image.cols - 1)
+                    line[n++] = '\n';
+            }
+        }
+        else
+        {
+            for (w = 0; w < words; w++)
+                for (k = 0; k < 8; k++)
+                    line[n++] = (char)(image.bits[r][w] >> (56 - 8 * k));
+            n = bytes;
+        }
+        fout.write(line.data(), n);
+    }
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Writes an image to a stream with the writer selected by the output type.
+ * Only binary output keeps an alpha plane, as a P7 PAM image; ASCII and QOI
+ * output write the colors without it.
+ *
+ * @param[in] fout - reference to output stream
+ * @param[in] image - image structure
+ * @param[in] outputType - type of output, ascii/binary/qoi
+ *
+ * @par Example:
+   @verbatim
+   writeImage(cout, image, "--binary");
+   @endverbatim
+ *
+ *****************************************************************************/
+void writeImage(ostream& fout, image& image, string outputType)
+{
+    if (outputType == "--ascii")
+    {
+        writeAscii(fout, image);
+    }
+
+    if (outputType == "--binary")
+    {
+        writeBinary(fout, image);
+    }
+
+    if (outputType == "--qoi")
+    {
+        if (image.bits != nullptr)  // QOI has no bitmap type
+            expandBitmap(image);
+        if (image.maxValue > 255)   // or 16 bit channels
+            narrowImage(image);
+        writeQoi(fout, image);
+    }
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Writes out image data in the QOI format. QOI is lossless and encodes in a
+ * single pass over the pixels, so intermediate files are a fraction of the
+ * size of P3/P6 without a slow compressor. QOI has no grayscale type, so a
+ * grayscale image is written with the gray value in all three channels. The
+ * encoded bytes are collected a row at a time and handed to the stream in one
+ * write per row.
+ *
+ * @param[in] fout - reference to output stream
+ * @param[in] image - image structure
+ *
+ * @par Example:
+   @verbatim
+   writeQoi(fout, image);
+   @endverbatim
+ *
+ *****************************************************************************/
+void writeQoi(ostream& fout, image& image)
+{
+    unsigned char index[64][4] = { { 0 } };
+    unsigned char px[4] = { 0, 0, 0, 255 };
+    unsigned char prev[4] = { 0, 0, 0, 255 };
+    unsigned char header[14] = { 'q', 'o', 'i', 'f' };
+    unsigned char endMarker[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+    unsigned char* buffer = new (nothrow) unsigned char[image.cols * 4 + 1];
+    pixel** green = image.green != nullptr ? image.green : image.redgray;
+    pixel** blue = image.blue != nullptr ? image.blue : image.redgray;
+    int r, c, n, hash, run = 0;
+    int vr, vg, vb, vgr, vgb;
+
+    if (buffer == nullptr)
+    {
+        lastFailure = "Unable to allocate the QOI buffer";
+        fout.setstate(ios::failbit);
+        return;
+    }
+
+    header[4] = (unsigned char)(image.cols >> 24);   // big endian width
+    header[5] = (unsigned char)(image.cols >> 16);
+    header[6] = (unsigned char)(image.cols >> 8);
+    header[7] = (unsigned char)image.cols;
+    header[8] = (unsigned char)(image.rows >> 24);   // big endian height
+    header[9] = (unsigned char)(image.rows >> 16);
+    header[10] = (unsigned char)(image.rows >> 8);
+    header[11] = (unsigned char)image.rows;
+    header[12] = 3;                                  // RGB
+    header[13] = 0;                                  // sRGB
+    fout.write((char*)header, sizeof(header));
+
+    for (r = 0; r < image.rows; r++)    // encode pixels
+    {
+        n = 0;
+        for (c = 0; c < image.cols; c++)
+        {
+            px[0] = image.redgray[r][c];
+            px[1] = green[r][c];
+            px[2] = blue[r][c];
+
+            if (memcmp(px, prev, 4) == 0)
+            {
+                run++;
+                if (run == 62 || (r == image.rows - 1 && c == image.cols - 1))
+                {
+                    buffer[n++] = (unsigned char)(0xc0 | (run - 1));
+                    run = 0;
+                }
+                continue;
+            }
+
+            if (run > 0)                        // finish the current run
+            {
+                buffer[n++] = (unsigned char)(0xc0 | (run - 1));
+                run = 0;
+            }
+
+            hash = (px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64;
+
+            if (memcmp(index[hash], px, 4) == 0)
+            {
+                buffer[n++] = (unsigned char)hash;
+            }
+            else
+            {
+                memcpy(index[hash], px, 4);
+
+                vr = (signed char)(px[0] - prev[0]);
+                vg = (signed char)(px[1] - prev[1]);
+                vb = (signed char)(px[2] - prev[2]);
+                vgr = vr - vg;
+                vgb = vb - vg;
+
+                if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2)
+                {
+                    buffer[n++] = (unsigned char)(0x40 | (vr + 2) << 4 |
+                        (vg + 2) << 2 | (vb + 2));
+                }
+                else if (vgr > -9 && vgr < 8 && vg > -33 && vg < 32 &&
+                    vgb > -9 && vgb < 8)
+                {
+                    buffer[n++] = (unsigned char)(0x80 | (vg + 32));
+                    buffer[n++] = (unsigned char)((vgr + 8) << 4 | (vgb + 8));
+                }
+                else
+                {
+                    buffer[n++] = 0xfe;
+                    buffer[n++] = px[0];
+                    buffer[n++] = px[1];
+                    buffer[n++] = px[2];
+                }
+            }
+
+            memcpy(prev, px, 4);
+        }
+
+        fout.write((char*)buffer, n);
+    }
+
+    fout.write((char*)endMarker, sizeof(endMarker));
+
+    delete[] buffer;
 }
\ No newline at end of file
@@ -0,0 +1,238 @@
+/** ***************************************************************************
+ * @file
+ *
+ * @brief decodes, processes and encodes images held in memory, for programs
+ *        that link the netPBM library instead of running thpe01.
+ *****************************************************************************/
+
+#include "netPBM.h"
+
+
+/******************************************************************************
+ *                              Globals
+ *****************************************************************************/
+thread_local string lastFailure;    /**< why the last call that failed on
+                                         this thread did, never printed here */
+thread_local string lastReport;     /**< lines an operation reported, such
+                                         as the numbers of --stats */
+
+
+/******************************************************************************
+ *                              Class
+ *****************************************************************************/
+/**
+ * @brief A read only stream buffer over bytes that are already in memory, so
+ *        readImage can parse an image from a buffer without copying it. The
+ *        get area can be sought, which lets readAscii parse in parallel just
+ *        as it does for a file.
+ */
+class memoryBuffer : public streambuf
+{
+public:
+    /**
+     * @brief creates a buffer that reads size bytes starting at data
+     * @param[in] data - the first byte to read
+     * @param[in] size - number of bytes that can be read
+     */
+    memoryBuffer(const char* data, size_t size)
+    {
+        char* first = const_cast<char*>(data);     // never written through
+        setg(first, first, first + size);
+    }
+
+protected:
+    /**
+     * @brief moves the read position relative to the start, the current
+     *        position or the end of the buffer
+     * @param[in] offset - distance to move
+     * @param[in] direction - where the distance is measured from
+     * @param[in] which - must include ios_base::in
+     * @returns the new position, or -1 if it is outside the buffer
+     */
+    streampos seekoff(streamoff offset, ios_base::seekdir direction,
+        ios_base::openmode which) override
+    {
+        char* from = eback();
+
+        if (direction == ios_base::cur)
+            from = gptr();
+        else if (direction == ios_base::end)
+            from = egptr();
+
+        if (!(which & ios_base::in) || offset < eback() - from ||
+            offset > egptr() - from)
+            return streampos(-1);
+
+        setg(eback(), from + offset, egptr());
+        return streampos(gptr() - eback());
+    }
+
+    /**
+     * @brief moves the read position to a distance from the start
+     * @param[in] position - distance from the start of the buffer
+     * @param[in] which - must include ios_base::in
+     * @returns the new position, or -1 if it is outside the buffer
+     */
+    streampos seekpos(streampos position, ios_base::openmode which) override
+    {
+        return seekoff(streamoff(position), ios_base::beg, which);
+    }
+};
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Reads an image from bytes in memory, in any format that thpe01 reads from
+ * a file. The bytes are read in place and are not needed once the function
+ * returns. Instead of printing a message, an imageError is thrown when the
+ * bytes are not an image, hold a malformed sample or end before the last
+ * pixel, and the picture is left empty. Its what() is the reason readImage
+ * gave.
+ *
+ * @param[in] data - the bytes of the image
+ * @param[in] size - number of bytes in data
+ * @param[out] picture - structure that receives the image
+ *
+ * @par Example:
+   @verbatim
+   decodeImage(bytes.data(), bytes.size(), picture);
+   @endverbatim
+ *
+ *****************************************************************************/
+void decodeImage(const char* data, size_t size, image& picture)
+{
+    memoryBuffer buffer(data, size);
+    istream in(&buffer);
+
+    if (!readImage(in, picture))
+    {
+        freeImage(picture);
+        throw imageError(lastFailure != "" ? lastFailure :
+            "The data is not a readable image");
+    }
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Writes an image to a string of bytes in the same way output writes a file,
+ * so the bytes match what thpe01 would write for the same output type. An
+ * imageError is thrown for an output type other than "--ascii", "--binary"
+ * or "--qoi".
+ *
+ * @param[in] picture - structure for image information
+ * @param[in] outputType - type of output, "--ascii", "--binary" or "--qoi"
+ *
+ * @returns the bytes of the written image
+ *
+ * @par Example:
+   @verbatim
+   string bytes = encodeImage(picture, "--binary");
+   @endverbatim
+ *
+ *****************************************************************************/
+string encodeImage(image& picture, string outputType)
+{
+    ostringstream out(ios::binary);
+
+    if (outputType != "--ascii" && outputType != "--binary" &&
+        outputType != "--qoi")
+        throw imageError(outputType + " is not an output type");
+
+    lastFailure = "";
+    writeImage(out, picture, outputType);
+    if (!out)
+        throw imageError(lastFailure != "" ? lastFailure :
+            "Unable to write the image");
+
+    return out.str();
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Applies the operation named by a command line option, such as "--negate"
+ * or "--brighten" with parameter "50", to an image in memory. An imageError
+ * is thrown when the operation fails, for example for a bad parameter or
+ * when memory runs out, and its what() says why. The picture may be partly
+ * changed when that happens. Text the operation reports, such as the
+ * numbers of "--stats", is returned rather than printed.
+ *
+ * @param[in,out] picture - structure for image information
+ * @param[in] option - the operation option, for example "--smooth"
+ * @param[in] parameter - the text given with the option, empty if none
+ *
+ * @returns what the operation reported, one line each, empty if nothing
+ *
+ * @par Example:
+   @verbatim
+   string stats = processImage(picture, "--stats", "0,0,64x64");
+
+   Output:
+   0,0,64x64 mean 120.5317 98.0410 77.2646 std dev 30.1127 28.9305 25.5082
+   @endverbatim
+ *
+ *****************************************************************************/
+string processImage(image& picture, string option, string parameter)
+{
+    lastFailure = "";
+    lastReport = "";
+    if (!applyOperation(picture, option, parameter))
+        throw imageError(lastFailure != "" ? lastFailure :
+            "Unable to apply " + option + " " + parameter);
+
+    return lastReport;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Decodes an image from memory, applies one operation to it and encodes the
+ * result, which is what one run of thpe01 does with files. The image is
+ * freed before returning, also when an imageError is thrown.
+ *
+ * @param[in] data - the bytes of the image
+ * @param[in] size - number of bytes in data
+ * @param[in] option - the operation option, for example "--smooth"
+ * @param[in] parameter - the text given with the option, empty if none
+ * @param[in] outputType - type of output, "--ascii", "--binary" or "--qoi"
+ *
+ * @returns the bytes of the processed image
+ *
+ * @par Example:
+   @verbatim
+   string result = transformImage(bytes.data(), bytes.size(), "--negate",
+       "", "--binary");
+   @endverbatim
+ *
+ *****************************************************************************/
+string transformImage(const char* data, size_t size, string option,
+    string parameter, string outputType)
+{
+    image picture;
+    string result;
+
+    decodeImage(data, size, picture);
+    try
+    {
+        processImage(picture, option, parameter);
+        result = encodeImage(picture, outputType);
+    }
+    catch (...)
+    {
+        freeImage(picture);
+        throw;
+    }
+
+    freeImage(picture);
+
+    return result;
+}
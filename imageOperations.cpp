@@ -2,48 +2,1090 @@
  * @file
  *
  * @brief demonstrates brighten, negate, contrast, grayscale, sharpen and 
- *        smooth.
+ *        smooth, and applies the operation chosen on the command line.
  *****************************************************************************/
 
 #include "netPBM.h"
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+
+/******************************************************************************
+ *                              Templates
+ *****************************************************************************/
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description
+ * Sets the samples around the edge of a plane of 8 or 16 bit samples to 0.
+ * The band may be wider on some sides than others, and a band wider than
+ * the plane clears the whole plane.
+ *
+ * @param[in,out] plane - the color plane to clear the edge of
+ * @param[in] rows - number of rows in the plane
+ * @param[in] cols - number of columns in the plane
+ * @param[in] top - number of rows to clear at the top
+ * @param[in] left - number of columns to clear on the left
+ * @param[in] bottom - number of rows to clear at the bottom
+ * @param[in] right - number of columns to clear on the right
+ *
+ * @par Example:
+   @verbatim
+   clearRows(image.redgray16, image.rows, image.cols, 1, 1, 1, 1)
+   @endverbatim
+ *
+ * *****************************************************************************/
+template <class T>
+static void clearRows(T** plane, int rows, int cols, int top, int left,
+    int bottom, int right)
+{
+    int r;
+
+    top = min(top, rows);
+    bottom = min(bottom, rows - top);
+    left = min(left, cols);
+    right = min(right, cols - left);
+
+    for (r = 0; r < rows; r++)
+    {
+        if (r < top || r >= rows - bottom)
+            memset(plane[r], 0, cols * sizeof(T));
+        else
+        {
+            memset(plane[r], 0, left * sizeof(T));
+            memset(plane[r] + cols - right, 0, right * sizeof(T));
+        }
+    }
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description
+ * Filters one plane of 8 or 16 bit samples with a row kernel, the work of
+ * filterPlane. Every inner row is filtered from the row above, the row
+ * itself and the row below into a new plane, the border is set to 0, and
+ * the old plane is replaced. The filter is called with the three rows, the
+ * output row and the first and last column.
+ *
+ * @param[in,out] plane - the color plane to filter
+ * @param[in] rows - rows in the plane
+ * @param[in] cols - columns in the plane
+ * @param[in] filter - the row kernel
+ *
+ * @returns true if the plane was filtered, false if memory ran out
+ *
+ * @par Example:
+   @verbatim
+   filterRows(image.redgray16, image.rows, image.cols, kernels.smoothRow16)
+   @endverbatim
+ *
+ * *****************************************************************************/
+template <class T, class Filter>
+static bool filterRows(T**& plane, int rows, int cols, Filter filter)
+{
+    T** result = allocPlane<T>(rows, cols);
+
+    if (result == nullptr)
+        return false;
+
+    parallelFor(1, rows - 1, [&](int rowStart, int rowEnd)
+        {
+            for (int r = rowStart; r < rowEnd; r++)
+                filter(plane[r - 1], plane[r], plane[r + 1], result[r], 1,
+                    cols - 1);
+        });
+
+    clearRows(result, rows, cols, 1, 1, 1, 1);
+
+    free2d(plane, rows);
+    plane = result;
+
+    return true;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description
+ * Cuts the rectangle of height rows and width columns at top, left out of
+ * each plane of 8 or 16 bit samples that is not nullptr. The rows are
+ * copied into new planes and the old planes are freed.
+ *
+ * @param[in,out] planes - the red/gray, green and blue planes
+ * @param[in] rows - rows in the planes
+ * @param[in] top - first row to keep
+ * @param[in] left - first column to keep
+ * @param[in] width - number of columns to keep
+ * @param[in] height - number of rows to keep
+ *
+ * @returns true if every plane was cropped, false if memory ran out
+ *
+ * @par Example:
+   @verbatim
+   cropPlanes(planes, image.rows, 20, 10, 64, 32)
+   @endverbatim
+ *
+ * *****************************************************************************/
+template <class T>
+static bool cropPlanes(T** planes[3], int rows, int top, int left, int width,
+    int height)
+{
+    int k;
+
+    for (k = 0; k < 3; k++)
+    {
+        T** cropped;
+
+        if (planes[k] == nullptr)
+            continue;
+
+        cropped = allocPlane<T>(height, width);
+        if (cropped == nullptr)
+            return false;
+
+        for (int r = 0; r < height; r++)
+            memcpy(cropped[r], planes[k][top + r] + left, width * sizeof(T));
+
+        free2d(planes[k], rows);
+        planes[k] = cropped;
+    }
+
+    return true;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description
+ * Stretches a plane of 8 or 16 bit samples so its darkest sample becomes 0
+ * and its brightest becomes maxValue, the work of contrast. A plane with
+ * a single value is left alone.
+ *
+ * @param[in,out] plane - the gray plane to stretch
+ * @param[in] rows - rows in the plane
+ * @param[in] cols - columns in the plane
+ * @param[in] maxValue - the largest sample value
+ *
+ * @par Example:
+   @verbatim
+   contrastPlane(image.redgray16, image.rows, image.cols, image.maxValue)
+   @endverbatim
+ *
+ * *****************************************************************************/
+template <class T>
+static void contrastPlane(T** plane, int rows, int cols, int maxValue)
+{
+    long maximum, minimum;
+    int r, c;
+    double scale;
+
+    maximum = plane[0][0];
+    minimum = plane[0][0];
+
+    for (r = 0; r < rows; r++)
+    {
+        for (c = 0; c < cols; c++)
+        {
+            if (plane[r][c] > maximum)
+                maximum = plane[r][c];
+
+            if (plane[r][c] < minimum)
+                minimum = plane[r][c];
+        }
+    }
+
+    if (maximum == minimum)
+        return;
+
+    scale = (double)maxValue / (maximum - minimum);
+
+    for (r = 0; r < rows; r++)
+    {
+        for (c = 0; c < cols; c++)
+        {
+            plane[r][c] = (T)max(0, min((int)round(scale * (plane[r][c] -
+                minimum)), maxValue));
+        }
+    }
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description
+ * Replaces the three planes of 8 or 16 bit samples with one gray plane,
+ * 0.3 red + 0.6 green + 0.1 blue rounded, the work of grayscale. The green
+ * and blue planes are freed and set to nullptr. Planes that are already
+ * gray are left alone.
+ *
+ * @param[in,out] red - the red plane, which becomes the gray plane
+ * @param[in,out] green - the green plane, freed
+ * @param[in,out] blue - the blue plane, freed
+ * @param[in] rows - rows in the planes
+ * @param[in] cols - columns in the planes
+ * @param[in] maxValue - the largest sample value
+ *
+ * @par Example:
+   @verbatim
+   grayscalePlanes(image.redgray16, image.green16, image.blue16, image.rows,
+       image.cols, image.maxValue)
+   @endverbatim
+ *
+ * *****************************************************************************/
+template <class T>
+static void grayscalePlanes(T**& red, T**& green, T**& blue, int rows,
+    int cols, int maxValue)
+{
+    int r, c;
+
+    if (green == nullptr || blue == nullptr)
+        return;
+
+    for (r = 0; r < rows; ++r)
+    {
+        for (c = 0; c < cols; ++c)
+        {
+            red[r][c] = (T)min((int)round(0.3 * (double)red[r][c] +
+                0.6 * (double)green[r][c] +
+                0.1 * (double)blue[r][c]), maxValue);
+        }
+    }
+
+    free2d(blue, rows);
+    free2d(green, rows);
+    blue = nullptr;
+    green = nullptr;
+}
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description
+ * Applies the operation named by a command line option to an image. Options
+ * that are not operations, such as the output types, leave the image alone.
+ * The parameter is the text given after the option, which most operations
+ * read as a number. A P1/P4 bitmap is handled by bitmapOperation when the
+ * operation has a bitmap version, and is unpacked to gray pixels otherwise.
+ * An image with 16 bit samples keeps them through brighten, negate,
+ * grayscale, contrast, smooth, sharpen and crop, and is reduced to 8 bits
+ * by narrowImage before the other operations. Nothing is printed: the
+ * reason for a failure is left in lastFailure, and what an operation
+ * reports, such as the numbers of --stats, is added to lastReport.
+ *
+ * @param[in,out] picture - structure for image information
+ * @param[in] option - the operation option, for example "--smooth"
+ * @param[in] parameter - the text given with the option, empty if none
+ *
+ * @returns true if the operation worked or the option is not an operation,
+ *          false if it failed, such as a bad parameter or no memory
+ *
+ * @par Example:
+   @verbatim
+   applyOperation(image, "--brighten", "100")
+
+   Output:
+   a brightened image per the value 100
+   @endverbatim
+ *
+ * *****************************************************************************/
+bool applyOperation(image& picture, string option, string parameter)
+{
+    const string eightBit[] = { "--equalize", "--clahe", "--median",
+        "--erode", "--dilate", "--open", "--close", "--boxblur", "--stddev",
+        "--stats", "--unsharp", "--edges", "--bilateral", "--over" };
+    int value = atoi(parameter.c_str());
+    bool ok;
+
+    if (picture.bits != nullptr)    // bitmaps unpack for pixel operations
+    {
+        if (bitmapOperation(picture, option, parameter, ok))
+            return ok;
+        if (!expandBitmap(picture))
+            return false;
+    }
+
+    if (picture.maxValue > 255 && find(begin(eightBit), end(eightBit),
+        option) != end(eightBit) && !narrowImage(picture))
+        return false;               // no 16 bit version
+
+    if (option == "--brighten")
+        brighten(picture, value);
+    else if (option == "--negate")
+        negateImage(picture);
+    else if (option == "--grayscale")
+        grayscale(picture);
+    else if (option == "--contrast")
+        contrast(picture);
+    else if (option == "--smooth")
+        return smooth(picture);
+    else if (option == "--sharpen")
+        return sharpen(picture);
+    else if (option == "--equalize")
+        equalize(picture);
+    else if (option == "--clahe")
+        clahe(picture, value);
+    else if (option == "--median")
+        return median(picture, value);
+    else if (option == "--erode" || option == "--dilate" ||
+        option == "--open" || option == "--close")
+        return morphology(picture, option, parameter);
+    else if (option == "--boxblur")
+        return boxFilter(picture, value, false);
+    else if (option == "--stddev")
+        return boxFilter(picture, value, true);
+    else if (option == "--stats")
+        return regionStatistics(picture, parameter);
+    else if (option == "--unsharp")
+        return unsharp(picture, parameter);
+    else if (option == "--edges")
+        return edges(picture, parameter);
+    else if (option == "--bilateral")
+        return bilateral(picture, parameter);
+    else if (option == "--over")
+        return overlayImage(picture, parameter);
+    else if (option == "--crop")
+        return cropImage(picture, parameter);
+    else if (option == "--and" || option == "--or" || option == "--xor")
+    {
+        lastFailure = option + " needs a P1/P4 bitmap";
+        return false;
+    }
+
+    return true;
+}
+
+
+ /** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description
+ * This function iterates over each pixel in the image using nested loops.
+ * For each pixel, it adds the 'value' to the red, green and blue components
+ * separately, creating a new red, green and blue values. The new red, green
+ * and blue values are then clamped to the range [0,255]. Each row is handed
+ * to the addRow kernel picked for this processor, which adds many pixels at
+ * once with saturating instructions. After the execution
+ * of the function the image will be brightened by increasing the red, green
+ * and blue components. 16 bit samples use the addRow16 kernel and are
+ * clamped to the max value of the image.
+ *
+ * @param[in,out] image - structure for image information
+ * @param[in] value - the value given by the user for amt of brightness
+ *
+ * @par Example:
+   @verbatim
+   brighten(image, 100)
+   
+   Output:
+   a brightened image per the value 100
+   @endverbatim
+ *
+ * *****************************************************************************/
+void brighten(image& image, int value)
+{
+    int r;
+
+    if (image.maxValue > 255)       // 16 bit samples
+    {
+        for (r = 0; r < image.rows; ++r)
+        {
+            kernels.addRow16(image.redgray16[r], image.cols, value,
+                image.maxValue);
+            kernels.addRow16(image.green16[r], image.cols, value,
+                image.maxValue);
+            kernels.addRow16(image.blue16[r], image.cols, value,
+                image.maxValue);
+        }
+        return;
+    }
+
+    for (r = 0; r < image.rows; ++r)
+    {
+        kernels.addRow(image.redgray[r], image.cols, value);
+        kernels.addRow(image.green[r], image.cols, value);
+        kernels.addRow(image.blue[r], image.cols, value);
+    }
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description
+ * Contrast limited adaptive histogram equalization (CLAHE). The image is
+ * converted to grayscale and split into a grid of up to 8x8 tiles. Each
+ * tile gets its own histogram, which is clipped at clipLimit times the
+ * average bin count; the clipped counts are spread evenly over all of the
+ * bins so a few outlier pixels cannot stretch the tile. The cumulative
+ * histogram of each tile becomes a lookup table. Every pixel is then mapped
+ * through the tables of the four nearest tile centers and the results are
+ * blended bilinearly, which hides the tile seams. The tile histograms are
+ * built in parallel by rows of tiles. For the blend, each row first gathers
+ * the four table values into short arrays and then mixes them with one
+ * fixed-point loop the compiler can vectorize.
+ *
+ * @param[in,out] image - structure for image information
+ * @param[in] clipLimit - contrast limit as a multiple of the average bin
+ *                        count, 3 when 0 is given
+ *
+ * @par Example:
+   @verbatim
+   clahe(image, 3)
+
+   Output:
+   a locally equalized grayscale image
+   @endverbatim
+ *
+ * *****************************************************************************/
+void clahe(image& image, int clipLimit)
+{
+    int tilesDown = min(8, image.rows), tilesAcross = min(8, image.cols);
+    int tileRows = (image.rows + tilesDown - 1) / tilesDown;
+    int tileCols = (image.cols + tilesAcross - 1) / tilesAcross;
+    vector<pixel> luts((size_t)tilesDown * tilesAcross * 256);
+    vector<int> left(image.cols), right(image.cols), weight(image.cols);
+    int c;
+
+    grayscale(image);
+
+    if (clipLimit <= 0)
+        clipLimit = 3;
+
+    tilesDown = (image.rows + tileRows - 1) / tileRows;     // no empty tiles
+    tilesAcross = (image.cols + tileCols - 1) / tileCols;
+
+    parallelFor(0, tilesDown, [&](int tileStart, int tileEnd)
+        {
+            int histogram[256];
+
+            for (int ty = tileStart; ty < tileEnd; ty++)
+            {
+                for (int tx = 0; tx < tilesAcross; tx++)
+                {
+                    int r0 = ty * tileRows, r1 = min(r0 + tileRows, image.rows);
+                    int c0 = tx * tileCols, c1 = min(c0 + tileCols, image.cols);
+                    int count = (r1 - r0) * (c1 - c0);
+                    int limit = (int)max(1LL, min((long long)count,
+                        (long long)clipLimit * count / 256));
+                    int excess = 0, sum = 0, v;
+                    pixel* lut = &luts[((size_t)ty * tilesAcross + tx) * 256];
+
+                    memset(histogram, 0, sizeof(histogram));
+                    for (int r = r0; r < r1; r++)
+                        for (int cc = c0; cc < c1; cc++)
+                            histogram[image.redgray[r][cc]]++;
+
+                    for (v = 0; v < 256; v++)           // clip the peaks
+                    {
+                        if (histogram[v] > limit)
+                        {
+                            excess += histogram[v] - limit;
+                            histogram[v] = limit;
+                        }
+                    }
+
+                    for (v = 0; v < 256; v++)           // spread the excess
+                    {
+                        sum += histogram[v] + excess / 256 +
+                            (v < excess % 256 ? 1 : 0);
+                        lut[v] = (pixel)crop((int)((255LL * sum + count / 2) /
+                            count));
+                    }
+                }
+            }
+        });
+
+    // columns between tile centers blend two tables, the edges use one
+    for (c = 0; c < image.cols; c++)
+    {
+        int scaled = (2 * c + 1 - tileCols) * 128 / tileCols;   // 256ths
+        left[c] = max(0, min(scaled >> 8, tilesAcross - 1));
+        right[c] = min(left[c] + 1, tilesAcross - 1);
+        weight[c] = scaled < 0 ? 0 : (right[c] == left[c] ? 0 : scaled & 255);
+    }
+
+    parallelFor(0, image.rows, [&](int rowStart, int rowEnd)
+        {
+            vector<int> a(image.cols), b(image.cols), d(image.cols), e(image.cols);
+
+            for (int r = rowStart; r < rowEnd; r++)
+            {
+                int scaled = (2 * r + 1 - tileRows) * 128 / tileRows;
+                int top = max(0, min(scaled >> 8, tilesDown - 1));
+                int bottom = min(top + 1, tilesDown - 1);
+                int wy = scaled < 0 ? 0 : (bottom == top ? 0 : scaled & 255);
+                const pixel* upper = &luts[(size_t)top * tilesAcross * 256];
+                const pixel* lower = &luts[(size_t)bottom * tilesAcross * 256];
+                pixel* row = image.redgray[r];
+
+                for (int cc = 0; cc < image.cols; cc++)     // gather
+                {
+                    a[cc] = upper[left[cc] * 256 + row[cc]];
+                    b[cc] = upper[right[cc] * 256 + row[cc]];
+                    d[cc] = lower[left[cc] * 256 + row[cc]];
+                    e[cc] = lower[right[cc] * 256 + row[cc]];
+                }
+
+                for (int cc = 0; cc < image.cols; cc++)     // blend
+                {
+                    int wx = weight[cc];
+                    int high = a[cc] * (256 - wx) + b[cc] * wx;
+                    int low = d[cc] * (256 - wx) + e[cc] * wx;
+                    row[cc] = (pixel)((high * (256 - wy) + low * wy + 32768) >> 16);
+                }
+            }
+        });
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description
+ * Sets the pixels around the edge of a plane to 0. The filters leave the
+ * pixels whose neighborhood runs off the image black, and this clears that
+ * band, which may be wider on some sides than others. A band wider than the
+ * plane clears the whole plane.
+ *
+ * @param[in,out] plane - the color plane to clear the edge of
+ * @param[in] rows - number of rows in the plane
+ * @param[in] cols - number of columns in the plane
+ * @param[in] top - number of rows to clear at the top
+ * @param[in] left - number of columns to clear on the left
+ * @param[in] bottom - number of rows to clear at the bottom
+ * @param[in] right - number of columns to clear on the right
+ *
+ * @par Example:
+   @verbatim
+   clearBorder(image.redgray, image.rows, image.cols, 1, 1, 1, 1)
+   @endverbatim
+ *
+ * *****************************************************************************/
+void clearBorder(pixel** plane, int rows, int cols, int top, int left,
+    int bottom, int right)
+{
+    clearRows(plane, rows, cols, top, left, bottom, right);
+}
+
 
  /** ***************************************************************************
+  * @author Heidi Anderson
+  *
+  * @par Description:
+  * Crops a number to be between 0 and 255 inclusive
+  *
+  * @param[in] num - number to be cropped
+  *
+  * @returns returns the cropped number
+  *
+  * @par Example:
+    @verbatim
+    crop(-14)
+   
+    Output:
+    0
+    @endverbatim
+  * 
+  *****************************************************************************/
+int crop(int num)
+{
+    if ( num < 0 )    // crop to zero
+    {
+        num = 0;
+    }
+
+    if ( num > 255 )  // crop to 255
+    {
+        num = 255;
+    }
+
+    return num;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description
+ * Cuts a rectangle out of an image. The region is written "left,top,WxH"
+ * and is clipped to the image; a region that misses the image leaves the
+ * image alone, with the reason in lastFailure. The rows of each color are copied
+ * into new planes by cropPlanes, 8 or 16 bit, and a bitmap is cut by
+ * cropBits without unpacking it.
+ *
+ * @param[in,out] image - structure for image information
+ * @param[in] region - the rectangle to keep, such as "10,20,64x32"
+ *
+ * @returns true if the image was cropped, false otherwise
+ *
+ * @par Example:
+   @verbatim
+   cropImage(image, "10,20,64x32")
+
+   Output:
+   the 64x32 pixels starting at column 10, row 20
+   @endverbatim
+ *
+ * *****************************************************************************/
+bool cropImage(image& image, string region)
+{
+    pixel** planes[3] = { image.redgray, image.green, image.blue };
+    sample16** wide[3] = { image.redgray16, image.green16, image.blue16 };
+    pixel** alpha[3] = { image.alpha, nullptr, nullptr };
+    int left = 0, top = 0, width = 0, height = 0;
+    bool ok;
+
+    if (sscanf(region.c_str(), "%d,%d,%dx%d", &left, &top, &width,
+        &height) != 4)
+    {
+        lastFailure = region + " is not a region, use left,top,WxH";
+        return false;
+    }
+
+    width = min(left + width, image.cols) - max(left, 0);
+    height = min(top + height, image.rows) - max(top, 0);
+    left = max(left, 0);
+    top = max(top, 0);
+    if (width <= 0 || height <= 0)
+    {
+        lastFailure = region + " is outside the image";
+        return false;
+    }
+
+    if (image.bits != nullptr)
+        return cropBits(image, top, left, width, height);
+
+    if (image.maxValue > 255)
+    {
+        ok = cropPlanes(wide, image.rows, top, left, width, height);
+        image.redgray16 = wide[0];
+        image.green16 = wide[1];
+        image.blue16 = wide[2];
+    }
+    else
+    {
+        ok = cropPlanes(planes, image.rows, top, left, width, height) &&
+            cropPlanes(alpha, image.rows, top, left, width, height);
+        image.redgray = planes[0];
+        image.green = planes[1];
+        image.blue = planes[2];
+        image.alpha = alpha[0];
+    }
+
+    if (!ok)
+        return false;
+
+    image.rows = height;
+    image.cols = width;
+
+    return true;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description
+ * This function first converts the input image to grayscale using the
+ * 'grayscale' function. The function then finds the maximum and minimum
+ * intensity values in the grayscale image. It iterates through each pixel and
+ * and keeps track of the maximum and minimum intensity values encountered.
+ * After finding the maximum and minimum intensity values, the function
+ * calculates a scaling factor 'scale' to stretch the intesntiy values to the
+ * full range of [0.255]. This scaling factor ensures that the intensity values are
+ * distributed across the entire range, effecrively enhancing the contrast.
+ *
+ * The function iterates through each pixzel of the grayscale imagte again. For
+ * each pixel, it applies the contrast enhancement formula. The resulting
+ * intensity values are then clamped to the range [0.255]. This ensures that the
+ * intensity values do not go beyond the valid range. After the function
+ * execution, the input grayscale image will have it's contrast enhanced.
+ * The work is done by contrastPlane, which stretches 16 bit samples to the
+ * max value of the image instead of 255.
+ *
+ * @param[in,out] image - structure for image information
+ * 
+ * @par Example:
+   @verbatim
+   contrast(image)
+   
+   Output:
+   a contrasted image
+   @endverbatim
+ * 
+ * *****************************************************************************/
+void contrast(image& image)
+{
+    grayscale(image);
+
+    if (image.maxValue > 255)
+        contrastPlane(image.redgray16, image.rows, image.cols, image.maxValue);
+    else
+        contrastPlane(image.redgray, image.rows, image.cols, 255);
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description
+ * Edge map. The image is turned into the gradient magnitude of its luma in
+ * one sweep: each row of luma is made from the color planes with the
+ * lumaRow kernel, and as soon as three rows are ready the gradientRow kernel
+ * finds the horizontal and vertical gradients and their magnitude for the
+ * middle one. Only three rows of luma are kept, in a ring, and no gray, Gx
+ * or Gy plane is ever stored. The rows are split into one strip per thread,
+ * and each strip is swept in tiles of columns so the ring stays in the
+ * first level cache however wide the image is.
+ *
+ * The settings name the kernel, "sobel" (the default) or "scharr", and the
+ * magnitude, "l2" (the default, approximated) or "l1", such as
+ * "scharr,l1". The magnitude is divided by the kernel weight, 4 for Sobel
+ * and 16 for Scharr, so a step from black to white gives about 255. Pixels
+ * past the edge repeat the edge pixels. The result is a grayscale image.
+ *
+ * @param[in,out] image - structure for image information
+ * @param[in] settings - kernel and magnitude names separated by a comma
+ *
+ * @returns true if the edge map was made, false if memory ran out
+ *
+ * @par Example:
+   @verbatim
+   edges(image, "sobel,l2")
+
+   Output:
+   a grayscale edge map
+   @endverbatim
+ *
+ * *****************************************************************************/
+bool edges(image& image, string settings)
+{
+    const int tileWidth = 2048;
+    bool scharr = settings.find("scharr") != string::npos;
+    bool l2 = settings.find("l1") == string::npos;
+    int side = scharr ? 3 : 1, center = scharr ? 10 : 2, shift = scharr ? 4 : 2;
+    pixel** green = image.green == nullptr ? image.redgray : image.green;
+    pixel** blue = image.blue == nullptr ? image.redgray : image.blue;
+    pixel** result = alloc2d(image.rows, image.cols);
+
+    if (result == nullptr)
+        return false;
+
+    parallelFor(0, image.rows, [&](int rowStart, int rowEnd)
+        {
+            vector<short> ring[3];
+            int rows = image.rows, cols = image.cols;
+
+            for (vector<short>& line : ring)
+                line.resize(tileWidth + 2);
+
+            for (int left = 0; left < cols; left += tileWidth)
+            {
+                int width = min(tileWidth, cols - left);
+                int first = max(left - 1, 0), last = min(left + width + 1, cols);
+
+                // luma of row y, with the columns on each side of the tile
+                auto luma = [&](int y)
+                    {
+                        short* line = &ring[(y - rowStart + 3) % 3][0];
+                        int r = max(0, min(y, rows - 1));
+
+                        kernels.lumaRow(image.redgray[r] + first,
+                            green[r] + first, blue[r] + first,
+                            line + first - (left - 1), last - first);
+                        if (left == 0)
+                            line[0] = line[1];
+                        if (left + width == cols)
+                            line[width + 1] = line[width];
+                    };
+
+                luma(rowStart - 1);
+                luma(rowStart);
+                for (int r = rowStart; r < rowEnd; r++)
+                {
+                    luma(r + 1);
+                    kernels.gradientRow(&ring[(r - rowStart + 2) % 3][0],
+                        &ring[(r - rowStart + 3) % 3][0],
+                        &ring[(r - rowStart + 4) % 3][0], result[r] + left,
+                        width, side, center, shift, l2);
+                }
+            }
+        });
+
+    freeImage(image);
+    image.redgray = result;
+
+    if (image.magicNumber == "P3")
+        image.magicNumber = "P2";
+    if (image.magicNumber == "P6")
+        image.magicNumber = "P5";
+
+    return true;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description
+ * Histogram equalization. The image is converted to grayscale, then the
+ * rows are split across threads and each thread counts its pixels into a
+ * private histogram, so no counter is shared while counting; the private
+ * histograms are added together at the end. The cumulative histogram maps
+ * every gray level to its rank among the pixels, stretched to [0,255],
+ * which spreads the levels that occur most over the widest range. Unlike
+ * contrast, a few very dark or very bright pixels do not pin the result.
+ * The table is applied in a second parallel pass.
+ *
+ * @param[in,out] image - structure for image information
+ *
+ * @par Example:
+   @verbatim
+   equalize(image)
+
+   Output:
+   an equalized grayscale image
+   @endverbatim
+ *
+ * *****************************************************************************/
+void equalize(image& image)
+{
+    long long histogram[256] = { 0 };
+    long long total = (long long)image.rows * image.cols, first = 0, sum = 0;
+    pixel lut[256];
+    mutex merge;
+    int v;
+
+    grayscale(image);
+
+    parallelFor(0, image.rows, [&](int rowStart, int rowEnd)
+        {
+            long long local[256] = { 0 };
+
+            for (int r = rowStart; r < rowEnd; r++)
+                for (int c = 0; c < image.cols; c++)
+                    local[image.redgray[r][c]]++;
+
+            lock_guard<mutex> lock(merge);
+            for (int i = 0; i < 256; i++)
+                histogram[i] += local[i];
+        });
+
+    for (v = 0; v < 256 && first == 0; v++)     // count of the darkest level
+        first = histogram[v];
+
+    for (v = 0; v < 256; v++)
+    {
+        sum += histogram[v];
+        if (total == first)
+            lut[v] = (pixel)v;                  // a single gray level
+        else
+            lut[v] = (pixel)crop((int)((255 * max(sum - first, 0LL) +
+                (total - first) / 2) / (total - first)));
+    }
+
+    parallelFor(0, image.rows, [&](int rowStart, int rowEnd)
+        {
+            for (int r = rowStart; r < rowEnd; r++)
+                for (int c = 0; c < image.cols; c++)
+                    image.redgray[r][c] = lut[image.redgray[r][c]];
+        });
+}
+
+
+/** ***************************************************************************
  * @author Heidi Anderson
  *
  * @par Description
- * This function iterates over each pixel in the image using nested loops.
- * For each pixel, it adds the 'value' to the red, green and blue components
- * separately, creating a new red, green and blue values. The new red, green
- * and blue values are then clamped to the range [0,255]. After the execution
- * of the function the image will be brightened by increasing the red, green
- * and blue components.
+ * Replaces every pixel with the median of the square of 2 * radius + 1 rows
+ * and columns around it. Unlike smooth, which averages salt and pepper noise
+ * into its neighbors, the median drops the outliers and keeps edges sharp.
+ * Each color is filtered by medianPlane.
  *
  * @param[in,out] image - structure for image information
- * @param[in] value - the value given by the user for amt of brightness
+ * @param[in] radius - radius of the square, 1 when 0 is given
+ *
+ * @returns true if every plane was filtered, false if memory ran out
  *
  * @par Example:
    @verbatim
-   brighten(image, 100)
-   
+   median(image, 2)
+
    Output:
-   a brightened image per the value 100
+   an image filtered with a 5x5 median
    @endverbatim
  *
  * *****************************************************************************/
-void brighten(image& image, int value)
+bool median(image& image, int radius)
 {
-    int r, c;
+    if (radius <= 0)
+        radius = 1;
 
-    for (r = 0; r < image.rows; ++r)
+    return medianPlane(image.redgray, image.rows, image.cols, radius)
+        && (image.green == nullptr ||
+            medianPlane(image.green, image.rows, image.cols, radius))
+        && (image.blue == nullptr ||
+            medianPlane(image.blue, image.rows, image.cols, radius));
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description
+ * Median filters one color plane. The plane is first copied into a larger
+ * plane with radius extra rows and columns on every side that repeat the
+ * edge pixels, so the border is filtered like the rest and no window needs
+ * bounds checks. The radius is limited to 127 so a window count fits in 16
+ * bits.
+ *
+ * Radius 1 and 2 use the medianRow kernel picked for this processor, which
+ * runs a sorting network over 9 or 25 pixels on a whole register of columns
+ * at once.
+ *
+ * Larger radii use the constant time algorithm of Perreault and Hebert. The
+ * rows are split into one strip per thread. Each strip keeps a histogram of
+ * every column over the window rows, and moving down a row removes one pixel
+ * from each column histogram and adds one. Moving right along a row adds the
+ * histogram of the column entering the window to the window histogram and
+ * subtracts the one leaving it, so the work per pixel does not grow with the
+ * radius. A 16 bin coarse histogram is kept next to each 256 bin fine one,
+ * so finding the median looks at no more than 32 bins.
+ *
+ * @param[in,out] plane - the color plane to filter
+ * @param[in] rows - number of rows in the plane
+ * @param[in] cols - number of columns in the plane
+ * @param[in] radius - radius of the square window
+ *
+ * @returns true if the plane was filtered, false if memory ran out
+ *
+ * @par Example:
+   @verbatim
+   medianPlane(image.redgray, image.rows, image.cols, 1)
+   @endverbatim
+ *
+ * *****************************************************************************/
+bool medianPlane(pixel**& plane, int rows, int cols, int radius)
+{
+    int side, wide;
+    pixel** padded;
+    pixel** result;
+
+    radius = min(radius, 127);
+    side = 2 * radius + 1;
+    wide = cols + 2 * radius;
+    padded = alloc2d(rows + 2 * radius, wide);
+    result = alloc2d(rows, cols);
+
+    if (padded == nullptr || result == nullptr)
     {
-        for (c = 0; c < image.cols; ++c)
+        free2d(padded, rows + 2 * radius);
+        free2d(result, rows);
+        return false;
+    }
+
+    parallelFor(0, rows + 2 * radius, [&](int rowStart, int rowEnd)
         {
-            image.redgray[r][c] = crop(image.redgray[r][c] + value);
-            image.green[r][c] = crop(image.green[r][c] + value);
-            image.blue[r][c] = crop(image.blue[r][c] + value);
+            for (int r = rowStart; r < rowEnd; r++)
+            {
+                const pixel* source = plane[max(0, min(r - radius, rows - 1))];
+                memset(padded[r], source[0], radius);
+                memcpy(padded[r] + radius, source, cols);
+                memset(padded[r] + radius + cols, source[cols - 1], radius);
+            }
+        });
 
-        }
+    if (radius <= 2)
+    {
+        parallelFor(0, rows, [&](int rowStart, int rowEnd)
+            {
+                for (int r = rowStart; r < rowEnd; r++)
+                    kernels.medianRow(padded + r, result[r], radius, 0, cols);
+            });
+    }
+    else
+    {
+        parallelFor(0, rows, [&](int rowStart, int rowEnd)
+            {
+                vector<unsigned short> fine((size_t)wide * 256);
+                vector<unsigned short> coarse((size_t)wide * 16);
+                unsigned short windowFine[256], windowCoarse[16];
+                int half = side * side / 2 + 1;     // rank of the median
+
+                for (int r = rowStart; r < rowEnd; r++)
+                {
+                    if (r == rowStart)      // column histograms of the window
+                    {
+                        for (int y = r; y < r + side; y++)
+                        {
+                            for (int c = 0; c < wide; c++)
+                            {
+                                fine[c * 256 + padded[y][c]]++;
+                                coarse[c * 16 + (padded[y][c] >> 4)]++;
+                            }
+                        }
+                    }
+                    else                    // slide every column down a row
+                    {
+                        const pixel* leaving = padded[r - 1];
+                        const pixel* entering = padded[r + side - 1];
+
+                        for (int c = 0; c < wide; c++)
+                        {
+                            fine[c * 256 + leaving[c]]--;
+                            coarse[c * 16 + (leaving[c] >> 4)]--;
+                            fine[c * 256 + entering[c]]++;
+                            coarse[c * 16 + (entering[c] >> 4)]++;
+                        }
+                    }
+
+                    memset(windowFine, 0, sizeof(windowFine));
+                    memset(windowCoarse, 0, sizeof(windowCoarse));
+                    for (int c = 0; c < side; c++)
+                    {
+                        for (int v = 0; v < 256; v++)
+                            windowFine[v] += fine[c * 256 + v];
+                        for (int v = 0; v < 16; v++)
+                            windowCoarse[v] += coarse[c * 16 + v];
+                    }
+
+                    for (int c = 0; c < cols; c++)
+                    {
+                        int count = 0, bin = 0, v;
+
+                        while (count + windowCoarse[bin] < half)
+                            count += windowCoarse[bin++];
+                        for (v = bin * 16; count + windowFine[v] < half; v++)
+                            count += windowFine[v];
+                        result[r][c] = (pixel)v;
+
+                        if (c + 1 == cols)
+                            break;
+
+                        const unsigned short* in = &fine[(c + side) * 256];
+                        const unsigned short* out = &fine[c * 256];
+                        for (v = 0; v < 256; v++)   // slide the window right
+                            windowFine[v] += in[v] - out[v];
+                        in = &coarse[(c + side) * 16];
+                        out = &coarse[c * 16];
+                        for (v = 0; v < 16; v++)
+                            windowCoarse[v] += in[v] - out[v];
+                    }
+                }
+            });
     }
+
+    free2d(padded, rows + 2 * radius);
+    free2d(plane, rows);
+    plane = result;
+
+    return true;
 }
 
 
@@ -51,65 +1093,238 @@ void brighten(image& image, int value)
  * @author Heidi Anderson
  *
  * @par Description
- * This function first converts the input image to grayscale using the
- * 'grayscale' function. The function then finds the maximum and minimum
- * intensity values in the grayscale image. It iterates through each pixel and
- * and keeps track of the maximum and minimum intensity values encountered.
- * After finding the maximum and minimum intensity values, the function
- * calculates a scaling factor 'scale' to stretch the intesntiy values to the
- * full range of [0.255]. This scaling factor ensures that the intensity values are
- * distributed across the entire range, effecrively enhancing the contrast.
- *
- * The function iterates through each pixzel of the grayscale imagte again. For
- * each pixel, it applies the contrast enhancement formula. The resulting
- * intensity values are then clamped to the range [0.255]. This ensures that the
- * intensity values do not go beyond the valid range. After the function
- * execution, the input grayscale image will have it's contrast enhanced.
+ * Grayscale morphology with a rectangle of width by height pixels. "--erode"
+ * replaces every pixel with the smallest pixel under the rectangle, which
+ * shrinks bright blobs, and "--dilate" with the largest, which grows them.
+ * "--open" erodes then dilates, removing bright specks smaller than the
+ * rectangle, and "--close" dilates then erodes, filling small dark holes.
+ * The size is given as WxH, or as one number for a square, and is 3x3 when
+ * it is missing. Each color is filtered by morphPlane, and like smooth and
+ * sharpen the pixels where the rectangle does not fit inside the image are
+ * set to 0 at the end. A bitmap is filtered by morphBits without unpacking
+ * it.
  *
  * @param[in,out] image - structure for image information
- * 
+ * @param[in] option - "--erode", "--dilate", "--open" or "--close"
+ * @param[in] size - rectangle size such as "5x3"
+ *
+ * @returns true if every plane was filtered, false if memory ran out
+ *
  * @par Example:
    @verbatim
-   contrast(image)
-   
+   morphology(image, "--open", "5x5")
+
    Output:
-   a contrasted image
+   an image with the bright specks under 5x5 removed
    @endverbatim
- * 
+ *
  * *****************************************************************************/
-void contrast(image& image)
+bool morphology(image& image, string option, string size)
 {
-    long maximum, minimum;
-    int r, c;
-    double scale;
+    pixel** planes[3] = { image.redgray, image.green, image.blue };
+    int width = 3, height = 3, k;
+    bool ok = true;
 
-    grayscale(image);
+    if (size != "")
+    {
+        width = height = atoi(size.c_str());
+        if (size.find_first_of("xX") != string::npos)
+            height = atoi(size.c_str() + size.find_first_of("xX") + 1);
+    }
+    width = max(width, 1);
+    height = max(height, 1);
 
-    maximum = image.redgray[0][0];
-    minimum = image.redgray[0][0];
+    if (image.bits != nullptr)      // a bitmap, 64 pixels at a time
+    {
+        if (option == "--erode" || option == "--dilate")
+            ok = morphBits(image, width, height, option == "--dilate");
+        else
+            ok = morphBits(image, width, height, option == "--close") &&
+                morphBits(image, width, height, option == "--open");
+
+        if (ok)
+            borderBits(image, (height - 1) / 2, (width - 1) / 2, height / 2,
+                width / 2);
+        return ok;
+    }
 
-    for (r = 0; r < image.rows; r++)
+    for (k = 0; k < 3 && ok; k++)
     {
-        for (c = 0; c < image.cols; c++)
-        {
-            if (image.redgray[r][c] > maximum)
-                maximum = image.redgray[r][c];
+        if (planes[k] == nullptr)
+            continue;
 
-            if (image.redgray[r][c] < minimum)
-                minimum = image.redgray[r][c];
-        }
+        if (option == "--erode" || option == "--dilate")
+            ok = morphPlane(planes[k], image.rows, image.cols, width, height,
+                option == "--dilate");
+        else
+            ok = morphPlane(planes[k], image.rows, image.cols, width, height,
+                option == "--close") &&
+                morphPlane(planes[k], image.rows, image.cols, width, height,
+                option == "--open");
+
+        clearBorder(planes[k], image.rows, image.cols, (height - 1) / 2,
+            (width - 1) / 2, height / 2, width / 2);
     }
 
-    scale = 255.0 / (maximum - minimum);
+    image.redgray = planes[0];
+    image.green = planes[1];
+    image.blue = planes[2];
+
+    return ok;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description
+ * Erodes or dilates one color plane with a rectangle using the van Herk /
+ * Gil-Werman algorithm, which takes three comparisons per pixel no matter
+ * how large the rectangle is. The rectangle is split into a row pass and a
+ * column pass. A line is cut into blocks as long as the rectangle; within
+ * each block a running minimum (or maximum) is taken from the left and one
+ * from the right. Every window covers the end of one block and the start of
+ * the next, so its result is the right running value at its first pixel
+ * combined with the left running value at its last pixel. Pixels past the
+ * edge of the plane count as 255 for erode and 0 for dilate, so they never
+ * win.
+ *
+ * The row pass runs each row on its own thread. The column pass works on
+ * whole rows at a time with the minRow or maxRow kernel picked for this
+ * processor, so every comparison covers a register of columns.
+ *
+ * @param[in,out] plane - the color plane to filter
+ * @param[in] rows - number of rows in the plane
+ * @param[in] cols - number of columns in the plane
+ * @param[in] width - width of the rectangle
+ * @param[in] height - height of the rectangle
+ * @param[in] dilate - true to take the maximum, false for the minimum
+ *
+ * @returns true if the plane was filtered, false if memory ran out
+ *
+ * @par Example:
+   @verbatim
+   morphPlane(image.redgray, image.rows, image.cols, 5, 3, false)
+   @endverbatim
+ *
+ * *****************************************************************************/
+bool morphPlane(pixel**& plane, int rows, int cols, int width, int height,
+    bool dilate)
+{
+    void (*pick)(const pixel*, const pixel*, pixel*, int) =
+        dilate ? kernels.maxRow : kernels.minRow;
+    pixel edge = dilate ? 0 : 255;
+    int blocks = (rows + height - 1 + height - 1) / height;
+    int lines = blocks * height;        // padded rows, whole blocks
+    pixel** across = alloc2d(rows, cols);
+    pixel** fromTop = alloc2d(lines, cols);
+    pixel** fromBottom = alloc2d(lines, cols);
+    vector<pixel> outside(cols, edge);
 
-    for (r = 0; r < image.rows; r++)
+    if (across == nullptr || fromTop == nullptr || fromBottom == nullptr)
     {
-        for (c = 0; c < image.cols; c++)
+        free2d(across, rows);
+        free2d(fromTop, lines);
+        free2d(fromBottom, lines);
+        return false;
+    }
+
+    parallelFor(0, rows, [&](int rowStart, int rowEnd)    // row pass
         {
-            image.redgray[r][c] = crop((int)round(scale * (image.redgray[r][c] - minimum)));
+            int length = (cols + width - 1 + width - 1) / width * width;
+            vector<pixel> line(length, edge), left(length), right(length);
 
-        }
-    }
+            for (int r = rowStart; r < rowEnd; r++)
+            {
+                memcpy(&line[(width - 1) / 2], plane[r], cols);
+
+                for (int b = 0; b < length; b += width)
+                {
+                    left[b] = line[b];
+                    right[b + width - 1] = line[b + width - 1];
+                    for (int i = 1; i < width; i++)
+                    {
+                        int j = b + width - 1 - i;
+                        left[b + i] = dilate ? max(left[b + i - 1], line[b + i])
+                            : min(left[b + i - 1], line[b + i]);
+                        right[j] = dilate ? max(right[j + 1], line[j])
+                            : min(right[j + 1], line[j]);
+                    }
+                }
+
+                pick(&right[0], &left[width - 1], across[r], cols);
+            }
+        });
+
+    parallelFor(0, blocks, [&](int blockStart, int blockEnd)    // column pass
+        {
+            for (int b = blockStart * height; b < blockEnd * height; b += height)
+            {
+                for (int i = 0; i < height; i++)
+                {
+                    int top = b + i - (height - 1) / 2;
+                    int bottom = b + height - 1 - i - (height - 1) / 2;
+                    const pixel* down = top >= 0 && top < rows ? across[top]
+                        : &outside[0];
+                    const pixel* up = bottom >= 0 && bottom < rows ?
+                        across[bottom] : &outside[0];
+
+                    if (i == 0)
+                    {
+                        memcpy(fromTop[b], down, cols);
+                        memcpy(fromBottom[b + height - 1], up, cols);
+                    }
+                    else
+                    {
+                        pick(fromTop[b + i - 1], down, fromTop[b + i], cols);
+                        pick(fromBottom[b + height - i], up,
+                            fromBottom[b + height - 1 - i], cols);
+                    }
+                }
+            }
+        });
+
+    parallelFor(0, rows, [&](int rowStart, int rowEnd)
+        {
+            for (int r = rowStart; r < rowEnd; r++)
+                pick(fromBottom[r], fromTop[r + height - 1], across[r], cols);
+        });
+
+    free2d(fromTop, lines);
+    free2d(fromBottom, lines);
+    free2d(plane, rows);
+    plane = across;
+
+    return true;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description
+ * Filters one color plane with a row kernel. A new plane is allocated and
+ * every inner row is filtered from the row above, the row itself and the
+ * row below, while the border rows and columns are set to 0 like smooth and
+ * sharpen always have. The rows are split across threads with parallelFor.
+ * The old plane is freed and replaced by the new one.
+ *
+ * @param[in,out] plane - the color plane to filter
+ * @param[in] rows - rows in the plane
+ * @param[in] cols - columns in the plane
+ * @param[in] filter - the row kernel, for example kernels.smoothRow
+ *
+ * @returns true if the plane was filtered, false if memory ran out
+ *
+ * @par Example:
+   @verbatim
+   filterPlane(image.redgray, image.rows, image.cols, kernels.smoothRow)
+   @endverbatim
+ *
+ * *****************************************************************************/
+bool filterPlane(pixel**& plane, int rows, int cols, rowStencil filter)
+{
+    return filterRows(plane, rows, cols, filter);
 }
 
 
@@ -125,7 +1340,7 @@ void contrast(image& image)
  * image will be converted to grayscale. Each pixel in the output image will
  * represent a shade of gray, and the color information from the original image
  * will be discarded. The updated magicNumber indicates the type of new image
- * file.
+ * file. The planes are converted by grayscalePlanes, 8 or 16 bit.
  *
  * @param[in,out] image - structure for image information
  * 
@@ -139,30 +1354,82 @@ void contrast(image& image)
  * *****************************************************************************/
 void grayscale(image& image)
 {
-    int r, c;
-    pixel** grayscale = alloc2d(image.rows, image.cols);
-
     if (image.magicNumber == "P3")
         image.magicNumber = "P2";
 
     if (image.magicNumber == "P6")
         image.magicNumber = "P5";
 
-    for (r = 0; r < image.rows; ++r)
+    if (image.maxValue > 255)
+        grayscalePlanes(image.redgray16, image.green16, image.blue16,
+            image.rows, image.cols, image.maxValue);
+    else
+        grayscalePlanes(image.redgray, image.green, image.blue, image.rows,
+            image.cols, 255);
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description
+ * Reduces an image with 16 bit samples to 8 bit pixels, for the operations
+ * and output formats that only have an 8 bit version. Every sample is
+ * scaled from [0,maxValue] to [0,255] and rounded, the rows are split
+ * across threads, and the 16 bit planes are freed. An image that is
+ * already 8 bit is left alone.
+ *
+ * @param[in,out] image - structure for image information
+ *
+ * @returns true if the image has 8 bit pixels, false if memory ran out
+ *
+ * @par Example:
+   @verbatim
+   narrowImage(image)
+
+   Output:
+   the image with a max value of 255
+   @endverbatim
+ *
+ * *****************************************************************************/
+bool narrowImage(image& image)
+{
+    sample16** wide[3] = { image.redgray16, image.green16, image.blue16 };
+    pixel** planes[3] = { nullptr, nullptr, nullptr };
+    int maxValue = image.maxValue, k;
+
+    if (maxValue <= 255)
+        return true;
+
+    for (k = 0; k < 3; k++)
     {
-        for (c = 0; c < image.cols; ++c)
+        if (wide[k] == nullptr)
+            continue;
+
+        planes[k] = alloc2d(image.rows, image.cols);
+        if (planes[k] == nullptr)
         {
-            grayscale[r][c] = crop((pixel)round(0.3 * (double)image.redgray[r][c] +
-                0.6 * (double)image.green[r][c] +
-                0.1 * (double)image.blue[r][c]));
+            while (k > 0)
+                free2d(planes[--k], image.rows);
+            return false;
         }
+
+        parallelFor(0, image.rows, [&](int rowStart, int rowEnd)
+            {
+                for (int r = rowStart; r < rowEnd; r++)
+                    for (int c = 0; c < image.cols; c++)
+                        planes[k][r][c] = (pixel)((min((int)wide[k][r][c],
+                            maxValue) * 255 + maxValue / 2) / maxValue);
+            });
     }
 
-    copy2d(grayscale, image.redgray, image.rows, image.cols);
+    freeImage(image);
+    image.redgray = planes[0];
+    image.green = planes[1];
+    image.blue = planes[2];
+    image.maxValue = 255;
 
-    free2d(grayscale, image.rows);
-    image.blue = nullptr;
-    image.green = nullptr;
+    return true;
 }
 
 
@@ -176,7 +1443,9 @@ void grayscale(image& image)
  * value by subtracting the original color values from 255. In other words, it 
  * converts a bright pixel to a dark pixel and vice versa. After the function 
  * execution, the input image will be negated, meaning that all colors will be
- * inverted. White pixels become black, black becomes white, and so on.
+ * inverted. White pixels become black, black becomes white, and so on. The
+ * rows are negated by the negateRow kernel picked for this processor, and
+ * 16 bit samples by negateRow16, which subtracts them from the max value.
  *
  * @param[in,out] image - structure for image information
  * 
@@ -190,16 +1459,25 @@ void grayscale(image& image)
  * *****************************************************************************/
 void negateImage(image& image)
 {
-    int r, c;
+    int r;
 
-    for (r = 0; r < image.rows; ++r)    // for loop to implement negation
+    if (image.maxValue > 255)       // 16 bit samples
     {
-        for (c = 0; c < image.cols; ++c)
+        for (r = 0; r < image.rows; ++r)
         {
-            image.redgray[r][c] = 255 - image.redgray[r][c];
-            image.green[r][c] = 255 - image.green[r][c];
-            image.blue[r][c] = 255 - image.blue[r][c];
+            kernels.negateRow16(image.redgray16[r], image.cols,
+                image.maxValue);
+            kernels.negateRow16(image.green16[r], image.cols, image.maxValue);
+            kernels.negateRow16(image.blue16[r], image.cols, image.maxValue);
         }
+        return;
+    }
+
+    for (r = 0; r < image.rows; ++r)    // for loop to implement negation
+    {
+        kernels.negateRow(image.redgray[r], image.cols);
+        kernels.negateRow(image.green[r], image.cols);
+        kernels.negateRow(image.blue[r], image.cols);
     }
 
 }
@@ -219,7 +1497,9 @@ void negateImage(image& image)
  * range [0,255]. After processing all pixels, the function updates the input
  * image's pixel arrays with the smoothed pixel values stored in the new 2D 
  * arrays. Finally, the function deallocates the memory occupied by the new 2D
- * arrayus using the free2d function.
+ * arrayus using the free2d function. The work for each color is done by
+ * filterPlane with the smoothRow kernel picked for this processor, or with
+ * smoothRow16 for 16 bit samples.
  *
  * @param[in,out] image - structure for image information
  *
@@ -236,57 +1516,17 @@ void negateImage(image& image)
  * *****************************************************************************/
 bool smooth(image& image)
 {
-    pixel** newRed = alloc2d(image.rows, image.cols);
-    pixel** newGreen = alloc2d(image.rows, image.cols);
-    pixel** newBlue = alloc2d(image.rows, image.cols);
-    double average;
-    int r, c;
-
-    for (r = 0; r < image.rows; r++)
-    {
-        for (c = 0; c < image.cols; c++)
-        {
-            if (r == 0 || c == 0 ||
-                r == image.rows - 1 || c == image.cols - 1)
-            {
-                newRed[r][c] = 0;
-                newBlue[r][c] = 0;
-                newGreen[r][c] = 0;
-            }
-            else
-            {
-                average = ((unsigned long)image.redgray[r - 1][c - 1] +
-                    image.redgray[r - 1][c] + image.redgray[r - 1][c + 1] +
-                    image.redgray[r][c - 1] + image.redgray[r][c]
-                    + image.redgray[r][c + 1] + image.redgray[r + 1][c - 1] +
-                    image.redgray[r + 1][c] + image.redgray[r + 1][c + 1]) / 9.0;
-                newRed[r][c] = crop((int)average);
-
-                average = ((unsigned long)image.green[r - 1][c - 1] +
-                    image.green[r - 1][c] + image.green[r - 1][c + 1] +
-                    image.green[r][c - 1] + image.green[r][c]
-                    + image.green[r][c + 1] + image.green[r + 1][c - 1] +
-                    image.green[r + 1][c] + image.green[r + 1][c + 1]) / 9.0;
-                newGreen[r][c] = crop((int)average);
-
-                average = ((unsigned long)image.blue[r - 1][c - 1] +
-                    image.blue[r - 1][c] + image.blue[r - 1][c + 1] +
-                    image.blue[r][c - 1] + image.blue[r][c]
-                    + image.blue[r][c + 1] + image.blue[r + 1][c - 1] +
-                    image.blue[r + 1][c] + image.blue[r + 1][c + 1]) / 9.0;
-                newBlue[r][c] = crop((int)average);;
-            }
-        }
-    }
-
-    copy2d(newRed, image.redgray, image.rows, image.cols);
-    copy2d(newGreen, image.green, image.rows, image.cols);
-    copy2d(newBlue, image.blue, image.rows, image.cols);
-
-    free2d(newRed, image.rows), free2d(newBlue, image.rows), free2d(newGreen, image.rows);
-
-    return true;
+    if (image.maxValue > 255)
+        return filterRows(image.redgray16, image.rows, image.cols,
+            kernels.smoothRow16)
+            && filterRows(image.green16, image.rows, image.cols,
+                kernels.smoothRow16)
+            && filterRows(image.blue16, image.rows, image.cols,
+                kernels.smoothRow16);
 
+    return filterPlane(image.redgray, image.rows, image.cols, kernels.smoothRow)
+        && filterPlane(image.green, image.rows, image.cols, kernels.smoothRow)
+        && filterPlane(image.blue, image.rows, image.cols, kernels.smoothRow);
 }
 
 
@@ -307,7 +1547,9 @@ bool smooth(image& image)
  * result to the rang [0.255]. After processing all pixels, the function updates
  * the images pixel arrays with the sharpened pixel values stored in the new 2D
  * arrays. Finally, the function deallocates the memory occupied by the new 2D 
- * arrays's by using the free2d function.
+ * arrays's by using the free2d function. The work for each color is done by
+ * filterPlane with the sharpenRow kernel picked for this processor, or with
+ * sharpenRow16 for 16 bit samples, clamped to the max value.
  *
  * @param[in,out] image - structure for image information
  *
@@ -324,47 +1566,166 @@ bool smooth(image& image)
  * *****************************************************************************/
 bool sharpen(image& image)
 {
-    pixel** newRed = alloc2d(image.rows, image.cols);
-    pixel** newGreen = alloc2d(image.rows, image.cols);
-    pixel** newBlue = alloc2d(image.rows, image.cols);
-    int r, c;
+    int maxValue = image.maxValue;
+    auto sharpen16 = [maxValue](const sample16* above, const sample16* row,
+        const sample16* below, sample16* out, int first, int last)
+        {
+            kernels.sharpenRow16(above, row, below, out, first, last,
+                maxValue);
+        };
+
+    if (image.maxValue > 255)
+        return filterRows(image.redgray16, image.rows, image.cols, sharpen16)
+            && filterRows(image.green16, image.rows, image.cols, sharpen16)
+            && filterRows(image.blue16, image.rows, image.cols, sharpen16);
+
+    return filterPlane(image.redgray, image.rows, image.cols, kernels.sharpenRow)
+        && filterPlane(image.green, image.rows, image.cols, kernels.sharpenRow)
+        && filterPlane(image.blue, image.rows, image.cols, kernels.sharpenRow);
+}
+
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description
+ * Unsharp mask. Every pixel is pushed away from the blur of the square of
+ * 2 * radius + 1 rows and columns around it: the result is the pixel plus
+ * amount times the pixel minus the blur. Differences smaller than threshold
+ * are left alone, so flat areas and film grain are not sharpened. The
+ * parameter is written "radius,amount,threshold", and missing values are
+ * radius 2, amount 1 and threshold 0. Each color is done by unsharpPlane.
+ *
+ * @param[in,out] image - structure for image information
+ * @param[in] settings - the radius, amount and threshold, such as "3,1.5,4"
+ *
+ * @returns true if every plane was sharpened, false if memory ran out
+ *
+ * @par Example:
+   @verbatim
+   unsharp(image, "3,1.5,4")
+
+   Output:
+   a sharpened image
+   @endverbatim
+ *
+ * *****************************************************************************/
+bool unsharp(image& image, string settings)
+{
+    pixel** planes[3] = { image.redgray, image.green, image.blue };
+    int radius = 2, threshold = 0, k;
+    double amount = 1;
+    bool ok = true;
+
+    sscanf(settings.c_str(), "%d,%lf,%d", &radius, &amount, &threshold);
+    radius = max(1, min(radius, 127));
+    amount = max(0.0, min(amount, 16.0));
+    threshold = max(threshold, 0);
 
-    for (r = 0; r < image.rows; r++)
+    for (k = 0; k < 3 && ok; k++)
     {
-        for (c = 0; c < image.cols; c++)
+        if (planes[k] != nullptr)
+            ok = unsharpPlane(planes[k], image.rows, image.cols, radius,
+                (int)(amount * 256 + 0.5), threshold);
+    }
+
+    image.redgray = planes[0];
+    image.green = planes[1];
+    image.blue = planes[2];
+
+    return ok;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description
+ * Unsharp masks one color plane in a single pass with integer math. The
+ * rows are split into one strip per thread. Each strip keeps one running
+ * sum per column over the 2 * radius + 1 rows around the current row, and
+ * moving down a row adds the row entering the window and subtracts the one
+ * leaving it. A running sum along those column sums gives the box sum for
+ * each pixel, so no blurred plane is ever stored; the only extra memory is
+ * one row of column sums per thread. Rows and columns past the edge repeat
+ * the edge pixels.
+ *
+ * The box sum is n times the blur, where n is the number of pixels in the
+ * square, so the pixel times n minus the sum is the difference scaled by n
+ * with no rounding. The threshold is tested on that value, and it is scaled
+ * back by a multiply with a 32 bit reciprocal of n instead of a divide.
+ *
+ * @param[in,out] plane - the color plane to sharpen
+ * @param[in] rows - number of rows in the plane
+ * @param[in] cols - number of columns in the plane
+ * @param[in] radius - radius of the blur square
+ * @param[in] amount - strength in 256ths, 256 adds the difference once
+ * @param[in] threshold - smallest difference from the blur that is changed
+ *
+ * @returns true if the plane was sharpened, false if memory ran out
+ *
+ * @par Example:
+   @verbatim
+   unsharpPlane(image.redgray, image.rows, image.cols, 2, 384, 0)
+   @endverbatim
+ *
+ * *****************************************************************************/
+bool unsharpPlane(pixel**& plane, int rows, int cols, int radius, int amount,
+    int threshold)
+{
+    pixel** result = alloc2d(rows, cols);
+    long long n = (long long)(2 * radius + 1) * (2 * radius + 1);
+    long long reciprocal = (1LL << 32) / n;
+
+    if (result == nullptr)
+        return false;
+
+    parallelFor(0, rows, [&](int rowStart, int rowEnd)
         {
-            if (r == 0 || c == 0 || r == image.rows - 1 || c == image.cols - 1)
+            vector<int> columns(cols, 0);
+
+            for (int y = rowStart - radius; y <= rowStart + radius; y++)
             {
-                newRed[r][c] = 0;
-                newBlue[r][c] = 0;
-                newGreen[r][c] = 0;
+                const pixel* source = plane[max(0, min(y, rows - 1))];
+                for (int c = 0; c < cols; c++)
+                    columns[c] += source[c];
             }
-            else
+
+            for (int r = rowStart; r < rowEnd; r++)
             {
-                newRed[r][c] = crop(5 * image.redgray[r][c] - image.redgray[r][c - 1] -
-                    image.redgray[r - 1][c] - image.redgray[r + 1][c] -
-                    image.redgray[r][c + 1]);
+                const pixel* row = plane[r];
+                int box = 0;
 
-                newGreen[r][c] = crop(5 * image.green[r][c] - image.green[r][c - 1] -
-                    image.green[r - 1][c] - image.green[r + 1][c] -
-                    image.green[r][c + 1]);
+                if (r > rowStart)       // slide the column sums down a row
+                {
+                    const pixel* entering = plane[min(r + radius, rows - 1)];
+                    const pixel* leaving = plane[max(r - radius - 1, 0)];
+                    for (int c = 0; c < cols; c++)
+                        columns[c] += entering[c] - leaving[c];
+                }
 
-                newBlue[r][c] = crop(5 * image.blue[r][c] - image.blue[r][c - 1] -
-                    image.blue[r - 1][c] - image.blue[r + 1][c] -
-                    image.blue[r][c + 1]);
-            }
-        }
-    }
+                for (int x = -radius; x <= radius; x++)
+                    box += columns[max(0, min(x, cols - 1))];
 
-    copy2d(newRed, image.redgray, image.rows, image.cols);
-    copy2d(newGreen, image.green, image.rows, image.cols);
-    copy2d(newBlue, image.blue, image.rows, image.cols);
+                for (int c = 0; c < cols; c++)
+                {
+                    long long scaled = row[c] * n - box;  // n * (pixel - blur)
 
-    free2d(newRed, image.rows);
-    free2d(newBlue, image.rows);
-    free2d(newGreen, image.rows);
+                    if (scaled >= threshold * n || -scaled >= threshold * n)
+                        result[r][c] = (pixel)crop(row[c] + (int)((amount *
+                            scaled * reciprocal + (1LL << 39)) >> 40));
+                    else
+                        result[r][c] = row[c];
 
-    return true;
+                    box += columns[min(c + radius + 1, cols - 1)] -
+                        columns[max(c - radius, 0)];
+                }
+            }
+        });
 
-}
+    free2d(plane, rows);
+    plane = result;
 
+    return true;
+}
@@ -0,0 +1,676 @@
+/** ***************************************************************************
+ * @file
+ *
+ * @brief reprocesses only the tiles of an image that changed since the last
+ *        run and patches them into the output file that run wrote.
+ *****************************************************************************/
+
+#include "netPBM.h"
+#include <atomic>
+#include <filesystem>
+#include <iomanip>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+
+/******************************************************************************
+ *                              Globals
+ *****************************************************************************/
+static const int tileSize = 64;     /**< width and height of a hashed tile */
+
+
+/******************************************************************************
+ *                              Struct
+ *****************************************************************************/
+/**
+ * @brief What the last incremental run kept next to its output: how the
+ *        output was made, the size and last write time it was left with, and
+ *        a hash of each tile of the input, row by row.
+ */
+struct tileRecord
+{
+    string option;              /**< Image operation choice */
+    string parameter;           /**< Text given with the option */
+    string outputFile;          /**< Name of the output file */
+    long long modified = 0;     /**< Last write time of the output file */
+    long long size = 0;         /**< Size of the output file in bytes */
+    int cols = 0;               /**< Number of columns in the input */
+    int rows = 0;               /**< Number of rows in the input */
+    int maxValue = 0;           /**< Largest sample value of the input */
+    unsigned long long comment = 0;     /**< Hash of the input comment */
+    vector<unsigned long long> hashes;  /**< Hash of each input tile */
+};
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Adds a run of bytes to a 64 bit hash, eight bytes at a time. Each word is
+ * mixed in with a multiply and a shift, which is enough to tell an edited
+ * tile from the one before it at several GB a second.
+ *
+ * @param[in] data - the bytes to add
+ * @param[in] size - number of bytes
+ * @param[in] hash - the hash so far
+ *
+ * @returns the hash with the bytes added
+ *
+ * @par Example:
+   @verbatim
+   hash = hashBytes(image.redgray[r] + c, 64, hash);
+   @endverbatim
+ *
+ *****************************************************************************/
+static unsigned long long hashBytes(const void* data, size_t size,
+    unsigned long long hash)
+{
+    const unsigned char* next = (const unsigned char*)data;
+    unsigned long long word;
+
+    for (; size >= 8; size -= 8, next += 8)
+    {
+        memcpy(&word, next, 8);
+        hash = (hash ^ word) * 0x9e3779b97f4a7c15ULL;
+        hash ^= hash >> 32;
+    }
+
+    word = size;                    // the tail and its length
+    memcpy(&word, next, size);
+    hash = (hash ^ word ^ (size << 56)) * 0x9e3779b97f4a7c15ULL;
+
+    return hash ^ (hash >> 32);
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Hashes every tileSize square tile of an image, 8 or 16 bit, over all of
+ * its color planes. The tiles are in rows from the top left, and the rows
+ * of tiles are hashed in parallel.
+ *
+ * @param[in] picture - image structure
+ *
+ * @returns the hash of each tile
+ *
+ * @par Example:
+   @verbatim
+   hashTiles(image);
+   @endverbatim
+ *
+ *****************************************************************************/
+static vector<unsigned long long> hashTiles(image& picture)
+{
+    pixel** planes[3] = { picture.redgray, picture.green, picture.blue };
+    sample16** planes16[3] = { picture.redgray16, picture.green16,
+        picture.blue16 };
+    bool wide = picture.maxValue > 255;
+    int across = (picture.cols + tileSize - 1) / tileSize;
+    int down = (picture.rows + tileSize - 1) / tileSize;
+    vector<unsigned long long> hashes((size_t)across * down);
+
+    parallelFor(0, down, [&](int first, int last)
+        {
+            for (int j = first; j < last; j++)
+            {
+                int top = j * tileSize;
+                int bottom = min(top + tileSize, picture.rows);
+
+                for (int i = 0; i < across; i++)
+                {
+                    int left = i * tileSize;
+                    int width = min(tileSize, picture.cols - left);
+                    unsigned long long hash = 0;
+
+                    for (int k = 0; k < 3; k++)
+                    {
+                        if (wide ? planes16[k] == nullptr :
+                            planes[k] == nullptr)
+                            continue;
+                        hash = hashBytes(&k, sizeof(k), hash);
+                        for (int r = top; r < bottom; r++)
+                            hash = wide ? hashBytes(planes16[k][r] + left,
+                                width * sizeof(sample16), hash) :
+                                hashBytes(planes[k][r] + left, width, hash);
+                    }
+                    hashes[(size_t)j * across + i] = hash;
+                }
+            }
+        });
+
+    return hashes;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Reads the size and last write time of a file into a tile record.
+ *
+ * @param[in] fileName - name of the file
+ * @param[out] record - the record the size and time are stored in
+ *
+ * @returns true if the file exists, false otherwise
+ *
+ * @par Example:
+   @verbatim
+   stampOutput("result.ppm", record);
+   @endverbatim
+ *
+ *****************************************************************************/
+static bool stampOutput(string fileName, tileRecord& record)
+{
+    error_code error;
+
+    record.size = (long long)fs::file_size(fileName, error);
+    if (error)
+        return false;
+    record.modified = (long long)fs::last_write_time(fileName, error)
+        .time_since_epoch().count();
+
+    return !error;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Reads the tile record of the last incremental run. The first line names
+ * the columns of the second, which is tab separated like an --info index,
+ * and each line after that holds the tile hashes of one row of tiles.
+ *
+ * @param[in] fileName - name of the record file
+ * @param[out] record - the record that was read
+ *
+ * @returns true if the record was complete, false otherwise
+ *
+ * @par Example:
+   @verbatim
+   readTileRecord("result.tiles", record);
+   @endverbatim
+ *
+ *****************************************************************************/
+static bool readTileRecord(string fileName, tileRecord& record)
+{
+    ifstream fin(fileName);
+    vector<string> fields;
+    string line, field;
+    unsigned long long hash;
+
+    getline(fin, line);                 // skip the column names
+    if (!getline(fin, line))
+        return false;
+
+    istringstream columns(line);
+    while (getline(columns, field, '\t'))
+        fields.push_back(field);
+    if (fields.size() != 10)
+        return false;
+
+    record.option = fields[0];
+    record.parameter = fields[1];
+    record.outputFile = fields[2];
+    record.modified = atoll(fields[3].c_str());
+    record.size = atoll(fields[4].c_str());
+    record.cols = atoi(fields[5].c_str());
+    record.rows = atoi(fields[6].c_str());
+    record.maxValue = atoi(fields[7].c_str());
+    record.comment = strtoull(fields[8].c_str(), nullptr, 16);
+
+    while (fin >> hex >> hash)
+        record.hashes.push_back(hash);
+
+    return record.hashes.size() == (size_t)atoll(fields[9].c_str());
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Writes a tile record for the next incremental run, to a temporary file
+ * that is then renamed, so an interrupted run leaves the old record.
+ *
+ * @param[in] fileName - name of the record file
+ * @param[in] record - the record to write
+ *
+ * @returns true if the record was written, false otherwise
+ *
+ * @par Example:
+   @verbatim
+   writeTileRecord("result.tiles", record);
+   @endverbatim
+ *
+ *****************************************************************************/
+static bool writeTileRecord(string fileName, const tileRecord& record)
+{
+    string temporary = fileName + ".tmp";
+    int across = (record.cols + tileSize - 1) / tileSize;
+    error_code error;
+    ofstream fout;
+    size_t i;
+
+    if (!openOutput(temporary, fout))
+        return false;
+
+    fout << "option\tparameter\toutput\tmodified\tsize\tcols\trows\tmaxvalue"
+        "\tcomment\ttiles\n";
+    fout << record.option << '\t' << record.parameter << '\t'
+        << record.outputFile << '\t' << record.modified << '\t' << record.size
+        << '\t' << record.cols << '\t' << record.rows << '\t'
+        << record.maxValue << '\t' << hex << record.comment << dec << '\t'
+        << record.hashes.size() << '\n';
+
+    fout << hex << setfill('0');
+    for (i = 0; i < record.hashes.size(); i++)
+        fout << setw(16) << record.hashes[i]
+            << ((i + 1) % across == 0 ? '\n' : ' ');
+    finishOutput(temporary, fout);
+
+    fs::rename(temporary, fileName, error);
+
+    return fout && !error;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Points a view at a rectangle of a plane without copying it: each row of
+ * the view is the row of the plane plus the left column.
+ *
+ * @param[in] plane - the plane, nullptr if the image does not hold it
+ * @param[out] rows - storage for the row pointers of the view
+ * @param[in] top - first row of the rectangle
+ * @param[in] left - first column of the rectangle
+ * @param[in] height - number of rows in the rectangle
+ *
+ * @returns the rows of the view, nullptr for a plane that is not held
+ *
+ * @par Example:
+   @verbatim
+   part.redgray = viewRegion(region.redgray, rows[0], 1, 1, 64);
+   @endverbatim
+ *
+ *****************************************************************************/
+template <class T>
+static T** viewRegion(T** plane, vector<T*>& rows, int top, int left,
+    int height)
+{
+    if (plane == nullptr)
+        return nullptr;
+
+    rows.resize(height);
+    for (int r = 0; r < height; r++)
+        rows[r] = plane[top + r] + left;
+
+    return rows.data();
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Copies a rectangle of a plane into a plane of its own, allocated here.
+ *
+ * @param[in] plane - the plane, nullptr if the image does not hold it
+ * @param[out] copy - the copy, nullptr for a plane that is not held
+ * @param[in] top - first row of the rectangle
+ * @param[in] left - first column of the rectangle
+ * @param[in] height - number of rows in the rectangle
+ * @param[in] width - number of columns in the rectangle
+ *
+ * @returns true if the rectangle was copied, false if memory ran out
+ *
+ * @par Example:
+   @verbatim
+   copyRegion(image.redgray, region.redgray, 63, 63, 66, 130);
+   @endverbatim
+ *
+ *****************************************************************************/
+template <class T>
+static bool copyRegion(T** plane, T**& copy, int top, int left, int height,
+    int width)
+{
+    copy = nullptr;
+    if (plane == nullptr)
+        return true;
+
+    if ((copy = allocPlane<T>(height, width)) == nullptr)
+        return false;
+    for (int r = 0; r < height; r++)
+        memcpy(copy[r], plane[top + r] + left, width * sizeof(T));
+
+    return true;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Applies an operation to one rectangle of an image and packs the result
+ * the way writeBinary writes it. The rectangle is copied with the halo the
+ * operation reads around it, as far as the image goes, so its pixels come
+ * out the same as when the whole image is processed; the halo is dropped
+ * again before packing.
+ *
+ * @param[in] picture - the input image
+ * @param[in] option - image operation choice
+ * @param[in] parameter - the text given with the option, empty if none
+ * @param[in] top - first row of the rectangle
+ * @param[in] left - first column of the rectangle
+ * @param[in] height - number of rows in the rectangle
+ * @param[in] width - number of columns in the rectangle
+ * @param[out] bytes - the packed rows of the result, without a header
+ *
+ * @returns true if the rectangle was processed, false otherwise
+ *
+ * @par Example:
+   @verbatim
+   processRegion(image, "--smooth", "", 64, 128, 64, 192, bytes);
+   @endverbatim
+ *
+ *****************************************************************************/
+static bool processRegion(image& picture, string option, string parameter,
+    int top, int left, int height, int width, string& bytes)
+{
+    int halo = haloRows(option);
+    int first = max(top - halo, 0), start = max(left - halo, 0);
+    vector<pixel*> rows[3];
+    vector<sample16*> rows16[3];
+    ostringstream packed(ios::binary);
+    image region, part;
+    bool ok;
+    size_t size;
+
+    region.magicNumber = picture.magicNumber;
+    region.rows = min(top + height + halo, picture.rows) - first;
+    region.cols = min(left + width + halo, picture.cols) - start;
+    region.maxValue = picture.maxValue;
+
+    ok = copyRegion(picture.redgray, region.redgray, first, start,
+            region.rows, region.cols) &&
+        copyRegion(picture.green, region.green, first, start, region.rows,
+            region.cols) &&
+        copyRegion(picture.blue, region.blue, first, start, region.rows,
+            region.cols) &&
+        copyRegion(picture.redgray16, region.redgray16, first, start,
+            region.rows, region.cols) &&
+        copyRegion(picture.green16, region.green16, first, start,
+            region.rows, region.cols) &&
+        copyRegion(picture.blue16, region.blue16, first, start, region.rows,
+            region.cols) &&
+        applyOperation(region, option, parameter);
+
+    if (ok)                         // the rectangle without its halo
+    {
+        part = region;
+        part.rows = height;
+        part.cols = width;
+        part.redgray = viewRegion(region.redgray, rows[0], top - first,
+            left - start, height);
+        part.green = viewRegion(region.green, rows[1], top - first,
+            left - start, height);
+        part.blue = viewRegion(region.blue, rows[2], top - first,
+            left - start, height);
+        part.redgray16 = viewRegion(region.redgray16, rows16[0], top - first,
+            left - start, height);
+        part.green16 = viewRegion(region.green16, rows16[1], top - first,
+            left - start, height);
+        part.blue16 = viewRegion(region.blue16, rows16[2], top - first,
+            left - start, height);
+
+        writeBinary(packed, part);
+        bytes = packed.str();
+        size = (size_t)width * height * (part.maxValue > 255 ? 2 : 1) *
+            (part.green == nullptr && part.green16 == nullptr ? 1 : 3);
+        ok = bytes.size() >= size;
+        if (ok)
+            bytes.erase(0, bytes.size() - size);    // drop the header
+    }
+
+    freeImage(region);
+
+    return ok;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Processes the dirty tiles of an image and writes them over their place
+ * in an existing binary output file. Each band of tiles is done on its
+ * own: the runs of dirty tiles next to each other in the band are processed
+ * as one rectangle each, in parallel, and their rows are then written with
+ * a seek and a write per row. The output must be a P5 or P6 image of the
+ * same size whose pixels take as many bytes as the processed tiles.
+ *
+ * @param[in] picture - the input image
+ * @param[in] option - image operation choice
+ * @param[in] parameter - the text given with the option, empty if none
+ * @param[in] dirty - 1 for each tile to process, in rows from the top left
+ * @param[in] outputFile - name of the output file to patch
+ *
+ * @returns true if every dirty tile was patched, false otherwise
+ *
+ * @par Example:
+   @verbatim
+   patchTiles(image, "--smooth", "", dirty, "result.ppm");
+   @endverbatim
+ *
+ *****************************************************************************/
+static bool patchTiles(image& picture, string option, string parameter,
+    const vector<char>& dirty, string outputFile)
+{
+    fstream file(outputFile, ios::in | ios::out | ios::binary);
+    int across = (picture.cols + tileSize - 1) / tileSize;
+    int down = (picture.rows + tileSize - 1) / tileSize;
+    long long start, pixelBytes;
+    image header;
+    int i, j, r;
+
+    readHeader(file, header);
+    start = (long long)file.tellg();
+    if (!file || (header.magicNumber != "P5" && header.magicNumber != "P6") ||
+        header.cols != picture.cols || header.rows != picture.rows ||
+        header.maxValue != picture.maxValue)
+        return false;
+    pixelBytes = (header.magicNumber == "P5" ? 1 : 3) *
+        (header.maxValue > 255 ? 2 : 1);
+
+    for (j = 0; j < down; j++)
+    {
+        vector<pair<int, int>> runs;    // first and end tile of each run
+        vector<string> bytes;
+        atomic<bool> ok(true);
+        int top = j * tileSize, height = min(tileSize, picture.rows - top);
+
+        for (i = 0; i < across; i++)
+        {
+            if (!dirty[(size_t)j * across + i])
+                continue;
+            if (!runs.empty() && runs.back().second == i)
+                runs.back().second = i + 1;
+            else
+                runs.push_back({ i, i + 1 });
+        }
+
+        bytes.resize(runs.size());
+        parallelFor(0, (int)runs.size(), [&](int first, int last)
+            {
+                for (int k = first; k < last; k++)
+                {
+                    int left = runs[k].first * tileSize;
+                    int width = min(runs[k].second * tileSize,
+                        picture.cols) - left;
+
+                    if (!processRegion(picture, option, parameter, top, left,
+                        height, width, bytes[k]) ||
+                        bytes[k].size() != (size_t)(pixelBytes * width *
+                            height))
+                        ok = false;
+                }
+            });
+        if (!ok)
+            return false;
+
+        for (i = 0; i < (int)runs.size(); i++)
+        {
+            int left = runs[i].first * tileSize;
+            size_t rowBytes = bytes[i].size() / height;
+
+            for (r = 0; r < height; r++)
+            {
+                file.seekp(start + ((long long)(top + r) * picture.cols +
+                    left) * pixelBytes);
+                file.write(bytes[i].data() + r * rowBytes, rowBytes);
+            }
+        }
+    }
+
+    file.close();
+
+    return bool(file);
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Processes an image incrementally for edits of an image that was already
+ * processed, such as a re-export with a few local changes. Next to the
+ * output, basename.tiles keeps a hash of every 64 pixel square tile of the
+ * input and the size and last write time the output was left with.
+ *
+ * When the record matches the operation, the size of the image and the
+ * output file, only the tiles whose hash changed are processed again, along
+ * with the tiles around them when the operation reads a halo of pixels
+ * around each one, and they are written over their place in the existing
+ * output. The work is then about the size of the edit rather than of the
+ * image; only the hashing reads the whole image. Otherwise the image is
+ * processed and written as usual. Either way a new record is written, and a
+ * count of the tiles processed is left in lastReport.
+ *
+ * Only binary, uncompressed output of an operation that works pixel by
+ * pixel or with a 3x3 filter can be patched: negate, brighten, grayscale,
+ * smooth and sharpen. Anything else, a bitmap or an image with alpha is
+ * declined and the caller processes the image as usual.
+ *
+ * @param[in,out] picture - structure for image information
+ * @param[in] option - image operation choice
+ * @param[in] parameter - the text given with the option, empty if none
+ * @param[in] outputType - type of output, ascii/binary/qoi
+ * @param[in] baseName - name of the output file without an extension
+ *
+ * @returns HANDOFF_DONE if the output and its record were brought up to
+ *          date, HANDOFF_FAILED with the reason in lastFailure if they could
+ *          not be, HANDOFF_DECLINED if the caller has to process the image
+ *
+ * @par Example:
+   @verbatim
+   if (incrementalUpdate(image, "--smooth", "", "--binary", "result") ==
+       HANDOFF_DECLINED)
+       applyOperation(image, "--smooth", "");
+
+   lastReport:
+   4 of 1960 tiles changed, 26 processed
+   @endverbatim
+ *
+ *****************************************************************************/
+handoff incrementalUpdate(image& picture, string option, string parameter,
+    string outputType, string baseName)
+{
+    string recordFile = baseName + ".tiles";
+    int halo = haloRows(option), reach = (max(halo, 0) + tileSize - 1) /
+        tileSize;
+    int across = (picture.cols + tileSize - 1) / tileSize;
+    int down = (picture.rows + tileSize - 1) / tileSize;
+    tileRecord last, next;
+    vector<char> dirty;
+    size_t changed = 0, processed = 0;
+    bool patched = false;
+    ofstream fout;
+    int i, j, x, y;
+
+    if (halo < 0 || outputType != "--binary" || picture.bits != nullptr ||
+        picture.alpha != nullptr ||
+        compressionFromName(baseName) != COMPRESS_NONE)
+        return HANDOFF_DECLINED;
+
+    next.option = option;
+    next.parameter = parameter;
+    next.cols = picture.cols;
+    next.rows = picture.rows;
+    next.maxValue = picture.maxValue;
+    next.comment = hashBytes(picture.comment.data(), picture.comment.size(),
+        0);
+    next.hashes = hashTiles(picture);
+
+    if (readTileRecord(recordFile, last) && stampOutput(last.outputFile,
+        next) && last.option == option && last.parameter == parameter &&
+        last.cols == next.cols && last.rows == next.rows &&
+        last.maxValue == next.maxValue && last.comment == next.comment &&
+        last.size == next.size && last.modified == next.modified &&
+        last.hashes.size() == next.hashes.size())
+    {
+        dirty.assign(next.hashes.size(), 0);
+        for (j = 0; j < down; j++)
+        {
+            for (i = 0; i < across; i++)
+            {
+                if (last.hashes[(size_t)j * across + i] ==
+                    next.hashes[(size_t)j * across + i])
+                    continue;
+                changed++;
+                for (y = max(j - reach, 0); y <= min(j + reach, down - 1); y++)
+                    for (x = max(i - reach, 0);
+                        x <= min(i + reach, across - 1); x++)
+                        dirty[(size_t)y * across + x] = 1;
+            }
+        }
+
+        processed = count(dirty.begin(), dirty.end(), 1);
+        next.outputFile = last.outputFile;
+        patched = patchTiles(picture, option, parameter, dirty,
+            next.outputFile);
+    }
+
+    if (!patched)                   // no output to patch, write all of it
+    {
+        if (!tunedOperation(picture, option, parameter))
+            return HANDOFF_FAILED;
+        next.outputFile = outputName(baseName, outputType, picture);
+        if (!openOutput(next.outputFile, fout))
+            return HANDOFF_FAILED;
+        writeImage(fout, picture, outputType);
+        if (!finishOutput(next.outputFile, fout))
+            return HANDOFF_FAILED;
+    }
+
+    if (!stampOutput(next.outputFile, next) ||
+        !writeTileRecord(recordFile, next))
+    {
+        lastFailure = "Unable to write the tile record " + recordFile;
+        return HANDOFF_FAILED;
+    }
+
+    if (patched)
+        lastReport = to_string(changed) + " of " +
+            to_string(next.hashes.size()) + " tiles changed, " +
+            to_string(processed) + " processed\n";
+    else
+        lastReport = "No earlier output to patch, all " +
+            to_string(next.hashes.size()) + " tiles processed\n";
+
+    return HANDOFF_DONE;
+}
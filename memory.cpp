@@ -1,119 +1,307 @@
-/** ***************************************************************************
- * @file memory.cpp
- *
- * @brief demonstrates allocating and deallocating a 2D array
- *****************************************************************************/
-
-#include "netPBM.h"
-
- /** ***************************************************************************
-  * @author Barney Rubble
-  *
-  * @par Description:
-  * The function first checks if the pointer is nullptr. If ptr is nullptr it
-  * means that no memory was allocated, so the function simply returns without
-  * doing anything. If ptr is not nullptr, the function enters a loop that 
-  * iterates through each row of the 2D array. For each row, it calls delete[]
-  * to deallocate the memory allocated for that row. After deallocating the 
-  * memory for each row, the function calls 'delete[]' again to deallocate the
-  * memory occupied by the array of pointers ('ptr'). After the function 
-  * execution, the ptr is now dangling, meaning it points to a location in 
-  * memory that has been deallocated.
-  *
-  * @param[in] ptr - reference to a pointer of 'pixel' type
-  * @param[in] rows - the number of rows in the 2D array
-  * 
-  * @par Example:
-   @verbatim
-   free2d(ptr, 4);
-   @endverbatim
-  * 
-  ******************************************************************************/
-void free2d(pixel**& ptr, int rows)
-{
-    int i;
-    if (ptr == nullptr)
-        return;
-
-    for (i = 0; i < rows; i++)  // loop to step through ptr
-        delete[] ptr[i];        // free ptr[i]
-
-    delete[] ptr;
-}
-
-
-/** ***************************************************************************
- * @author Heidi Anderson
- *
- * @par Description
- * This function dynamically allocates memory for a 2D array of pixels. It
- * first allocates memory for an array of pointers to 'pixel', and then, for
- * each row, it allocates memory for an array of 'pixel' type. If any memory
- * allocation fails during this process, it frees the previously allocated 
- * memory and returns false.
- *
- * @param[in] row - the number of rows in the 2D array
- * @param[in] cols - the number of columns in the 2D array
- *
- * @returns true to indicate successful memory allocation
- * 
- * @par Example:
-   @verbatim
-   alloc2d(2, 3);
-   @endverbatim
- *
- * *****************************************************************************/
-pixel** alloc2d(int row, int cols)
-{
-    int i;
-    pixel** ptr = nullptr;
-
-    ptr = new (nothrow) pixel * [row];
-
-    if (ptr == nullptr)
-    {
-        return nullptr;
-    }
-
-    for (i = 0; i < row; i++)
-    {
-        ptr[i] = new (nothrow) pixel[cols]; // allocation step
-        if (ptr[i] == nullptr)              // free if necessary
-        {
-            free2d(ptr, row);
-            return nullptr;
-        }
-    }
-    return ptr;
-}
-
-
-/** ***************************************************************************
- * @author Heidi Anderson
- *
- * @par Description:
- * Copies the values from one array into another
- *
- * @param[in] source - pointer to the source 2D array
- * @param[out] dest - pointer to the destination 2D array
- * @param[in] rows - rows in the array
- * @param[in] cols - columns in the array
- * 
- * @par Example:
-   @verbatim
-   copy2d(source, dest, 12, 14);
-   @endverbatim
- *
- *****************************************************************************/
-void copy2d(pixel**& source, pixel**& dest, int rows, int cols)
-{
-    int r, c;
-
-    for (r = 0; r < rows; ++r)
-    {
-        for (c = 0; c < cols; ++c)
-        {
-            dest[r][c] = source[r][c];  // copy source to destination
-        }
-    }
+/** ***************************************************************************
+ * @file memory.cpp
+ *
+ * @brief demonstrates allocating and deallocating a 2D array
+ *****************************************************************************/
+
+#include "netPBM.h"
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description
+ * Frees every row of a 2D array of samples of type T and then the array of
+ * row pointers. A nullptr array is skipped.
+ *
+ * @param[in] ptr - reference to the 2D array
+ * @param[in] rows - the number of rows in the 2D array
+ *
+ * @par Example:
+   @verbatim
+   freePlane(plane, rows);
+   @endverbatim
+ *
+ * *****************************************************************************/
+template <class T>
+static void freePlane(T**& ptr, int rows)
+{
+    int i;
+    if (ptr == nullptr)
+        return;
+
+    for (i = 0; i < rows; i++)  // loop to step through ptr
+        delete[] ptr[i];        // free ptr[i]
+
+    delete[] ptr;
+}
+
+
+ /** ***************************************************************************
+  * @author Barney Rubble
+  *
+  * @par Description:
+  * The function first checks if the pointer is nullptr. If ptr is nullptr it
+  * means that no memory was allocated, so the function simply returns without
+  * doing anything. If ptr is not nullptr, the function enters a loop that 
+  * iterates through each row of the 2D array. For each row, it calls delete[]
+  * to deallocate the memory allocated for that row. After deallocating the 
+  * memory for each row, the function calls 'delete[]' again to deallocate the
+  * memory occupied by the array of pointers ('ptr'). After the function 
+  * execution, the ptr is now dangling, meaning it points to a location in 
+  * memory that has been deallocated.
+  *
+  * @param[in] ptr - reference to a pointer of 'pixel' type
+  * @param[in] rows - the number of rows in the 2D array
+  * 
+  * @par Example:
+   @verbatim
+   free2d(ptr, 4);
+   @endverbatim
+  * 
+  ******************************************************************************/
+void free2d(pixel**& ptr, int rows)
+{
+    freePlane(ptr, rows);
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description
+ * Allocates a 2D array of samples of type T, one array of T per row. The
+ * row pointers start out nullptr, so if any row cannot be allocated the
+ * rows already allocated are freed and nullptr is returned. It is built
+ * for pixel and sample16 here, for 8 and 16 bit planes.
+ *
+ * @param[in] rows - the number of rows in the 2D array
+ * @param[in] cols - the number of columns in the 2D array
+ *
+ * @returns the 2D array, or nullptr if memory ran out
+ *
+ * @par Example:
+   @verbatim
+   image.redgray16 = allocPlane<sample16>(image.rows, image.cols);
+   @endverbatim
+ *
+ * *****************************************************************************/
+template <class T>
+T** allocPlane(int rows, int cols)
+{
+    int i;
+    T** ptr = new (nothrow) T * [rows]();
+
+    if (ptr == nullptr)
+    {
+        return nullptr;
+    }
+
+    for (i = 0; i < rows; i++)
+    {
+        ptr[i] = new (nothrow) T[cols];     // allocation step
+        if (ptr[i] == nullptr)              // free if necessary
+        {
+            freePlane(ptr, rows);
+            return nullptr;
+        }
+    }
+    return ptr;
+}
+
+template pixel** allocPlane<pixel>(int rows, int cols);
+template sample16** allocPlane<sample16>(int rows, int cols);
+
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description
+ * Frees a 2D array of 16 bit samples made by allocPlane, the same way free2d
+ * frees a 2D array of pixels.
+ *
+ * @param[in] ptr - reference to a pointer of 'sample16' type
+ * @param[in] rows - the number of rows in the 2D array
+ *
+ * @par Example:
+   @verbatim
+   free2d(image.redgray16, image.rows);
+   @endverbatim
+ *
+ * *****************************************************************************/
+void free2d(sample16**& ptr, int rows)
+{
+    freePlane(ptr, rows);
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description
+ * Frees all of the color planes of an image, 8 or 16 bit, or its bitmap,
+ * and resets the pointers to nullptr so the image can be reused for the next
+ * read. Planes that were already released, such as green and blue after
+ * grayscale, are skipped.
+ *
+ * @param[in,out] picture - image structure
+ *
+ * @par Example:
+   @verbatim
+   freeImage(image);
+   @endverbatim
+ *
+ *****************************************************************************/
+void freeImage(image& picture)
+{
+    free2d(picture.redgray, picture.rows);
+    free2d(picture.green, picture.rows);
+    free2d(picture.blue, picture.rows);
+    free2d(picture.redgray16, picture.rows);
+    free2d(picture.green16, picture.rows);
+    free2d(picture.blue16, picture.rows);
+    freeBits(picture.bits, picture.rows);
+    free2d(picture.alpha, picture.rows);
+
+    picture.redgray = nullptr;
+    picture.green = nullptr;
+    picture.blue = nullptr;
+    picture.redgray16 = nullptr;
+    picture.green16 = nullptr;
+    picture.blue16 = nullptr;
+    picture.alpha = nullptr;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description
+ * Allocates the rows of a bitmap with one bit per pixel. Each row is an
+ * array of 64 bit words and every word starts out 0, which is white. If an
+ * allocation fails the rows already allocated are freed.
+ *
+ * @param[in] rows - the number of rows in the bitmap
+ * @param[in] cols - the number of pixels in each row
+ *
+ * @returns the rows of the bitmap, or nullptr if memory ran out
+ *
+ * @par Example:
+   @verbatim
+   image.bits = allocBits(image.rows, image.cols);
+   @endverbatim
+ *
+ * *****************************************************************************/
+unsigned long long** allocBits(int rows, int cols)
+{
+    int i, words = (cols + 63) / 64;
+    unsigned long long** bits = new (nothrow) unsigned long long* [rows];
+
+    if (bits == nullptr)
+    {
+        return nullptr;
+    }
+
+    for (i = 0; i < rows; i++)
+    {
+        bits[i] = new (nothrow) unsigned long long[words]();
+        if (bits[i] == nullptr)
+        {
+            while (i > 0)
+                delete[] bits[--i];
+            delete[] bits;
+            return nullptr;
+        }
+    }
+    return bits;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description
+ * Frees the rows of a bitmap made by allocBits and sets the pointer to
+ * nullptr. A nullptr bitmap is skipped.
+ *
+ * @param[in,out] bits - the rows of the bitmap
+ * @param[in] rows - the number of rows in the bitmap
+ *
+ * @par Example:
+   @verbatim
+   freeBits(image.bits, image.rows);
+   @endverbatim
+ *
+ * *****************************************************************************/
+void freeBits(unsigned long long**& bits, int rows)
+{
+    int i;
+
+    if (bits == nullptr)
+        return;
+
+    for (i = 0; i < rows; i++)
+        delete[] bits[i];
+
+    delete[] bits;
+    bits = nullptr;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description
+ * This function dynamically allocates memory for a 2D array of pixels. It
+ * first allocates memory for an array of pointers to 'pixel', and then, for
+ * each row, it allocates memory for an array of 'pixel' type. If any memory
+ * allocation fails during this process, it frees the previously allocated 
+ * memory and returns false.
+ *
+ * @param[in] row - the number of rows in the 2D array
+ * @param[in] cols - the number of columns in the 2D array
+ *
+ * @returns true to indicate successful memory allocation
+ * 
+ * @par Example:
+   @verbatim
+   alloc2d(2, 3);
+   @endverbatim
+ *
+ * *****************************************************************************/
+pixel** alloc2d(int row, int cols)
+{
+    return allocPlane<pixel>(row, cols);
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Copies the values from one array into another
+ *
+ * @param[in] source - pointer to the source 2D array
+ * @param[out] dest - pointer to the destination 2D array
+ * @param[in] rows - rows in the array
+ * @param[in] cols - columns in the array
+ * 
+ * @par Example:
+   @verbatim
+   copy2d(source, dest, 12, 14);
+   @endverbatim
+ *
+ *****************************************************************************/
+void copy2d(pixel**& source, pixel**& dest, int rows, int cols)
+{
+    int r, c;
+
+    for (r = 0; r < rows; ++r)
+    {
+        for (c = 0; c < cols; ++c)
+        {
+            dest[r][c] = source[r][c];  // copy source to destination
+        }
+    }
 }
\ No newline at end of file
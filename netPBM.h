@@ -1,67 +1,404 @@
-/** ***************************************************************************
- * @file
- *
- * @brief header file for take home programming exam 1
- *****************************************************************************/
-
-#pragma once
-#include <fstream>
-#include <iostream>
-#include <string>
-#include <sstream>
-#include <cmath>
-#include <algorithm>
-
-using namespace std;
-
-/******************************************************************************
- *                              Typdef
- *****************************************************************************/
-/**
- * @brief represents a pixel of an image
- */
-typedef unsigned char pixel;
-
-
-/******************************************************************************
- *                              Struct
- *****************************************************************************/
-/**
- * @brief Holds data about the image
- */
-struct image
-{
-    string magicNumber;     /**< Magic number to indicate image type */
-    string comment;         /**< Comments in top of image file */
-    int rows;               /**< Number of rows in the image */
-    int cols;               /**< Number of columns in the image */
-    pixel** redgray;        /**< 2D array for red/gray color values */
-    pixel** green;          /**< 2D array for green color values */
-    pixel** blue;           /**< 2D array for blue color values */
-};
-
-
-/******************************************************************************
- *                         Function Prototypes
- *****************************************************************************/
-pixel** alloc2d(int row, int cols);
-void asciiOrBinary(ifstream& fin, image& image);
-void brighten(image& image, int value);
-void contrast(image& picture);
-void copy2d(pixel**& source, pixel**& dest, int rows, int cols);
-int crop(int num);
-int errorCheck(int& argc, char**& argv);
-void free2d(pixel**& ptr, int r);
-void grayscale(image& picture);
-void negateImage(image& picture);
-bool openInput(string fileName, ifstream& fin);
-bool openOutput(string fileName, ofstream& fout);
-void output(char* fileName, string outputFile, ofstream& fout, image& image, string option);
-void readAscii(ifstream& fin, image& image);
-void readBinary(ifstream& fin, image& image);
-void readHeader(ifstream& fin, image& image);
-bool sharpen(image& picture);
-bool smooth(image& picture);
-int usageStatement();
-void writeAscii(ofstream& fout, image& image, string option);
-void writeBinary(ofstream& fout, image& image, string option);
+/** ***************************************************************************
+ * @file
+ *
+ * @brief header file for take home programming exam 1
+ *****************************************************************************/
+
+#pragma once
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <sstream>
+#include <cmath>
+#include <algorithm>
+#include <cstring>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+using namespace std;
+
+/******************************************************************************
+ *                              Typdef
+ *****************************************************************************/
+/**
+ * @brief represents a pixel of an image
+ */
+typedef unsigned char pixel;
+
+/**
+ * @brief represents a 16 bit sample of an image whose max value is over 255
+ */
+typedef unsigned short sample16;
+
+/**
+ * @brief a row kernel that filters columns [first, last) of row into out
+ *        using the rows above and below it
+ */
+typedef void (*rowStencil)(const pixel* above, const pixel* row,
+    const pixel* below, pixel* out, int first, int last);
+
+
+/******************************************************************************
+ *                              Enum
+ *****************************************************************************/
+/**
+ * @brief instruction set levels the row kernels are built for
+ */
+enum isaLevel
+{
+    ISA_SCALAR,             /**< plain C++, the reference version */
+    ISA_SSE42,              /**< SSE4.2 and SSSE3, 16 pixels at a time */
+    ISA_AVX2,               /**< AVX2, 32 pixels at a time */
+    ISA_AVX512              /**< AVX-512 F and BW, 64 pixels at a time */
+};
+
+/**
+ * @brief compression of an image file
+ */
+enum compression
+{
+    COMPRESS_NONE,          /**< a plain image file */
+    COMPRESS_GZIP,          /**< gzip, .gz */
+    COMPRESS_ZSTD           /**< zstd, .zst */
+};
+
+/**
+ * @brief what became of an image handed to shardImage or incrementalUpdate,
+ *        which only take the images they can work on
+ */
+enum handoff
+{
+    HANDOFF_DECLINED,       /**< not taken, the caller processes the image */
+    HANDOFF_DONE,           /**< processed and written */
+    HANDOFF_FAILED          /**< taken but not written, see lastFailure */
+};
+
+
+/******************************************************************************
+ *                              Struct
+ *****************************************************************************/
+/**
+ * @brief Holds data about the image
+ */
+struct image
+{
+    string magicNumber;         /**< Magic number to indicate image type */
+    string comment;             /**< Comments in top of image file */
+    int rows = 0;               /**< Number of rows in the image */
+    int cols = 0;               /**< Number of columns in the image */
+    pixel** redgray = nullptr;  /**< 2D array for red/gray color values */
+    pixel** green = nullptr;    /**< 2D array for green color values */
+    pixel** blue = nullptr;     /**< 2D array for blue color values */
+    int maxValue = 255;         /**< Largest sample value, over 255 when the
+                                     samples are 16 bit */
+    sample16** redgray16 = nullptr; /**< 16 bit red/gray color values */
+    sample16** green16 = nullptr;   /**< 16 bit green color values */
+    sample16** blue16 = nullptr;    /**< 16 bit blue color values */
+    unsigned long long** bits = nullptr;    /**< P1/P4 rows, 64 pixels a
+                                                 word, first pixel in the high
+                                                 bit, 1 is black */
+    pixel** alpha = nullptr;    /**< 2D array for alpha values, 0 is
+                                     transparent, nullptr when opaque */
+    int depth = 0;              /**< Samples per pixel of a P7 PAM image */
+};
+
+/**
+ * @brief The row kernels for one instruction set level. Each one works on a
+ *        single row so the operations can keep their own loops over rows.
+ */
+struct kernelTable
+{
+    isaLevel level;         /**< Instruction set the kernels were built for */
+    void (*addRow)(pixel* row, int cols, int value);    /**< clamped add */
+    void (*negateRow)(pixel* row, int cols);            /**< 255 - pixel */
+    rowStencil smoothRow;   /**< 3x3 mean */
+    rowStencil sharpenRow;  /**< 5 point sharpen */
+    void (*interleaveRow)(const pixel* red, const pixel* green,
+        const pixel* blue, pixel* packed, int cols);    /**< planes to RGB */
+    void (*deinterleaveRow)(const pixel* packed, pixel* red, pixel* green,
+        pixel* blue, int cols);                         /**< RGB to planes */
+    void (*diffRow)(const pixel* first, const pixel* second, pixel* diff,
+        int cols, unsigned long long& sumSquares, int& maxDiff); /**< |a-b| */
+    void (*medianRow)(const pixel* const* window, pixel* out, int radius,
+        int first, int last);                   /**< 3x3 and 5x5 median */
+    void (*minRow)(const pixel* first, const pixel* second, pixel* out,
+        int cols);                              /**< smaller pixel */
+    void (*maxRow)(const pixel* first, const pixel* second, pixel* out,
+        int cols);                              /**< larger pixel */
+    void (*lumaRow)(const pixel* red, const pixel* green, const pixel* blue,
+        short* gray, int cols);                 /**< planes to 16 bit luma */
+    void (*gradientRow)(const short* above, const short* row,
+        const short* below, pixel* out, int cols, int side, int center,
+        int shift, bool l2);                    /**< Sobel/Scharr magnitude */
+    void (*swapRow)(const sample16* in, sample16* out,
+        int count);                             /**< swap the sample bytes */
+    void (*addRow16)(sample16* row, int cols, int value,
+        int maxValue);                          /**< clamped 16 bit add */
+    void (*negateRow16)(sample16* row, int cols,
+        int maxValue);                          /**< maxValue - sample */
+    void (*smoothRow16)(const sample16* above, const sample16* row,
+        const sample16* below, sample16* out, int first,
+        int last);                              /**< 16 bit 3x3 mean */
+    void (*sharpenRow16)(const sample16* above, const sample16* row,
+        const sample16* below, sample16* out, int first, int last,
+        int maxValue);                          /**< 16 bit sharpen */
+    void (*overRow)(const pixel* over, const pixel* alpha, pixel* base,
+        int cols);                              /**< alpha blend onto base */
+    void (*halveRow)(const pixel* above, const pixel* below, pixel* out,
+        int cols);                              /**< 2x2 mean, half width */
+};
+
+
+/**
+ * @brief Summed-area table of one color plane, built by buildSummedArea.
+ *        Entry [r][c] is at r * (cols + 1) + c and holds the sum of the
+ *        pixels in rows [0, r) and columns [0, c).
+ */
+struct summedArea
+{
+    int rows = 0;           /**< Number of rows in the plane */
+    int cols = 0;           /**< Number of columns in the plane */
+    unsigned long long* sums = nullptr;     /**< Sums of the pixels */
+    unsigned long long* squares = nullptr;  /**< Sums of the squared pixels */
+};
+
+/**
+ * @brief What the header of an image file says, as listed by catalogImages
+ */
+struct imageInfo
+{
+    string path;            /**< Path of the file as it was found */
+    long long modified = 0; /**< Last write time in seconds since 1970 */
+    long long size = 0;     /**< Size of the file in bytes */
+    string magicNumber;     /**< Magic number, "qoif" for QOI */
+    int cols = 0;           /**< Number of columns in the image */
+    int rows = 0;           /**< Number of rows in the image */
+    int maxValue = 0;       /**< Largest sample value, 1 for a bitmap */
+    string comment;         /**< Comment lines of the header */
+};
+
+/**
+ * @brief How far apart two images are, as found by measureDifference
+ */
+struct imageDifference
+{
+    int maxDiff = 0;        /**< Largest absolute difference of one sample */
+    double mse = 0;         /**< Mean squared error over all samples */
+    double psnr = 0;        /**< Peak signal to noise ratio in dB */
+    double ssim = 1;        /**< Mean structural similarity of the luma */
+};
+
+
+/******************************************************************************
+ *                              Class
+ *****************************************************************************/
+/**
+ * @brief The error thrown by the in-memory image functions, such as
+ *        decodeImage and processImage, in place of printing a message and
+ *        ending the program. what() describes the problem.
+ */
+class imageError : public runtime_error
+{
+public:
+    /**
+     * @brief creates the error with a description of the problem
+     * @param[in] message - the description returned by what()
+     */
+    explicit imageError(const string& message) : runtime_error(message) {}
+};
+
+/**
+ * @brief A first in first out queue with a fixed capacity that is shared by
+ *        two pipeline stages. push blocks while the queue is full and pop
+ *        blocks while it is empty, so a fast stage can only run a few images
+ *        ahead of a slow one.
+ */
+template <class T>
+class boundedQueue
+{
+public:
+    /**
+     * @brief creates an empty queue holding at most capacity items
+     * @param[in] capacity - the most items the queue will hold
+     */
+    explicit boundedQueue(size_t capacity) : limit(capacity) {}
+
+    /**
+     * @brief adds an item, waiting while the queue is full
+     * @param[in] item - the item to add
+     */
+    void push(T item)
+    {
+        unique_lock<mutex> lock(guard);
+        notFull.wait(lock, [this] { return items.size() < limit; });
+        items.push_back(item);
+        notEmpty.notify_one();
+    }
+
+    /**
+     * @brief removes the oldest item, waiting while the queue is empty
+     * @returns the oldest item in the queue
+     */
+    T pop()
+    {
+        unique_lock<mutex> lock(guard);
+        notEmpty.wait(lock, [this] { return !items.empty(); });
+        T item = items.front();
+        items.pop_front();
+        notFull.notify_one();
+        return item;
+    }
+
+private:
+    deque<T> items;                 /**< items waiting for the next stage */
+    size_t limit;                   /**< the most items the queue holds */
+    mutex guard;                    /**< protects items */
+    condition_variable notFull;     /**< signaled when an item is removed */
+    condition_variable notEmpty;    /**< signaled when an item is added */
+};
+
+/**
+ * @brief A connection between the coordinator and a shard worker, or
+ *        between two neighboring workers. Sockets are used on one machine,
+ *        and another transport can carry the same bytes to workers on
+ *        other machines.
+ */
+class shardTransport
+{
+public:
+    /**
+     * @brief closes the connection
+     */
+    virtual ~shardTransport() {}
+
+    /**
+     * @brief sends all of the bytes
+     * @param[in] data - the bytes to send
+     * @param[in] size - number of bytes to send
+     * @returns true if every byte was sent, false if the connection failed
+     */
+    virtual bool send(const void* data, size_t size) = 0;
+
+    /**
+     * @brief receives exactly size bytes
+     * @param[out] data - where the bytes are stored
+     * @param[in] size - number of bytes to receive
+     * @returns true if every byte arrived, false if the connection failed
+     */
+    virtual bool receive(void* data, size_t size) = 0;
+};
+
+
+/******************************************************************************
+ *                              Globals
+ *****************************************************************************/
+extern kernelTable kernels;     /**< kernels picked for this processor */
+extern thread_local string lastFailure; /**< why a call on this thread failed */
+extern thread_local string lastReport;  /**< what an operation reported */
+
+
+/******************************************************************************
+ *                         Function Prototypes
+ *****************************************************************************/
+pixel** alloc2d(int row, int cols);
+unsigned long long** allocBits(int rows, int cols);
+template <class T> T** allocPlane(int rows, int cols);
+bool applyOperation(image& picture, string option, string parameter);
+void asciiOrBinary(istream& fin, image& image);
+bool attachCompressor(string fileName, ofstream& fout);
+bool attachDecompressor(string fileName, ifstream& fin);
+bool bilateral(image& picture, string settings);
+bool bitmapOperation(image& picture, string option, string parameter, bool& ok);
+void borderBits(image& picture, int top, int left, int bottom, int right);
+bool boxFilter(image& picture, int radius, bool deviation);
+void brighten(image& image, int value);
+bool buildSummedArea(pixel** plane, int rows, int cols, bool squares, summedArea& table);
+int catalogImages(vector<string> paths, string indexFile, ostream& listing);
+void clahe(image& picture, int clipLimit);
+void clearBorder(pixel** plane, int rows, int cols, int top, int left, int bottom, int right);
+int compareImages(string firstFile, string secondFile, string diffBase);
+compression compressionFromName(string fileName);
+void contrast(image& picture);
+void copy2d(pixel**& source, pixel**& dest, int rows, int cols);
+size_t countAsciiSamples(const char* begin, const char* end);
+int crop(int num);
+bool cropBits(image& picture, int top, int left, int width, int height);
+bool cropImage(image& picture, string region);
+void decodeImage(const char* data, size_t size, image& picture);
+isaLevel detectIsa();
+bool edges(image& picture, string settings);
+string encodeImage(image& picture, string outputType);
+void equalize(image& picture);
+int errorCheck(int& argc, char**& argv);
+bool expandBitmap(image& picture);
+bool filterPlane(pixel**& plane, int rows, int cols, rowStencil filter);
+bool finishOutput(string fileName, ofstream& fout);
+void free2d(sample16**& ptr, int rows);
+void free2d(pixel**& ptr, int r);
+void freeBits(unsigned long long**& bits, int rows);
+void freeImage(image& picture);
+void freeSummedArea(summedArea& table);
+int globalOptions(int& argc, char**& argv, int& shards, bool& incremental);
+void grayscale(image& picture);
+int haloRows(string option);
+handoff incrementalUpdate(image& picture, string option, string parameter, string outputType, string baseName);
+bool isaFromName(string name, isaLevel& level);
+kernelTable kernelsFor(isaLevel level);
+bool maskBits(image& picture, string option, string maskFile);
+bool measureDifference(image& first, image& second, imageDifference& result, image* diff);
+bool median(image& picture, int radius);
+bool medianPlane(pixel**& plane, int rows, int cols, int radius);
+bool morphBits(image& picture, int width, int height, bool dilate);
+bool morphology(image& picture, string option, string size);
+bool morphPlane(pixel**& plane, int rows, int cols, int width, int height, bool dilate);
+bool narrowImage(image& picture);
+void negateImage(image& picture);
+bool openInput(string fileName, ifstream& fin);
+bool openOutput(string fileName, ofstream& fout);
+bool output(char* fileName, string outputFile, ofstream& fout, image& image);
+string outputName(string baseName, string outputType, image& image);
+bool overlayImage(image& picture, string overlay);
+void parallelFor(int first, int last, const function<void(int, int)>& body);
+size_t parseAsciiSamples(const char* begin, const char* end, sample16* samples, size_t count, int maxValue, bool& valid);
+void printFailure(string otherwise);
+string processImage(image& picture, string option, string parameter);
+void readAscii(istream& fin, image& image);
+void readBinary(istream& fin, image& image);
+void readBinary16(istream& fin, image& image);
+void readBitmap(istream& fin, image& image);
+void readHeader(istream& fin, image& image);
+bool readImage(istream& fin, image& image);
+bool readImageInfo(string fileName, imageInfo& info);
+void readPam(istream& fin, image& image);
+void readQoi(istream& fin, image& image);
+bool regionStatistics(image& picture, string regions);
+long long regionStats(const summedArea& table, int top, int left, int bottom, int right, double& mean, double& variance);
+bool runShardWorker(shardTransport& coordinator, shardTransport* above, shardTransport* below);
+int setBandRows(int rows);
+int setThreadCount(int threads);
+handoff shardImage(image& picture, string option, string parameter, string outputType, string baseName, int workers);
+bool sharpen(image& picture);
+bool smooth(image& picture);
+int streamImages(string option, string parameter, string outputType, istream& in, ostream& out);
+bool structuralSimilarity(image& first, image& second, double& ssim);
+int threadCount();
+string transformImage(const char* data, size_t size, string option, string parameter, string outputType);
+bool tunedOperation(image& picture, string option, string parameter);
+int tuneOperations();
+bool unsharp(image& picture, string settings);
+bool unsharpPlane(pixel**& plane, int rows, int cols, int radius, int amount, int threshold);
+int usageStatement();
+bool useProfile(string option, bool keepIsa);
+void writeAscii(ostream& fout, image& image);
+void writeBinary(ostream& fout, image& image);
+void writeBinary16(ostream& fout, image& image);
+void writeBitmap(ostream& fout, image& image, string outputType);
+void writeHeader(ostream& fout, image& image, string magicNumber);
+void writeImage(ostream& fout, image& image, string outputType);
+void writePam(ostream& fout, image& image);
+bool writePyramid(image& picture, int tileSize, string outputType, string baseName);
+void writeQoi(ostream& fout, image& image);
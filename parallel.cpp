@@ -0,0 +1,188 @@
+/** ***************************************************************************
+ * @file
+ *
+ * @brief splits loops across the hardware threads of the machine.
+ *****************************************************************************/
+
+#include "netPBM.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+
+/******************************************************************************
+ *                              Globals
+ *****************************************************************************/
+static thread_local int threadLimit = 0;  /**< threads from setThreadCount,
+                                               0 for all */
+static thread_local int bandItems = 0;    /**< piece size from setBandRows, 0
+                                               for one piece per thread */
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Runs body over the range [first, last) split into one contiguous piece per
+ * thread. The calling thread works on the first piece while new threads work
+ * on the others, and the function returns after every piece is done. Ranges
+ * shorter than the thread count use one thread per item.
+ *
+ * When setBandRows has set a band size, the range is cut into bands of that
+ * many items instead, and each thread takes the next band as soon as it is
+ * done with one, so a band of rows stays in the cache while it is worked
+ * on and a slow band does not hold up the others.
+ *
+ * Both settings belong to the thread that calls parallelFor, and the
+ * threads it starts take them over, so a parallelFor inside the body
+ * follows them too.
+ *
+ * @param[in] first - first index of the range
+ * @param[in] last - one past the last index of the range
+ * @param[in] body - function called with the bounds of each piece
+ *
+ * @par Example:
+   @verbatim
+   parallelFor(0, image.rows, [&](int rowStart, int rowEnd) { ... });
+   @endverbatim
+ *
+ *****************************************************************************/
+void parallelFor(int first, int last, const function<void(int, int)>& body)
+{
+    vector<thread> workers;
+    int count = last - first;
+    int pieces = min(threadCount(), count);
+    int limit = threadLimit, band = bandItems, i;
+    auto inherit = [limit, band]()
+        {
+            threadLimit = limit;
+            bandItems = band;
+        };
+
+    if (bandItems > 0 && count > bandItems)     // bands taken in turn
+    {
+        atomic<int> next(first);
+        auto takeBands = [&]()
+            {
+                int start;
+                while ((start = next.fetch_add(bandItems)) < last)
+                    body(start, min(start + bandItems, last));
+            };
+
+        pieces = min(threadCount(), (count + bandItems - 1) / bandItems);
+        for (i = 1; i < pieces; i++)
+            workers.emplace_back([&inherit, &takeBands]
+                {
+                    inherit();
+                    takeBands();
+                });
+        takeBands();
+
+        for (thread& worker : workers)
+            worker.join();
+        return;
+    }
+
+    if (pieces <= 1)    // nothing to split
+    {
+        if (count > 0)
+            body(first, last);
+        return;
+    }
+
+    for (i = 1; i < pieces; i++)
+    {
+        int start = first + (int)((long long)count * i / pieces);
+        int end = first + (int)((long long)count * (i + 1) / pieces);
+
+        workers.emplace_back([&inherit, &body, start, end]
+            {
+                inherit();
+                body(start, end);
+            });
+    }
+
+    body(first, first + count / pieces);
+
+    for (thread& worker : workers)
+        worker.join();
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Returns the number of threads parallelFor splits work across, the number
+ * set by setThreadCount or else one per hardware thread.
+ *
+ * @returns the number of threads
+ *
+ * @par Example:
+   @verbatim
+   int pieces = threadCount();
+   @endverbatim
+ *
+ *****************************************************************************/
+int threadCount()
+{
+    if (threadLimit > 0)
+        return threadLimit;
+
+    return max((int)thread::hardware_concurrency(), 1);
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Sets the number of threads parallelFor splits work across when it is
+ * called from this thread, such as the count a tuning profile picked. 0
+ * goes back to one per hardware thread.
+ *
+ * @param[in] threads - the number of threads, 0 for all of them
+ *
+ * @returns the number that was set before, to put it back with
+ *
+ * @par Example:
+   @verbatim
+   int before = setThreadCount(4);
+   @endverbatim
+ *
+ *****************************************************************************/
+int setThreadCount(int threads)
+{
+    int before = threadLimit;
+
+    threadLimit = max(threads, 0);
+
+    return before;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Sets how many items, usually rows, parallelFor hands a thread at a time
+ * when it is called from this thread. 0 goes back to one contiguous piece
+ * per thread.
+ *
+ * @param[in] rows - the band size, 0 for one piece per thread
+ *
+ * @returns the band size that was set before, to put it back with
+ *
+ * @par Example:
+   @verbatim
+   int before = setBandRows(64);
+   @endverbatim
+ *
+ *****************************************************************************/
+int setBandRows(int rows)
+{
+    int before = bandItems;
+
+    bandItems = max(rows, 0);
+
+    return before;
+}
@@ -0,0 +1,113 @@
+/** ***************************************************************************
+ * @file
+ *
+ * @brief processes a stream of concatenated images from one stream to
+ *        another with separate reader, worker and writer threads.
+ *****************************************************************************/
+
+#include "netPBM.h"
+#include <thread>
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Reads a sequence of images from an input stream, applies the operation to
+ * each one and writes the results to an output stream. The work is split into three stages
+ * joined by bounded queues: a reader thread parses image N + 1 while a
+ * worker thread processes image N and the calling thread writes image N - 1.
+ * A nullptr is passed down the queues to mark the end of the stream. Each
+ * queue holds two images, which bounds the memory in use to a handful of
+ * images no matter how long the stream is. An image the operation fails on
+ * is left out of the output. An image that can't be read ends the stream.
+ * What the operation reports for each image is collected in lastReport,
+ * and why images failed in lastFailure, one line each.
+ *
+ * @param[in] option - image operation choice
+ * @param[in] parameter - the text given with the option, empty if none
+ * @param[in] outputType - type of output, ascii/binary/qoi
+ * @param[in,out] in - the stream the images are read from
+ * @param[in,out] out - the stream the results are written to
+ *
+ * @returns 0 after the whole stream has been written, 1 if an image could
+ *          not be read, an operation failed or writing failed
+ *
+ * @par Example:
+   @verbatim
+   streamImages("--negate", "", "--binary", cin, cout);
+   @endverbatim
+ *
+ *****************************************************************************/
+int streamImages(string option, string parameter, string outputType,
+    istream& in, ostream& out)
+{
+    boundedQueue<image*> readQueue(2);
+    boundedQueue<image*> writeQueue(2);
+    image* picture;
+    string reports, failures, unreadable;
+
+    in.tie(nullptr);    // the reader must not flush out under the writer
+
+    thread reader([&readQueue, &unreadable, &in]
+        {
+            image* next = new image;
+
+            while (readImage(in, *next))    // parse until end of stream
+            {
+                readQueue.push(next);
+                next = new image;
+            }
+            if (lastFailure != "" || in.bad())     // not the end of stream
+                unreadable = lastFailure != "" ? lastFailure :
+                    "Unable to read the image stream";
+
+            delete next;
+            readQueue.push(nullptr);
+        });
+
+    thread worker([&readQueue, &writeQueue, &reports, &failures, option,
+        parameter]
+        {
+            image* next;
+
+            while ((next = readQueue.pop()) != nullptr)
+            {
+                lastReport = "";
+                if (tunedOperation(*next, option, parameter))
+                {
+                    reports += lastReport;  // such as --stats numbers
+                    writeQueue.push(next);
+                }
+                else
+                {
+                    if (failures != "")
+                        failures += '\n';
+                    failures += lastFailure != "" ? lastFailure :
+                        "Unable to apply " + option;
+                    freeImage(*next);
+                    delete next;
+                }
+            }
+
+            writeQueue.push(nullptr);
+        });
+
+    while ((picture = writeQueue.pop()) != nullptr)    // write in order
+    {
+        writeImage(out, *picture, outputType);
+        freeImage(*picture);
+        delete picture;
+    }
+    out.flush();
+
+    reader.join();
+    worker.join();
+
+    lastReport = reports;           // the threads are done with them
+    lastFailure = failures;
+    if (unreadable != "")
+        lastFailure += (failures != "" ? "\n" : "") + unreadable;
+
+    return lastFailure != "" || !out ? 1 : 0;
+}
@@ -0,0 +1,313 @@
+/** ***************************************************************************
+ * @file
+ *
+ * @brief writes an image as a Deep Zoom pyramid of fixed size tiles, each
+ *        level halved from the one above it as its rows are produced.
+ *****************************************************************************/
+
+#include "netPBM.h"
+#include <atomic>
+#include <filesystem>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+
+/******************************************************************************
+ *                              Struct
+ *****************************************************************************/
+/**
+ * @brief One level of the pyramid while it is being built. Only one band of
+ *        tile size rows of a level is kept; when it fills, its tiles are
+ *        written and the band is reused for the next rows.
+ */
+struct pyramidLevel
+{
+    int rows = 0;               /**< Number of rows in the level */
+    int cols = 0;               /**< Number of columns in the level */
+    int filled = 0;             /**< Rows of the band holding pixels */
+    int bandRow = 0;            /**< Level row of the first band row */
+    pixel** source[4] = {};     /**< Planes of the full image, top level */
+    pixel** band[4] = {};       /**< Rows of the band for each plane */
+    vector<pixel> carry[4];     /**< Even row left over when a band ends */
+};
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Writes the band of rows a level holds as one row of tiles, each in its
+ * own file named column_row in the directory of the level, in the format of
+ * the output type. The tiles of the row are written in parallel. A tile
+ * only points at the rows of the band, so no pixels are copied.
+ *
+ * @param[in] level - the level holding a full or final band
+ * @param[in] directory - directory of the level, such as "scan_files/12"
+ * @param[in] tileSize - width and height of a tile
+ * @param[in] outputType - type of output, ascii/binary/qoi
+ *
+ * @returns true if every tile was written, false with the reason in
+ *          lastFailure otherwise
+ *
+ * @par Example:
+   @verbatim
+   writeTileRow(levels[12], "scan_files/12", 256, "--binary");
+   @endverbatim
+ *
+ *****************************************************************************/
+static bool writeTileRow(pyramidLevel& level, string directory, int tileSize,
+    string outputType)
+{
+    int tiles = (level.cols + tileSize - 1) / tileSize;
+    atomic<bool> ok(true);
+
+    parallelFor(0, tiles, [&](int first, int last)
+        {
+            vector<pixel*> rows[4];
+            pixel** planes[4];
+
+            for (int k = 0; k < 4; k++)
+                rows[k].resize(level.filled);
+
+            for (int t = first; t < last; t++)
+            {
+                image tile;
+                ofstream fout;
+                string name;
+
+                for (int k = 0; k < 4; k++)
+                {
+                    planes[k] = nullptr;
+                    if (level.band[k] == nullptr)
+                        continue;
+                    for (int r = 0; r < level.filled; r++)
+                        rows[k][r] = level.band[k][r] + t * tileSize;
+                    planes[k] = rows[k].data();
+                }
+
+                tile.rows = level.filled;
+                tile.cols = min(tileSize, level.cols - t * tileSize);
+                tile.redgray = planes[0];
+                tile.green = planes[1];
+                tile.blue = planes[2];
+                tile.alpha = planes[3];
+
+                name = outputName(directory + "/" + to_string(t) + "_" +
+                    to_string(level.bandRow / tileSize), outputType, tile);
+                if (!openOutput(name, fout))
+                    ok = false;
+                else
+                {
+                    writeImage(fout, tile, outputType);
+                    if (!finishOutput(name, fout))
+                        ok = false;
+                }
+            }
+        });
+
+    if (!ok)
+        lastFailure = "Unable to write the tiles in " + directory;
+
+    return ok;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Takes the row that was just added to the band of a level. Every second
+ * row, and the last row of an odd number of rows, is halved together with
+ * the row before it by the halveRow kernel straight into the band of the
+ * next smaller level, which then takes that row the same way, so a row
+ * works its way down the pyramid while it is still in the cache. When the
+ * band is full, or the level has no more rows, its tiles are written.
+ *
+ * @param[in,out] levels - the levels, index 0 is the 1x1 level
+ * @param[in] index - the level a row was added to
+ * @param[in] baseName - basename of the pyramid
+ * @param[in] tileSize - width and height of a tile
+ * @param[in] outputType - type of output, ascii/binary/qoi
+ *
+ * @returns true if the tiles were written, false otherwise
+ *
+ * @par Example:
+   @verbatim
+   addPyramidRow(levels, top, "scan", 256, "--binary");
+   @endverbatim
+ *
+ *****************************************************************************/
+static bool addPyramidRow(vector<pyramidLevel>& levels, int index,
+    string baseName, int tileSize, string outputType)
+{
+    pyramidLevel& level = levels[index];
+    int row = level.bandRow + level.filled, k;
+    bool ok = true;
+
+    level.filled++;
+    if (index > 0 && (row % 2 == 1 || row == level.rows - 1))
+    {
+        pyramidLevel& next = levels[index - 1];
+        for (k = 0; k < 4; k++)
+        {
+            const pixel* below = level.band[k] == nullptr ? nullptr :
+                level.band[k][level.filled - 1];
+            const pixel* above = below;
+
+            if (below == nullptr)
+                continue;
+            if (row % 2 == 1)               // the row before is even
+                above = level.filled >= 2 ? level.band[k][level.filled - 2] :
+                    level.carry[k].data();
+            kernels.halveRow(above, below, next.band[k][next.filled],
+                level.cols);
+        }
+        ok = addPyramidRow(levels, index - 1, baseName, tileSize, outputType);
+    }
+
+    if (level.filled < tileSize && row < level.rows - 1)
+        return ok;
+
+    ok = writeTileRow(level, baseName + "_files/" + to_string(index),
+        tileSize, outputType) && ok;
+
+    for (k = 0; k < 4; k++)
+    {
+        if (level.band[k] == nullptr)
+            continue;
+        if (row % 2 == 0)               // its pair is in the next band
+            level.carry[k].assign(level.band[k][level.filled - 1],
+                level.band[k][level.filled - 1] + level.cols);
+        if (level.source[k] != nullptr)
+            level.band[k] = level.source[k] + row + 1;
+    }
+    level.bandRow = row + 1;
+    level.filled = 0;
+
+    return ok;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Writes an image as a Deep Zoom pyramid for a web viewer: basename.dzi
+ * describes it, and basename_files/N/column_row holds the tiles of level N,
+ * tileSize pixels square except at the right and bottom edges. Level N is
+ * the image halved until it is one pixel, with the full image as the
+ * highest level. The tiles are written in the format of the output type.
+ *
+ * Every level is made from the level above it by the halveRow kernel, a
+ * pair of rows at a time, as each row of the image is taken, so the image
+ * is read once and no level is ever held whole. Each level only keeps one
+ * band of tileSize rows, whose tiles are written in parallel as soon as it
+ * is full, so the extra memory is about two bands of the full width. A
+ * bitmap is unpacked and 16 bit samples are reduced to 8 bits first, and
+ * an alpha plane is halved like the colors. The directories of all levels
+ * are made before any band is allocated, so a directory that cannot be
+ * made stops the pyramid before a tile is written.
+ *
+ * @param[in,out] picture - structure for image information
+ * @param[in] tileSize - width and height of a tile, 256 when 0 is given
+ * @param[in] outputType - type of output, ascii/binary/qoi
+ * @param[in] baseName - basename of the .dzi file and the tile directory
+ *
+ * @returns true if the pyramid was written, false with the reason in
+ *          lastFailure otherwise
+ *
+ * @par Example:
+   @verbatim
+   writePyramid(image, 256, "--binary", "scan");
+
+   Output:
+   scan.dzi and scan_files/0/0_0.ppm to scan_files/13/23_15.ppm
+   @endverbatim
+ *
+ *****************************************************************************/
+bool writePyramid(image& picture, int tileSize, string outputType,
+    string baseName)
+{
+    pixel** planes[4] = { picture.redgray, picture.green, picture.blue,
+        picture.alpha };
+    vector<pyramidLevel> levels;
+    string extension;
+    error_code error;
+    ofstream fout;
+    int top = 0, size = max(picture.rows, picture.cols), r, i, k;
+    bool ok = true;
+
+    if (tileSize <= 0)
+        tileSize = 256;
+
+    if ((picture.bits != nullptr && !expandBitmap(picture)) ||
+        (picture.maxValue > 255 && !narrowImage(picture)))
+        return false;
+    planes[0] = picture.redgray;
+    planes[1] = picture.green;
+    planes[2] = picture.blue;
+
+    for (; size > 1; size = (size + 1) / 2)    // levels below the image
+        top++;
+
+    for (i = top; i >= 0; i--)          // every directory before any band
+    {
+        string directory = baseName + "_files/" + to_string(i);
+
+        fs::create_directories(directory, error);
+        if (error)
+        {
+            lastFailure = "Unable to create the directory " + directory;
+            return false;
+        }
+    }
+
+    levels.resize(top + 1);
+    for (i = top; i >= 0 && ok; i--)
+    {
+        levels[i].rows = i == top ? picture.rows : (levels[i + 1].rows + 1) / 2;
+        levels[i].cols = i == top ? picture.cols : (levels[i + 1].cols + 1) / 2;
+
+        for (k = 0; k < 4 && ok; k++)
+        {
+            if (planes[k] == nullptr)
+                continue;
+            if (i == top)               // the band is the image itself
+            {
+                levels[i].source[k] = planes[k];
+                levels[i].band[k] = planes[k];
+            }
+            else if ((levels[i].band[k] = alloc2d(min(tileSize,
+                levels[i].rows), levels[i].cols)) == nullptr)
+            {
+                lastFailure = "Unable to allocate memory for the pyramid";
+                ok = false;
+            }
+        }
+    }
+
+    for (r = 0; r < picture.rows && ok; r++)
+        ok = addPyramidRow(levels, top, baseName, tileSize, outputType);
+
+    for (i = 0; i < top; i++)           // only the bands that were allocated
+        for (k = 0; k < 4; k++)
+            free2d(levels[i].band[k], min(tileSize, levels[i].rows));
+
+    if (!ok)
+        return false;
+
+    extension = outputName("", outputType, picture).substr(1);
+    if (!openOutput(baseName + ".dzi", fout))
+        return false;
+
+    fout << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
+    fout << "<Image xmlns=\"http://schemas.microsoft.com/deepzoom/2008\"\n";
+    fout << "  Format=\"" << extension << "\" Overlap=\"0\" TileSize=\""
+        << tileSize << "\">\n";
+    fout << "  <Size Width=\"" << picture.cols << "\" Height=\""
+        << picture.rows << "\"/>\n";
+    fout << "</Image>\n";
+
+    return finishOutput(baseName + ".dzi", fout);
+}
@@ -0,0 +1,815 @@
+/** ***************************************************************************
+ * @file
+ *
+ * @brief splits an image into horizontal strips that separate worker
+ *        processes filter, trading halo rows with their neighbors.
+ *****************************************************************************/
+
+#include "netPBM.h"
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+#endif
+
+
+/******************************************************************************
+ *                             Structures
+ *****************************************************************************/
+/**
+ * @brief What the coordinator tells a worker about its strip. The option,
+ *        parameter and output file follow as strings, then the rows.
+ */
+struct shardHeader
+{
+    int rows;               /**< Number of rows the worker owns */
+    int cols;               /**< Number of columns in the image */
+    int firstRow;           /**< Row of the image the strip starts at */
+    int maxValue;           /**< Largest sample value of the image */
+    int planes;             /**< Bit k is set when color plane k is sent */
+    long long headerBytes;  /**< Length of the output file header */
+};
+
+/**
+ * @brief What a worker tells the coordinator when its strip is done. When
+ *        the worker has no output file its rows follow.
+ */
+struct shardReply
+{
+    int ok;                 /**< 1 if the strip was processed and written */
+    int planes;             /**< Bit k is set when color plane k remains */
+};
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Returns how many rows of the neighboring strips an operation reads to
+ * find one row of its own, which is also how many columns it reads on either
+ * side. The pixel operations need none and the 3x3 filters need one.
+ * Operations that need the whole image, such as contrast, or that change
+ * its size, such as crop, can not be split into strips or tiles.
+ *
+ * @param[in] option - image operation choice
+ *
+ * @returns the halo rows on each side, or -1 if the operation can not be
+ *          split into strips
+ *
+ * @par Example:
+   @verbatim
+   haloRows("--smooth");
+
+   Output:
+   1
+   @endverbatim
+ *
+ *****************************************************************************/
+int haloRows(string option)
+{
+    if (option == "--negate" || option == "--brighten" ||
+        option == "--grayscale")
+        return 0;
+    if (option == "--smooth" || option == "--sharpen")
+        return 1;
+
+    return -1;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Returns a mask of the color planes an image holds, bit 0 for red or gray,
+ * bit 1 for green and bit 2 for blue, of either sample size.
+ *
+ * @param[in] picture - image structure
+ *
+ * @returns the mask of the planes that are allocated
+ *
+ * @par Example:
+   @verbatim
+   planeMask(image);
+
+   Output:
+   7
+   @endverbatim
+ *
+ *****************************************************************************/
+static int planeMask(image& picture)
+{
+    bool wide = picture.maxValue > 255;
+    int mask = 0;
+
+    if ((wide ? (void*)picture.redgray16 : (void*)picture.redgray) != nullptr)
+        mask |= 1;
+    if ((wide ? (void*)picture.green16 : (void*)picture.green) != nullptr)
+        mask |= 2;
+    if ((wide ? (void*)picture.blue16 : (void*)picture.blue) != nullptr)
+        mask |= 4;
+
+    return mask;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Sends or receives count rows of every plane of an image, starting at row
+ * first. Both ends must hold the same planes.
+ *
+ * @param[in] link - the connection to the other end
+ * @param[in,out] planes - the red/gray, green and blue planes, nullptr for
+ *                         the ones that are not held
+ * @param[in] first - first row to move
+ * @param[in] count - number of rows to move
+ * @param[in] cols - number of columns in a row
+ * @param[in] sending - true to send the rows, false to receive them
+ *
+ * @returns true if every row was moved, false if the connection failed
+ *
+ * @par Example:
+   @verbatim
+   moveRows(link, planes, 0, 16, image.cols, true);
+   @endverbatim
+ *
+ *****************************************************************************/
+template <class T>
+static bool moveRows(shardTransport& link, T** planes[3], int first,
+    int count, int cols, bool sending)
+{
+    int k, r;
+
+    for (k = 0; k < 3; k++)
+    {
+        if (planes[k] == nullptr)
+            continue;
+
+        for (r = first; r < first + count; r++)
+        {
+            if (sending ? !link.send(planes[k][r], cols * sizeof(T)) :
+                !link.receive(planes[k][r], cols * sizeof(T)))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Sends or receives rows of an image with moveRows, using the 8 or 16 bit
+ * planes the image holds.
+ *
+ * @param[in] link - the connection to the other end
+ * @param[in,out] picture - image structure
+ * @param[in] first - first row to move
+ * @param[in] count - number of rows to move
+ * @param[in] sending - true to send the rows, false to receive them
+ *
+ * @returns true if every row was moved, false if the connection failed
+ *
+ * @par Example:
+   @verbatim
+   moveImageRows(link, image, 0, image.rows, false);
+   @endverbatim
+ *
+ *****************************************************************************/
+static bool moveImageRows(shardTransport& link, image& picture, int first,
+    int count, bool sending)
+{
+    pixel** planes[3] = { picture.redgray, picture.green, picture.blue };
+    sample16** planes16[3] = { picture.redgray16, picture.green16,
+        picture.blue16 };
+
+    if (picture.maxValue > 255)
+        return moveRows(link, planes16, first, count, picture.cols, sending);
+
+    return moveRows(link, planes, first, count, picture.cols, sending);
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Sends a string as its length followed by its characters.
+ *
+ * @param[in] link - the connection to the other end
+ * @param[in] text - the string to send
+ *
+ * @returns true if the string was sent, false if the connection failed
+ *
+ * @par Example:
+   @verbatim
+   sendString(link, "--smooth");
+   @endverbatim
+ *
+ *****************************************************************************/
+static bool sendString(shardTransport& link, const string& text)
+{
+    int length = (int)text.size();
+
+    return link.send(&length, sizeof(length)) &&
+        link.send(text.data(), text.size());
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Receives a string sent by sendString.
+ *
+ * @param[in] link - the connection to the other end
+ * @param[out] text - the string that was received
+ *
+ * @returns true if the string was received, false if the connection failed
+ *
+ * @par Example:
+   @verbatim
+   receiveString(link, option);
+   @endverbatim
+ *
+ *****************************************************************************/
+static bool receiveString(shardTransport& link, string& text)
+{
+    int length = 0;
+
+    if (!link.receive(&length, sizeof(length)) || length < 0)
+        return false;
+
+    text.assign(length, ' ');
+    return link.receive(&text[0], length);
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Trades halo rows with the workers above and below. The first halo rows a
+ * worker owns go to the worker above it and the last ones to the worker
+ * below it, while the rows it gets from them fill the top and bottom of its
+ * strip. The sends run on their own thread, so two neighbors that send to
+ * each other at the same time can not both block on a full connection.
+ *
+ * @param[in,out] strip - the strip with room for the halo rows
+ * @param[in] above - the worker above, nullptr for the top strip
+ * @param[in] below - the worker below, nullptr for the bottom strip
+ * @param[in] top - halo rows at the top of the strip
+ * @param[in] own - rows of the strip the worker owns
+ * @param[in] bottom - halo rows at the bottom of the strip
+ *
+ * @returns true if the halo rows were traded, false if a connection failed
+ *
+ * @par Example:
+   @verbatim
+   exchangeHalo(strip, above, below, 1, 100, 1);
+   @endverbatim
+ *
+ *****************************************************************************/
+static bool exchangeHalo(image& strip, shardTransport* above,
+    shardTransport* below, int top, int own, int bottom)
+{
+    bool sent = true, received;
+
+    thread sender([&]
+        {
+            if (above != nullptr)
+                sent = moveImageRows(*above, strip, top, top, true);
+            if (below != nullptr && sent)
+                sent = moveImageRows(*below, strip, top + own - bottom,
+                    bottom, true);
+        });
+
+    received = (above == nullptr ||
+        moveImageRows(*above, strip, 0, top, false)) &&
+        (below == nullptr ||
+            moveImageRows(*below, strip, top + own, bottom, false));
+
+    sender.join();
+
+    return sent && received;
+}
+
+
+#ifndef _WIN32
+/******************************************************************************
+ *                              Class
+ *****************************************************************************/
+/**
+ * @brief The shard transport over a connected Unix socket, used between the
+ *        processes of one machine. The socket is closed with the transport.
+ */
+class socketTransport : public shardTransport
+{
+public:
+    /**
+     * @brief wraps a connected socket
+     * @param[in] socket - descriptor of the socket
+     */
+    explicit socketTransport(int socket) : fd(socket) {}
+
+    /**
+     * @brief closes the socket
+     */
+    ~socketTransport() override
+    {
+        close(fd);
+    }
+
+    /**
+     * @brief sends all of the bytes, waiting while the socket is full
+     * @param[in] data - the bytes to send
+     * @param[in] size - number of bytes to send
+     * @returns true if every byte was sent, false if the socket failed
+     */
+    bool send(const void* data, size_t size) override
+    {
+        const char* next = (const char*)data;
+        ssize_t done;
+
+        while (size > 0)
+        {
+            done = ::send(fd, next, size, MSG_NOSIGNAL);
+            if (done < 0 && errno == EINTR)
+                continue;
+            if (done <= 0)
+                return false;
+            next += done;
+            size -= done;
+        }
+
+        return true;
+    }
+
+    /**
+     * @brief receives exactly size bytes, waiting until they arrive
+     * @param[out] data - where the bytes are stored
+     * @param[in] size - number of bytes to receive
+     * @returns true if every byte arrived, false if the socket closed first
+     */
+    bool receive(void* data, size_t size) override
+    {
+        char* next = (char*)data;
+        ssize_t done;
+
+        while (size > 0)
+        {
+            done = recv(fd, next, size, 0);
+            if (done < 0 && errno == EINTR)
+                continue;
+            if (done <= 0)
+                return false;
+            next += done;
+            size -= done;
+        }
+
+        return true;
+    }
+
+private:
+    int fd;                 /**< descriptor of the connected socket */
+};
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Writes the binary rows of a processed strip straight to their place in
+ * the output file with positioned writes, so no process ever gathers the
+ * whole output. The rows are packed by writeBinary, and the strip header it
+ * writes in front of them is skipped.
+ *
+ * @param[in] part - the rows of the strip the worker owns
+ * @param[in] outputFile - name of the output file, which already exists
+ * @param[in] header - where the strip and the file header start
+ *
+ * @returns true if the rows were written, false otherwise
+ *
+ * @par Example:
+   @verbatim
+   writeStrip(part, "result.part", header);
+   @endverbatim
+ *
+ *****************************************************************************/
+static bool writeStrip(image& part, string outputFile, shardHeader& header)
+{
+    ostringstream packed(ios::binary);
+    string bytes;
+    size_t rowBytes, size;
+    const char* next;
+    off_t offset;
+    ssize_t done;
+    int fd;
+
+    writeBinary(packed, part);
+    bytes = packed.str();
+    rowBytes = (size_t)part.cols * (planeMask(part) == 1 ? 1 : 3) *
+        (part.maxValue > 255 ? 2 : 1);
+    size = rowBytes * part.rows;
+    next = bytes.data() + bytes.size() - size;
+    offset = (off_t)(header.headerBytes + (long long)header.firstRow * rowBytes);
+
+    fd = open(outputFile.c_str(), O_WRONLY);
+    if (fd < 0)
+        return false;
+
+    while (size > 0)
+    {
+        done = pwrite(fd, next, size, offset);
+        if (done < 0 && errno == EINTR)
+            continue;
+        if (done <= 0)
+            break;
+        next += done;
+        offset += done;
+        size -= done;
+    }
+
+    close(fd);
+
+    return size == 0;
+}
+#endif
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Processes one strip of an image for shardImage. Everything the worker
+ * needs comes over the transports, so it can run in a process of its own or
+ * on another machine. The worker receives its strip from the coordinator,
+ * trades halo rows with the workers above and below, applies the operation
+ * and writes the rows it owns. With an output file the rows are written in
+ * place, otherwise they are sent back to the coordinator.
+ *
+ * @param[in] coordinator - the connection to the coordinator
+ * @param[in] above - the worker above, nullptr for the top strip
+ * @param[in] below - the worker below, nullptr for the bottom strip
+ *
+ * @returns true if the strip was processed and written, false otherwise
+ *
+ * @par Example:
+   @verbatim
+   runShardWorker(coordinator, &above, &below);
+   @endverbatim
+ *
+ *****************************************************************************/
+bool runShardWorker(shardTransport& coordinator, shardTransport* above,
+    shardTransport* below)
+{
+    shardHeader header;
+    shardReply reply = { 0, 0 };
+    string option, parameter, outputFile;
+    image strip, part;
+    int halo, top, bottom, k;
+    bool ok;
+
+    if (!coordinator.receive(&header, sizeof(header)) ||
+        !receiveString(coordinator, option) ||
+        !receiveString(coordinator, parameter) ||
+        !receiveString(coordinator, outputFile))
+        return false;
+
+    halo = max(haloRows(option), 0);
+    top = above == nullptr ? 0 : halo;
+    bottom = below == nullptr ? 0 : halo;
+
+    strip.magicNumber = header.planes == 1 ? "P5" : "P6";
+    strip.rows = top + header.rows + bottom;
+    strip.cols = header.cols;
+    strip.maxValue = header.maxValue;
+    for (k = 0; k < 3; k++)
+    {
+        if (!(header.planes & (1 << k)))
+            continue;
+        if (header.maxValue > 255)
+            (k == 0 ? strip.redgray16 : k == 1 ? strip.green16 :
+                strip.blue16) = allocPlane<sample16>(strip.rows, strip.cols);
+        else
+            (k == 0 ? strip.redgray : k == 1 ? strip.green : strip.blue) =
+                alloc2d(strip.rows, strip.cols);
+    }
+
+    ok = planeMask(strip) == header.planes &&
+        moveImageRows(coordinator, strip, top, header.rows, false) &&
+        exchangeHalo(strip, above, below, top, header.rows, bottom) &&
+        tunedOperation(strip, option, parameter);
+
+    part = strip;                   // the rows this worker owns
+    part.rows = header.rows;
+    part.redgray = strip.redgray ? strip.redgray + top : nullptr;
+    part.green = strip.green ? strip.green + top : nullptr;
+    part.blue = strip.blue ? strip.blue + top : nullptr;
+    part.redgray16 = strip.redgray16 ? strip.redgray16 + top : nullptr;
+    part.green16 = strip.green16 ? strip.green16 + top : nullptr;
+    part.blue16 = strip.blue16 ? strip.blue16 + top : nullptr;
+
+#ifndef _WIN32
+    if (ok && outputFile != "")
+        ok = writeStrip(part, outputFile, header);
+#endif
+
+    reply.ok = ok;
+    reply.planes = planeMask(part);
+    if (!coordinator.send(&reply, sizeof(reply)) ||
+        (ok && outputFile == "" &&
+            !moveImageRows(coordinator, part, 0, part.rows, true)))
+        ok = false;
+
+    freeImage(strip);
+
+    return ok;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Frees the color planes of an image that are not in a mask, so the image
+ * the coordinator writes has the same planes as the strips the workers
+ * made. An image left with one plane becomes a graymap.
+ *
+ * @param[in,out] picture - image structure
+ * @param[in] planes - mask of the planes to keep
+ *
+ * @par Example:
+   @verbatim
+   keepPlanes(image, 1);
+   @endverbatim
+ *
+ *****************************************************************************/
+static void keepPlanes(image& picture, int planes)
+{
+    if (!(planes & 2))
+    {
+        free2d(picture.green, picture.rows);
+        free2d(picture.green16, picture.rows);
+        picture.green = nullptr;
+        picture.green16 = nullptr;
+    }
+    if (!(planes & 4))
+    {
+        free2d(picture.blue, picture.rows);
+        free2d(picture.blue16, picture.rows);
+        picture.blue = nullptr;
+        picture.blue16 = nullptr;
+    }
+
+    if (planes == 1 && picture.magicNumber == "P3")
+        picture.magicNumber = "P2";
+    if (planes == 1 && picture.magicNumber == "P6")
+        picture.magicNumber = "P5";
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Splits an image into one horizontal strip per worker and has a separate
+ * worker process filter each strip with runShardWorker. The coordinator
+ * and the workers talk over Unix sockets, and neighboring workers get their
+ * own sockets to trade the halo rows a 3x3 filter reads across a strip
+ * boundary. Any transport can stand in for the sockets, for workers on
+ * other machines.
+ *
+ * For binary output the coordinator sizes the output file and each worker
+ * writes its rows to their place in it with positioned writes, so the
+ * processed image is never gathered. The coordinator writes the header last,
+ * once the workers report which planes remain, and renames the file. For
+ * ASCII, QOI and compressed output the workers send their rows back and the
+ * image is written as usual.
+ *
+ * Only operations that work row by row can be split: negate, brighten,
+ * grayscale, smooth and sharpen. Any other operation, a bitmap, an image
+ * with fewer rows than workers or a system without Unix sockets is
+ * declined, and the caller processes the image in this process.
+ *
+ * @param[in,out] picture - the image, freed when it was sharded
+ * @param[in] option - image operation choice
+ * @param[in] parameter - the text given with the option, empty if none
+ * @param[in] outputType - type of output, ascii/binary/qoi
+ * @param[in] baseName - name of the output file without an extension
+ * @param[in] workers - number of worker processes
+ *
+ * @returns HANDOFF_DONE if the image was processed in strips and written,
+ *          HANDOFF_FAILED with the reason in lastFailure if it was taken
+ *          but not written, HANDOFF_DECLINED if the caller has to process it
+ *
+ * @par Example:
+   @verbatim
+   if (shardImage(image, "--smooth", "", "--binary", "result", 4) ==
+       HANDOFF_DECLINED)
+       applyOperation(image, "--smooth", "");
+   @endverbatim
+ *
+ *****************************************************************************/
+handoff shardImage(image& picture, string option, string parameter,
+    string outputType, string baseName, int workers)
+{
+#ifdef _WIN32
+    return HANDOFF_DECLINED;
+#else
+    int halo = haloRows(option);
+    bool binary = outputType == "--binary" &&
+        compressionFromName(baseName) == COMPRESS_NONE, ok = true;
+    string partFile = binary ? baseName + ".part" : "";
+    vector<int> toWorker, fromCoordinator, down, up;
+    vector<pid_t> children;
+    ostringstream header(ios::binary);
+    shardReply reply;
+    ofstream fout;
+    int planes, i, j, pair[2], fd = -1, status;
+    size_t rowBytes;
+
+    if (halo < 0 || picture.bits != nullptr || picture.alpha != nullptr)
+        return HANDOFF_DECLINED;
+
+    workers = min(workers, picture.rows / max(halo, 1));
+    if (workers < 2)
+        return HANDOFF_DECLINED;
+
+    planes = planeMask(picture);
+    rowBytes = (size_t)picture.cols * (planes == 1 ? 1 : 3) *
+        (picture.maxValue > 255 ? 2 : 1);
+    writeHeader(header, picture, "P6");     // P5 headers are the same length
+
+    if (binary)     // sized up front so the workers can write anywhere
+    {
+        fd = open(partFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0 || ftruncate(fd, (off_t)(header.str().size() +
+            rowBytes * picture.rows)) != 0)
+        {
+            lastFailure = "Unable to create the output file " + partFile;
+            if (fd >= 0)
+                close(fd);
+            freeImage(picture);
+            return HANDOFF_FAILED;
+        }
+    }
+
+    for (i = 0; i < workers; i++)   // coordinator links and neighbor links
+    {
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0)
+            break;
+        toWorker.push_back(pair[0]);
+        fromCoordinator.push_back(pair[1]);
+
+        if (i + 1 < workers)
+        {
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0)
+                break;
+            down.push_back(pair[0]);
+            up.push_back(pair[1]);
+        }
+    }
+
+    cout.flush();               // the workers must not repeat buffered text
+    for (i = 0; i < (int)fromCoordinator.size() &&
+        (int)down.size() == workers - 1; i++)
+    {
+        pid_t child = fork();
+
+        if (child < 0)
+            break;
+
+        if (child == 0)             // the worker keeps only its own links
+        {
+            for (j = 0; j < workers; j++)
+            {
+                close(toWorker[j]);
+                if (j != i)
+                    close(fromCoordinator[j]);
+                if (j < workers - 1 && j != i)
+                    close(down[j]);
+                if (j < workers - 1 && j != i - 1)
+                    close(up[j]);
+            }
+            if (fd >= 0)
+                close(fd);
+
+            socketTransport coordinator(fromCoordinator[i]);
+            socketTransport* above = i > 0 ?
+                new socketTransport(up[i - 1]) : nullptr;
+            socketTransport* below = i < workers - 1 ?
+                new socketTransport(down[i]) : nullptr;
+            ok = runShardWorker(coordinator, above, below);
+            delete above;
+            delete below;
+            _exit(ok ? 0 : 1);
+        }
+
+        children.push_back(child);
+    }
+
+    for (int link : fromCoordinator)
+        close(link);
+    for (j = 0; j < (int)down.size(); j++)
+    {
+        close(down[j]);
+        close(up[j]);
+    }
+
+    vector<socketTransport*> links;
+    for (int link : toWorker)
+        links.push_back(new socketTransport(link));
+    ok = (int)children.size() == workers;
+
+    for (i = 0; i < (int)children.size() && ok; i++)    // hand out the strips
+    {
+        shardHeader strip;
+        int first = (int)((long long)picture.rows * i / workers);
+
+        strip.rows = (int)((long long)picture.rows * (i + 1) / workers) - first;
+        strip.cols = picture.cols;
+        strip.firstRow = first;
+        strip.maxValue = picture.maxValue;
+        strip.planes = planes;
+        strip.headerBytes = (long long)header.str().size();
+
+        ok = links[i]->send(&strip, sizeof(strip)) &&
+            sendString(*links[i], option) &&
+            sendString(*links[i], parameter) &&
+            sendString(*links[i], partFile) &&
+            moveImageRows(*links[i], picture, first, strip.rows, true);
+    }
+
+    for (i = 0; i < (int)children.size() && ok; i++)    // collect the results
+    {
+        int first = (int)((long long)picture.rows * i / workers);
+        int last = (int)((long long)picture.rows * (i + 1) / workers);
+
+        ok = links[i]->receive(&reply, sizeof(reply)) && reply.ok;
+        if (ok && i == 0)
+            keepPlanes(picture, reply.planes);
+        if (ok && !binary)
+            ok = moveImageRows(*links[i], picture, first, last - first, false);
+    }
+
+    for (socketTransport* link : links)     // ends any worker still waiting
+        delete link;
+    for (pid_t child : children)
+    {
+        if (waitpid(child, &status, 0) != child || !WIFEXITED(status) ||
+            WEXITSTATUS(status) != 0)
+            ok = false;
+    }
+
+    if (!ok)
+    {
+        lastFailure = "A shard worker failed, the image was not written";
+        if (binary)
+        {
+            close(fd);
+            remove(partFile.c_str());
+        }
+        freeImage(picture);
+        return HANDOFF_FAILED;
+    }
+
+    if (binary)     // the header goes in last, once the planes are known
+    {
+        header.str("");
+        writeHeader(header, picture, planeMask(picture) == 1 ? "P5" : "P6");
+        rowBytes = (size_t)picture.cols * (planeMask(picture) == 1 ? 1 : 3) *
+            (picture.maxValue > 255 ? 2 : 1);
+        if (pwrite(fd, header.str().data(), header.str().size(), 0) !=
+            (ssize_t)header.str().size() || ftruncate(fd,
+            (off_t)(header.str().size() + rowBytes * picture.rows)) != 0 ||
+            close(fd) != 0 || rename(partFile.c_str(),
+            outputName(baseName, outputType, picture).c_str()) != 0)
+            ok = false;
+    }
+    else
+        ok = output((char*)outputType.c_str(), outputName(baseName,
+            outputType, picture), fout, picture);
+
+    if (!ok && lastFailure == "")
+        lastFailure = "Unable to write the output file " +
+            outputName(baseName, outputType, picture);
+    freeImage(picture);
+
+    return ok ? HANDOFF_DONE : HANDOFF_FAILED;
+#endif
+}
@@ -0,0 +1,1710 @@
+/** ***************************************************************************
+ * @file
+ *
+ * @brief row kernels built for several instruction sets and the cpuid
+ *        dispatch that picks the fastest one the processor supports.
+ *
+ * Every kernel has a scalar version that is the reference for the others.
+ * The SSE4.2, AVX2 and AVX-512 versions are compiled in the same binary with
+ * target attributes, so the program runs on any x86 processor and uses the
+ * widest instructions it has. A level only replaces the kernels it speeds
+ * up; the rest are inherited from the level below it.
+ *****************************************************************************/
+
+#include "netPBM.h"
+#include <cstdlib>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define SIMD_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#if defined(SIMD_X86) && defined(__GNUC__)
+#define TARGET_SSE42 __attribute__((target("sse4.2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_AVX512 __attribute__((target("avx512f,avx512bw")))
+#else
+#define TARGET_SSE42
+#define TARGET_AVX2
+#define TARGET_AVX512
+#endif
+
+
+/******************************************************************************
+ *                          Median Networks
+ *****************************************************************************/
+/**
+ * @brief compare and swap steps that leave the median of a window in the
+ *        middle slot. The same steps run on single pixels in the scalar
+ *        kernel and on whole registers of pixels in the SIMD kernels.
+ */
+struct medianNetwork
+{
+    int size = 0;           /**< pixels in the window, 9 or 25 */
+    int count = 0;          /**< number of compare and swap steps */
+    unsigned char low[256];     /**< slot that receives the minimum */
+    unsigned char high[256];    /**< slot that receives the maximum */
+};
+
+/**
+ * @brief builds Batcher's odd-even merge sort for the next power of two at
+ *        or above size and keeps only the steps the middle slot depends on.
+ *        Slots past size act as +infinity, which never moves down, so steps
+ *        that touch them do nothing and are dropped as well.
+ */
+static medianNetwork buildMedianNetwork(int size)
+{
+    medianNetwork all, net;
+    bool needed[32] = { false };
+    int wires = 1, p, k, j, i, n;
+
+    while (wires < size)
+        wires *= 2;
+
+    for (p = 1; p < wires; p *= 2)
+        for (k = p; k >= 1; k /= 2)
+            for (j = k % p; j + k < wires; j += 2 * k)
+                for (i = 0; i < k && i + j + k < wires; i++)
+                    if ((i + j) / (2 * p) == (i + j + k) / (2 * p) &&
+                        i + j + k < size)
+                    {
+                        all.low[all.count] = (unsigned char)(i + j);
+                        all.high[all.count++] = (unsigned char)(i + j + k);
+                    }
+
+    needed[size / 2] = true;                // walk back from the median
+    for (n = all.count - 1; n >= 0; n--)
+    {
+        if (needed[all.low[n]] || needed[all.high[n]])
+        {
+            needed[all.low[n]] = needed[all.high[n]] = true;
+            net.low[net.count] = all.low[n];
+            net.high[net.count++] = all.high[n];
+        }
+    }
+
+    reverse(net.low, net.low + net.count);
+    reverse(net.high, net.high + net.count);
+    net.size = size;
+
+    return net;
+}
+
+/**
+ * @brief the network for a 3x3 window when radius is 1, else for 5x5
+ */
+static const medianNetwork& medianNetworkFor(int radius)
+{
+    static const medianNetwork three = buildMedianNetwork(9);
+    static const medianNetwork five = buildMedianNetwork(25);
+
+    return radius == 1 ? three : five;
+}
+
+
+/******************************************************************************
+ *                          Scalar Kernels
+ *****************************************************************************/
+/**
+ * @brief adds value to each pixel of a row, clamped to [0,255]
+ */
+static void addRowScalar(pixel* row, int cols, int value)
+{
+    int c;
+
+    for (c = 0; c < cols; c++)
+        row[c] = (pixel)crop(row[c] + value);
+}
+
+/**
+ * @brief replaces each pixel of a row with 255 minus the pixel
+ */
+static void negateRowScalar(pixel* row, int cols)
+{
+    int c;
+
+    for (c = 0; c < cols; c++)
+        row[c] = 255 - row[c];
+}
+
+/**
+ * @brief 3x3 mean of the samples in columns [first, last) of row, for 8 or
+ *        16 bit samples
+ */
+template <class T>
+static void smoothRowTemplate(const T* above, const T* row, const T* below,
+    T* out, int first, int last)
+{
+    int c;
+
+    for (c = first; c < last; c++)
+    {
+        out[c] = (T)((above[c - 1] + above[c] + above[c + 1] +
+            row[c - 1] + row[c] + row[c + 1] +
+            below[c - 1] + below[c] + below[c + 1]) / 9);
+    }
+}
+
+/**
+ * @brief 5 point sharpen of the samples in columns [first, last) of row,
+ *        clamped to [0,maxValue], for 8 or 16 bit samples
+ */
+template <class T>
+static void sharpenRowTemplate(const T* above, const T* row, const T* below,
+    T* out, int first, int last, int maxValue)
+{
+    int c;
+
+    for (c = first; c < last; c++)
+    {
+        out[c] = (T)max(0, min(5 * row[c] - row[c - 1] - above[c] -
+            below[c] - row[c + 1], maxValue));
+    }
+}
+
+/**
+ * @brief 3x3 mean of the pixels in columns [first, last) of row
+ */
+static void smoothRowScalar(const pixel* above, const pixel* row,
+    const pixel* below, pixel* out, int first, int last)
+{
+    smoothRowTemplate(above, row, below, out, first, last);
+}
+
+/**
+ * @brief 5 point sharpen of the pixels in columns [first, last) of row
+ */
+static void sharpenRowScalar(const pixel* above, const pixel* row,
+    const pixel* below, pixel* out, int first, int last)
+{
+    sharpenRowTemplate(above, row, below, out, first, last, 255);
+}
+
+/**
+ * @brief packs three planes into RGB triples
+ */
+static void interleaveRowScalar(const pixel* red, const pixel* green,
+    const pixel* blue, pixel* packed, int cols)
+{
+    int c;
+
+    for (c = 0; c < cols; c++)
+    {
+        packed[3 * c] = red[c];
+        packed[3 * c + 1] = green[c];
+        packed[3 * c + 2] = blue[c];
+    }
+}
+
+/**
+ * @brief splits RGB triples into three planes
+ */
+static void deinterleaveRowScalar(const pixel* packed, pixel* red,
+    pixel* green, pixel* blue, int cols)
+{
+    int c;
+
+    for (c = 0; c < cols; c++)
+    {
+        red[c] = packed[3 * c];
+        green[c] = packed[3 * c + 1];
+        blue[c] = packed[3 * c + 2];
+    }
+}
+
+/**
+ * @brief absolute difference of two rows, with the sum of squared
+ *        differences and the largest difference accumulated
+ */
+static void diffRowScalar(const pixel* first, const pixel* second,
+    pixel* diff, int cols, unsigned long long& sumSquares, int& maxDiff)
+{
+    int c, d;
+
+    for (c = 0; c < cols; c++)
+    {
+        d = abs(first[c] - second[c]);
+        sumSquares += (unsigned long long)(d * d);
+        maxDiff = max(maxDiff, d);
+        if (diff != nullptr)
+            diff[c] = (pixel)d;
+    }
+}
+
+/**
+ * @brief smaller of two rows, pixel by pixel
+ */
+static void minRowScalar(const pixel* first, const pixel* second, pixel* out,
+    int cols)
+{
+    int c;
+
+    for (c = 0; c < cols; c++)
+        out[c] = min(first[c], second[c]);
+}
+
+/**
+ * @brief larger of two rows, pixel by pixel
+ */
+static void maxRowScalar(const pixel* first, const pixel* second, pixel* out,
+    int cols)
+{
+    int c;
+
+    for (c = 0; c < cols; c++)
+        out[c] = max(first[c], second[c]);
+}
+
+/**
+ * @brief luma of a row, round(0.3 red + 0.6 green + 0.1 blue) as grayscale
+ *        uses, widened to 16 bits
+ */
+static void lumaRowScalar(const pixel* red, const pixel* green,
+    const pixel* blue, short* gray, int cols)
+{
+    int c;
+
+    for (c = 0; c < cols; c++)
+        gray[c] = (short)((3 * red[c] + 6 * green[c] + blue[c] + 5) / 10);
+}
+
+/**
+ * @brief gradient magnitude of a row of luma. The rows have one extra pixel
+ *        on each side, so out[c] is centered on index c + 1. side and
+ *        center are the weights of the 3 point smoothing across the
+ *        derivative, 1 and 2 for Sobel or 3 and 10 for Scharr, and the
+ *        magnitude is shifted right by shift to bring it back to [0,255].
+ *        The L2 magnitude is approximated by 0.961 max + 0.398 min of |gx|
+ *        and |gy| in 15 bit fixed point.
+ */
+static void gradientRowScalar(const short* above, const short* row,
+    const short* below, pixel* out, int cols, int side, int center,
+    int shift, bool l2)
+{
+    int c, gx, gy, ax, ay, magnitude;
+
+    for (c = 0; c < cols; c++)
+    {
+        gx = side * (above[c + 2] - above[c] + below[c + 2] - below[c]) +
+            center * (row[c + 2] - row[c]);
+        gy = side * (below[c] - above[c] + below[c + 2] - above[c + 2]) +
+            center * (below[c + 1] - above[c + 1]);
+        ax = abs(gx);
+        ay = abs(gy);
+        if (l2)
+            magnitude = ((max(ax, ay) * 31488 + 16384) >> 15) +
+                ((min(ax, ay) * 13056 + 16384) >> 15);
+        else
+            magnitude = ax + ay;
+        out[c] = (pixel)min(magnitude >> shift, 255);
+    }
+}
+
+/**
+ * @brief median of a square of 2 * radius + 1 rows and columns for the
+ *        columns [first, last) of out, the square for out[c] starts at
+ *        column c of each window row
+ */
+static void medianRowScalar(const pixel* const* window, pixel* out,
+    int radius, int first, int last)
+{
+    const medianNetwork& net = medianNetworkFor(radius);
+    int side = 2 * radius + 1;
+    pixel v[25], lo;
+    int c, y, x, i;
+
+    for (c = first; c < last; c++)
+    {
+        for (y = 0; y < side; y++)
+            for (x = 0; x < side; x++)
+                v[y * side + x] = window[y][c + x];
+
+        for (i = 0; i < net.count; i++)
+        {
+            lo = min(v[net.low[i]], v[net.high[i]]);
+            v[net.high[i]] = max(v[net.low[i]], v[net.high[i]]);
+            v[net.low[i]] = lo;
+        }
+
+        out[c] = v[net.size / 2];
+    }
+}
+
+/**
+ * @brief swaps the two bytes of each 16 bit sample, which turns the big
+ *        endian samples of a file into the order of this processor and back
+ */
+static void swapRowScalar(const sample16* in, sample16* out, int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++)
+        out[i] = (sample16)((in[i] >> 8) | (in[i] << 8));
+}
+
+/**
+ * @brief adds value to each 16 bit sample of a row, clamped to [0,maxValue]
+ */
+static void addRow16Scalar(sample16* row, int cols, int value, int maxValue)
+{
+    int c;
+
+    for (c = 0; c < cols; c++)
+        row[c] = (sample16)max(0, min(row[c] + value, maxValue));
+}
+
+/**
+ * @brief replaces each 16 bit sample of a row with maxValue minus the sample
+ */
+static void negateRow16Scalar(sample16* row, int cols, int maxValue)
+{
+    int c;
+
+    for (c = 0; c < cols; c++)
+        row[c] = (sample16)(maxValue - min((int)row[c], maxValue));
+}
+
+/**
+ * @brief 3x3 mean of the 16 bit samples in columns [first, last) of row
+ */
+static void smoothRow16Scalar(const sample16* above, const sample16* row,
+    const sample16* below, sample16* out, int first, int last)
+{
+    smoothRowTemplate(above, row, below, out, first, last);
+}
+
+/**
+ * @brief 5 point sharpen of the 16 bit samples in columns [first, last)
+ */
+static void sharpenRow16Scalar(const sample16* above, const sample16* row,
+    const sample16* below, sample16* out, int first, int last, int maxValue)
+{
+    sharpenRowTemplate(above, row, below, out, first, last, maxValue);
+}
+
+/**
+ * @brief blends a row onto base by alpha, (over * alpha + base * (255 -
+ *        alpha)) / 255 rounded, which is the over operator with the
+ *        overlay premultiplied; a 0 alpha leaves base alone
+ */
+static void overRowScalar(const pixel* over, const pixel* alpha, pixel* base,
+    int cols)
+{
+    int c, x;
+
+    for (c = 0; c < cols; c++)
+    {
+        if (alpha[c] == 0)
+            continue;
+        x = over[c] * alpha[c] + base[c] * (255 - alpha[c]) + 128;
+        base[c] = (pixel)((x + (x >> 8)) >> 8);     // x / 255, rounded
+    }
+}
+
+/**
+ * @brief halves two rows into one, each pixel the rounded mean of a 2x2
+ *        square; an odd last column is averaged with itself
+ */
+static void halveRowScalar(const pixel* above, const pixel* below,
+    pixel* out, int cols)
+{
+    int c;
+
+    for (c = 0; c + 1 < cols; c += 2)
+        out[c / 2] = (pixel)((above[c] + above[c + 1] + below[c] +
+            below[c + 1] + 2) >> 2);
+
+    if (c < cols)
+        out[c / 2] = (pixel)((above[c] + below[c] + 1) >> 1);
+}
+
+
+#ifdef SIMD_X86
+/******************************************************************************
+ *                          SSE4.2 Kernels
+ *****************************************************************************/
+/**
+ * @brief pshufb masks that gather one channel out of 48 packed bytes
+ */
+alignas(16) static const signed char splitMask[3][3][16] =
+{
+    { { 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+      { -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1 },
+      { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13 } },
+    { { 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+      { -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1 },
+      { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14 } },
+    { { 2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+      { -1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1 },
+      { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15 } }
+};
+
+/**
+ * @brief pshufb masks that place each channel into 48 packed bytes
+ */
+alignas(16) static const signed char mergeMask[3][3][16] =
+{
+    { { 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5 },
+      { -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1 },
+      { -1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1 } },
+    { { -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1 },
+      { 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10 },
+      { -1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1 } },
+    { { -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1 },
+      { -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1 },
+      { 10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15 } }
+};
+
+/**
+ * @brief loads a 16 byte shuffle mask
+ */
+TARGET_SSE42 static inline __m128i loadMask(const signed char* mask)
+{
+    return _mm_load_si128((const __m128i*)mask);
+}
+
+TARGET_SSE42 static void addRowSse42(pixel* row, int cols, int value)
+{
+    __m128i amount = _mm_set1_epi8((char)min(abs(value), 255));
+    __m128i v;
+    int c = 0;
+
+    for (; c + 16 <= cols; c += 16)
+    {
+        v = _mm_loadu_si128((const __m128i*)(row + c));
+        v = value >= 0 ? _mm_adds_epu8(v, amount) : _mm_subs_epu8(v, amount);
+        _mm_storeu_si128((__m128i*)(row + c), v);
+    }
+
+    addRowScalar(row + c, cols - c, value);
+}
+
+TARGET_SSE42 static void negateRowSse42(pixel* row, int cols)
+{
+    __m128i ones = _mm_set1_epi8(-1);
+    __m128i v;
+    int c = 0;
+
+    for (; c + 16 <= cols; c += 16)
+    {
+        v = _mm_loadu_si128((const __m128i*)(row + c));
+        _mm_storeu_si128((__m128i*)(row + c), _mm_xor_si128(v, ones));
+    }
+
+    negateRowScalar(row + c, cols - c);
+}
+
+/**
+ * @brief pshufb mask that swaps the bytes of each 16 bit lane
+ */
+alignas(16) static const signed char swapMask[16] =
+    { 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14 };
+
+TARGET_SSE42 static void swapRowSse42(const sample16* in, sample16* out,
+    int count)
+{
+    __m128i mask = loadMask(swapMask);
+    int i = 0;
+
+    for (; i + 8 <= count; i += 8)
+    {
+        _mm_storeu_si128((__m128i*)(out + i), _mm_shuffle_epi8(
+            _mm_loadu_si128((const __m128i*)(in + i)), mask));
+    }
+
+    swapRowScalar(in + i, out + i, count - i);
+}
+
+TARGET_SSE42 static void addRow16Sse42(sample16* row, int cols, int value,
+    int maxValue)
+{
+    __m128i amount = _mm_set1_epi16((short)min(abs(value), 65535));
+    __m128i largest = _mm_set1_epi16((short)maxValue);
+    __m128i v;
+    int c = 0;
+
+    for (; c + 8 <= cols; c += 8)
+    {
+        v = _mm_loadu_si128((const __m128i*)(row + c));
+        v = value >= 0 ? _mm_adds_epu16(v, amount) : _mm_subs_epu16(v, amount);
+        _mm_storeu_si128((__m128i*)(row + c), _mm_min_epu16(v, largest));
+    }
+
+    addRow16Scalar(row + c, cols - c, value, maxValue);
+}
+
+TARGET_SSE42 static void negateRow16Sse42(sample16* row, int cols,
+    int maxValue)
+{
+    __m128i largest = _mm_set1_epi16((short)maxValue);
+    __m128i v;
+    int c = 0;
+
+    for (; c + 8 <= cols; c += 8)
+    {
+        v = _mm_loadu_si128((const __m128i*)(row + c));
+        _mm_storeu_si128((__m128i*)(row + c), _mm_subs_epu16(largest, v));
+    }
+
+    negateRow16Scalar(row + c, cols - c, maxValue);
+}
+
+/**
+ * @brief widens 8 pixels starting at p to 16 bit lanes
+ */
+TARGET_SSE42 static inline __m128i widen8(const pixel* p)
+{
+    return _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)p));
+}
+
+/**
+ * @brief 3x3 mean of the 8 pixels of row starting at column at
+ */
+TARGET_SSE42 static inline __m128i smooth8(const pixel* above,
+    const pixel* row, const pixel* below, int at)
+{
+    __m128i sum = _mm_setzero_si128();
+    const pixel* src[3] = { above, row, below };
+    int k;
+
+    for (k = 0; k < 3; k++)
+    {
+        sum = _mm_add_epi16(sum, widen8(src[k] + at - 1));
+        sum = _mm_add_epi16(sum, widen8(src[k] + at));
+        sum = _mm_add_epi16(sum, widen8(src[k] + at + 1));
+    }
+
+    // (x * 7282) >> 16 == x / 9 for every sum of nine pixels
+    return _mm_mulhi_epu16(sum, _mm_set1_epi16(7282));
+}
+
+TARGET_SSE42 static void smoothRowSse42(const pixel* above, const pixel* row,
+    const pixel* below, pixel* out, int first, int last)
+{
+    int c = first;
+
+    for (; c + 16 <= last; c += 16)
+    {
+        _mm_storeu_si128((__m128i*)(out + c), _mm_packus_epi16(
+            smooth8(above, row, below, c), smooth8(above, row, below, c + 8)));
+    }
+
+    smoothRowScalar(above, row, below, out, c, last);
+}
+
+/**
+ * @brief 5 point sharpen of the 8 pixels of row starting at column at
+ */
+TARGET_SSE42 static inline __m128i sharpen8(const pixel* above,
+    const pixel* row, const pixel* below, int at)
+{
+    __m128i v = _mm_mullo_epi16(widen8(row + at), _mm_set1_epi16(5));
+
+    v = _mm_sub_epi16(v, widen8(row + at - 1));
+    v = _mm_sub_epi16(v, widen8(row + at + 1));
+    v = _mm_sub_epi16(v, widen8(above + at));
+    return _mm_sub_epi16(v, widen8(below + at));
+}
+
+TARGET_SSE42 static void sharpenRowSse42(const pixel* above, const pixel* row,
+    const pixel* below, pixel* out, int first, int last)
+{
+    int c = first;
+
+    for (; c + 16 <= last; c += 16)
+    {
+        _mm_storeu_si128((__m128i*)(out + c), _mm_packus_epi16(
+            sharpen8(above, row, below, c), sharpen8(above, row, below, c + 8)));
+    }
+
+    sharpenRowScalar(above, row, below, out, c, last);
+}
+
+TARGET_SSE42 static void interleaveRowSse42(const pixel* red,
+    const pixel* green, const pixel* blue, pixel* packed, int cols)
+{
+    __m128i plane[3], v;
+    int c = 0, j, k;
+
+    for (; c + 16 <= cols; c += 16)
+    {
+        plane[0] = _mm_loadu_si128((const __m128i*)(red + c));
+        plane[1] = _mm_loadu_si128((const __m128i*)(green + c));
+        plane[2] = _mm_loadu_si128((const __m128i*)(blue + c));
+        for (j = 0; j < 3; j++)
+        {
+            v = _mm_setzero_si128();
+            for (k = 0; k < 3; k++)
+                v = _mm_or_si128(v,
+                    _mm_shuffle_epi8(plane[k], loadMask(mergeMask[j][k])));
+            _mm_storeu_si128((__m128i*)(packed + 3 * c + 16 * j), v);
+        }
+    }
+
+    interleaveRowScalar(red + c, green + c, blue + c, packed + 3 * c,
+        cols - c);
+}
+
+TARGET_SSE42 static void deinterleaveRowSse42(const pixel* packed,
+    pixel* red, pixel* green, pixel* blue, int cols)
+{
+    __m128i chunk[3], v;
+    pixel* plane[3] = { red, green, blue };
+    int c = 0, j, k;
+
+    for (; c + 16 <= cols; c += 16)
+    {
+        for (j = 0; j < 3; j++)
+            chunk[j] = _mm_loadu_si128((const __m128i*)(packed + 3 * c + 16 * j));
+        for (k = 0; k < 3; k++)
+        {
+            v = _mm_setzero_si128();
+            for (j = 0; j < 3; j++)
+                v = _mm_or_si128(v,
+                    _mm_shuffle_epi8(chunk[j], loadMask(splitMask[k][j])));
+            _mm_storeu_si128((__m128i*)(plane[k] + c), v);
+        }
+    }
+
+    deinterleaveRowScalar(packed + 3 * c, red + c, green + c, blue + c,
+        cols - c);
+}
+
+TARGET_SSE42 static void diffRowSse42(const pixel* first, const pixel* second,
+    pixel* diff, int cols, unsigned long long& sumSquares, int& maxDiff)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i most = zero, sum64 = zero, sum32, d, lo, hi;
+    alignas(16) unsigned long long lanes[2];
+    alignas(16) pixel largest[16];
+    int c = 0, block, k;
+
+    while (c + 16 <= cols)
+    {
+        // 32 bit lanes hold 4096 blocks of squares before they could wrap
+        sum32 = zero;
+        for (block = 0; block < 4096 && c + 16 <= cols; block++, c += 16)
+        {
+            lo = _mm_loadu_si128((const __m128i*)(first + c));
+            hi = _mm_loadu_si128((const __m128i*)(second + c));
+            d = _mm_or_si128(_mm_subs_epu8(lo, hi), _mm_subs_epu8(hi, lo));
+            if (diff != nullptr)
+                _mm_storeu_si128((__m128i*)(diff + c), d);
+            most = _mm_max_epu8(most, d);
+
+            lo = _mm_unpacklo_epi8(d, zero);
+            hi = _mm_unpackhi_epi8(d, zero);
+            sum32 = _mm_add_epi32(sum32, _mm_madd_epi16(lo, lo));
+            sum32 = _mm_add_epi32(sum32, _mm_madd_epi16(hi, hi));
+        }
+        sum64 = _mm_add_epi64(sum64, _mm_unpacklo_epi32(sum32, zero));
+        sum64 = _mm_add_epi64(sum64, _mm_unpackhi_epi32(sum32, zero));
+    }
+
+    _mm_store_si128((__m128i*)lanes, sum64);
+    _mm_store_si128((__m128i*)largest, most);
+    sumSquares += lanes[0] + lanes[1];
+    for (k = 0; k < 16; k++)
+        maxDiff = max(maxDiff, (int)largest[k]);
+
+    diffRowScalar(first + c, second + c, diff == nullptr ? nullptr : diff + c,
+        cols - c, sumSquares, maxDiff);
+}
+
+TARGET_SSE42 static void minRowSse42(const pixel* first, const pixel* second,
+    pixel* out, int cols)
+{
+    int c = 0;
+
+    for (; c + 16 <= cols; c += 16)
+    {
+        _mm_storeu_si128((__m128i*)(out + c), _mm_min_epu8(
+            _mm_loadu_si128((const __m128i*)(first + c)),
+            _mm_loadu_si128((const __m128i*)(second + c))));
+    }
+
+    minRowScalar(first + c, second + c, out + c, cols - c);
+}
+
+TARGET_SSE42 static void maxRowSse42(const pixel* first, const pixel* second,
+    pixel* out, int cols)
+{
+    int c = 0;
+
+    for (; c + 16 <= cols; c += 16)
+    {
+        _mm_storeu_si128((__m128i*)(out + c), _mm_max_epu8(
+            _mm_loadu_si128((const __m128i*)(first + c)),
+            _mm_loadu_si128((const __m128i*)(second + c))));
+    }
+
+    maxRowScalar(first + c, second + c, out + c, cols - c);
+}
+
+TARGET_SSE42 static void lumaRowSse42(const pixel* red, const pixel* green,
+    const pixel* blue, short* gray, int cols)
+{
+    __m128i sum;
+    int c = 0;
+
+    for (; c + 8 <= cols; c += 8)
+    {
+        sum = _mm_add_epi16(_mm_mullo_epi16(widen8(red + c), _mm_set1_epi16(3)),
+            _mm_mullo_epi16(widen8(green + c), _mm_set1_epi16(6)));
+        sum = _mm_add_epi16(sum, _mm_add_epi16(widen8(blue + c),
+            _mm_set1_epi16(5)));
+        // (x * 6554) >> 16 == x / 10 for every sum up to 2555
+        _mm_storeu_si128((__m128i*)(gray + c),
+            _mm_mulhi_epu16(sum, _mm_set1_epi16(6554)));
+    }
+
+    lumaRowScalar(red + c, green + c, blue + c, gray + c, cols - c);
+}
+
+TARGET_SSE42 static void gradientRowSse42(const short* above,
+    const short* row, const short* below, pixel* out, int cols, int side,
+    int center, int shift, bool l2)
+{
+    __m128i sides = _mm_set1_epi16((short)side);
+    __m128i centers = _mm_set1_epi16((short)center);
+    __m128i count = _mm_cvtsi32_si128(shift);
+    __m128i a0, a1, a2, m0, m2, b0, b1, b2, gx, gy, magnitude;
+    int c = 0;
+
+    for (; c + 8 <= cols; c += 8)
+    {
+        a0 = _mm_loadu_si128((const __m128i*)(above + c));
+        a1 = _mm_loadu_si128((const __m128i*)(above + c + 1));
+        a2 = _mm_loadu_si128((const __m128i*)(above + c + 2));
+        m0 = _mm_loadu_si128((const __m128i*)(row + c));
+        m2 = _mm_loadu_si128((const __m128i*)(row + c + 2));
+        b0 = _mm_loadu_si128((const __m128i*)(below + c));
+        b1 = _mm_loadu_si128((const __m128i*)(below + c + 1));
+        b2 = _mm_loadu_si128((const __m128i*)(below + c + 2));
+
+        gx = _mm_add_epi16(_mm_mullo_epi16(sides, _mm_add_epi16(
+            _mm_sub_epi16(a2, a0), _mm_sub_epi16(b2, b0))),
+            _mm_mullo_epi16(centers, _mm_sub_epi16(m2, m0)));
+        gy = _mm_add_epi16(_mm_mullo_epi16(sides, _mm_add_epi16(
+            _mm_sub_epi16(b0, a0), _mm_sub_epi16(b2, a2))),
+            _mm_mullo_epi16(centers, _mm_sub_epi16(b1, a1)));
+        gx = _mm_abs_epi16(gx);
+        gy = _mm_abs_epi16(gy);
+
+        if (l2)
+            magnitude = _mm_add_epi16(
+                _mm_mulhrs_epi16(_mm_max_epi16(gx, gy), _mm_set1_epi16(31488)),
+                _mm_mulhrs_epi16(_mm_min_epi16(gx, gy), _mm_set1_epi16(13056)));
+        else
+            magnitude = _mm_add_epi16(gx, gy);
+
+        magnitude = _mm_srl_epi16(magnitude, count);
+        _mm_storel_epi64((__m128i*)(out + c),
+            _mm_packus_epi16(magnitude, magnitude));
+    }
+
+    gradientRowScalar(above + c, row + c, below + c, out + c, cols - c, side,
+        center, shift, l2);
+}
+
+TARGET_SSE42 static void medianRowSse42(const pixel* const* window,
+    pixel* out, int radius, int first, int last)
+{
+    const medianNetwork& net = medianNetworkFor(radius);
+    int side = 2 * radius + 1;
+    __m128i v[25], lo;
+    int c = first, y, x, i;
+
+    for (; c + 16 <= last; c += 16)
+    {
+        for (y = 0; y < side; y++)
+            for (x = 0; x < side; x++)
+                v[y * side + x] = _mm_loadu_si128(
+                    (const __m128i*)(window[y] + c + x));
+
+        for (i = 0; i < net.count; i++)
+        {
+            lo = _mm_min_epu8(v[net.low[i]], v[net.high[i]]);
+            v[net.high[i]] = _mm_max_epu8(v[net.low[i]], v[net.high[i]]);
+            v[net.low[i]] = lo;
+        }
+
+        _mm_storeu_si128((__m128i*)(out + c), v[net.size / 2]);
+    }
+
+    medianRowScalar(window, out, radius, c, last);
+}
+
+/**
+ * @brief the blend of overRowScalar on 8 pixels widened to 16 bit lanes
+ */
+TARGET_SSE42 static inline __m128i overLanesSse42(__m128i over, __m128i alpha,
+    __m128i base)
+{
+    __m128i x = _mm_add_epi16(_mm_mullo_epi16(over, alpha), _mm_mullo_epi16(
+        base, _mm_sub_epi16(_mm_set1_epi16(255), alpha)));
+
+    x = _mm_add_epi16(x, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+TARGET_SSE42 static void overRowSse42(const pixel* over, const pixel* alpha,
+    pixel* base, int cols)
+{
+    __m128i zero = _mm_setzero_si128(), opaque = _mm_set1_epi8(-1);
+    __m128i a, o, b, lo, hi;
+    int c = 0;
+
+    for (; c + 16 <= cols; c += 16)
+    {
+        a = _mm_loadu_si128((const __m128i*)(alpha + c));
+        if (_mm_testz_si128(a, a))              // transparent, skip it
+            continue;
+
+        o = _mm_loadu_si128((const __m128i*)(over + c));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(a, opaque)) == 0xffff)
+        {
+            _mm_storeu_si128((__m128i*)(base + c), o);      // opaque, copy
+            continue;
+        }
+
+        b = _mm_loadu_si128((const __m128i*)(base + c));
+        lo = overLanesSse42(_mm_unpacklo_epi8(o, zero),
+            _mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+        hi = overLanesSse42(_mm_unpackhi_epi8(o, zero),
+            _mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+        _mm_storeu_si128((__m128i*)(base + c), _mm_packus_epi16(lo, hi));
+    }
+
+    overRowScalar(over + c, alpha + c, base + c, cols - c);
+}
+
+TARGET_SSE42 static void halveRowSse42(const pixel* above, const pixel* below,
+    pixel* out, int cols)
+{
+    __m128i ones = _mm_set1_epi8(1), two = _mm_set1_epi16(2), lo, hi;
+    int c = 0;
+
+    for (; c + 32 <= cols; c += 32)
+    {
+        // maddubs adds each pair of neighbors into a 16 bit lane
+        lo = _mm_add_epi16(_mm_maddubs_epi16(_mm_loadu_si128(
+            (const __m128i*)(above + c)), ones), _mm_maddubs_epi16(
+            _mm_loadu_si128((const __m128i*)(below + c)), ones));
+        hi = _mm_add_epi16(_mm_maddubs_epi16(_mm_loadu_si128(
+            (const __m128i*)(above + c + 16)), ones), _mm_maddubs_epi16(
+            _mm_loadu_si128((const __m128i*)(below + c + 16)), ones));
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, two), 2);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, two), 2);
+        _mm_storeu_si128((__m128i*)(out + c / 2), _mm_packus_epi16(lo, hi));
+    }
+
+    halveRowScalar(above + c, below + c, out + c / 2, cols - c);
+}
+
+
+/******************************************************************************
+ *                          AVX2 Kernels
+ *****************************************************************************/
+TARGET_AVX2 static void addRowAvx2(pixel* row, int cols, int value)
+{
+    __m256i amount = _mm256_set1_epi8((char)min(abs(value), 255));
+    __m256i v;
+    int c = 0;
+
+    for (; c + 32 <= cols; c += 32)
+    {
+        v = _mm256_loadu_si256((const __m256i*)(row + c));
+        v = value >= 0 ? _mm256_adds_epu8(v, amount) :
+            _mm256_subs_epu8(v, amount);
+        _mm256_storeu_si256((__m256i*)(row + c), v);
+    }
+
+    addRowScalar(row + c, cols - c, value);
+}
+
+TARGET_AVX2 static void negateRowAvx2(pixel* row, int cols)
+{
+    __m256i ones = _mm256_set1_epi8(-1);
+    __m256i v;
+    int c = 0;
+
+    for (; c + 32 <= cols; c += 32)
+    {
+        v = _mm256_loadu_si256((const __m256i*)(row + c));
+        _mm256_storeu_si256((__m256i*)(row + c), _mm256_xor_si256(v, ones));
+    }
+
+    negateRowScalar(row + c, cols - c);
+}
+
+TARGET_AVX2 static void swapRowAvx2(const sample16* in, sample16* out,
+    int count)
+{
+    __m256i mask = _mm256_broadcastsi128_si256(loadMask(swapMask));
+    int i = 0;
+
+    for (; i + 16 <= count; i += 16)
+    {
+        _mm256_storeu_si256((__m256i*)(out + i), _mm256_shuffle_epi8(
+            _mm256_loadu_si256((const __m256i*)(in + i)), mask));
+    }
+
+    swapRowScalar(in + i, out + i, count - i);
+}
+
+TARGET_AVX2 static void addRow16Avx2(sample16* row, int cols, int value,
+    int maxValue)
+{
+    __m256i amount = _mm256_set1_epi16((short)min(abs(value), 65535));
+    __m256i largest = _mm256_set1_epi16((short)maxValue);
+    __m256i v;
+    int c = 0;
+
+    for (; c + 16 <= cols; c += 16)
+    {
+        v = _mm256_loadu_si256((const __m256i*)(row + c));
+        v = value >= 0 ? _mm256_adds_epu16(v, amount) :
+            _mm256_subs_epu16(v, amount);
+        _mm256_storeu_si256((__m256i*)(row + c), _mm256_min_epu16(v, largest));
+    }
+
+    addRow16Scalar(row + c, cols - c, value, maxValue);
+}
+
+TARGET_AVX2 static void negateRow16Avx2(sample16* row, int cols, int maxValue)
+{
+    __m256i largest = _mm256_set1_epi16((short)maxValue);
+    __m256i v;
+    int c = 0;
+
+    for (; c + 16 <= cols; c += 16)
+    {
+        v = _mm256_loadu_si256((const __m256i*)(row + c));
+        _mm256_storeu_si256((__m256i*)(row + c), _mm256_subs_epu16(largest, v));
+    }
+
+    negateRow16Scalar(row + c, cols - c, maxValue);
+}
+
+/**
+ * @brief widens 16 pixels starting at p to 16 bit lanes
+ */
+TARGET_AVX2 static inline __m256i widen16(const pixel* p)
+{
+    return _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)p));
+}
+
+/**
+ * @brief saturates 16 signed 16 bit lanes to bytes, keeping their order
+ */
+TARGET_AVX2 static inline __m128i narrow16(__m256i v)
+{
+    return _mm_packus_epi16(_mm256_castsi256_si128(v),
+        _mm256_extracti128_si256(v, 1));
+}
+
+TARGET_AVX2 static void smoothRowAvx2(const pixel* above, const pixel* row,
+    const pixel* below, pixel* out, int first, int last)
+{
+    __m256i sum;
+    __m256i ninth = _mm256_set1_epi16(7282);    // (x * 7282) >> 16 == x / 9
+    const pixel* src[3] = { above, row, below };
+    int c = first, k;
+
+    for (; c + 16 <= last; c += 16)
+    {
+        sum = _mm256_setzero_si256();
+        for (k = 0; k < 3; k++)
+        {
+            sum = _mm256_add_epi16(sum, widen16(src[k] + c - 1));
+            sum = _mm256_add_epi16(sum, widen16(src[k] + c));
+            sum = _mm256_add_epi16(sum, widen16(src[k] + c + 1));
+        }
+        sum = _mm256_mulhi_epu16(sum, ninth);
+        _mm_storeu_si128((__m128i*)(out + c), narrow16(sum));
+    }
+
+    smoothRowScalar(above, row, below, out, c, last);
+}
+
+TARGET_AVX2 static void sharpenRowAvx2(const pixel* above, const pixel* row,
+    const pixel* below, pixel* out, int first, int last)
+{
+    __m256i v;
+    int c = first;
+
+    for (; c + 16 <= last; c += 16)
+    {
+        v = _mm256_mullo_epi16(widen16(row + c), _mm256_set1_epi16(5));
+        v = _mm256_sub_epi16(v, widen16(row + c - 1));
+        v = _mm256_sub_epi16(v, widen16(row + c + 1));
+        v = _mm256_sub_epi16(v, widen16(above + c));
+        v = _mm256_sub_epi16(v, widen16(below + c));
+        _mm_storeu_si128((__m128i*)(out + c), narrow16(v));
+    }
+
+    sharpenRowScalar(above, row, below, out, c, last);
+}
+
+TARGET_AVX2 static void diffRowAvx2(const pixel* first, const pixel* second,
+    pixel* diff, int cols, unsigned long long& sumSquares, int& maxDiff)
+{
+    __m256i zero = _mm256_setzero_si256();
+    __m256i most = zero, sum64 = zero, sum32, d, lo, hi;
+    alignas(32) unsigned long long lanes[4];
+    alignas(32) pixel largest[32];
+    int c = 0, block, k;
+
+    while (c + 32 <= cols)
+    {
+        // 32 bit lanes hold 4096 blocks of squares before they could wrap
+        sum32 = zero;
+        for (block = 0; block < 4096 && c + 32 <= cols; block++, c += 32)
+        {
+            lo = _mm256_loadu_si256((const __m256i*)(first + c));
+            hi = _mm256_loadu_si256((const __m256i*)(second + c));
+            d = _mm256_or_si256(_mm256_subs_epu8(lo, hi),
+                _mm256_subs_epu8(hi, lo));
+            if (diff != nullptr)
+                _mm256_storeu_si256((__m256i*)(diff + c), d);
+            most = _mm256_max_epu8(most, d);
+
+            lo = _mm256_unpacklo_epi8(d, zero);
+            hi = _mm256_unpackhi_epi8(d, zero);
+            sum32 = _mm256_add_epi32(sum32, _mm256_madd_epi16(lo, lo));
+            sum32 = _mm256_add_epi32(sum32, _mm256_madd_epi16(hi, hi));
+        }
+        sum64 = _mm256_add_epi64(sum64, _mm256_unpacklo_epi32(sum32, zero));
+        sum64 = _mm256_add_epi64(sum64, _mm256_unpackhi_epi32(sum32, zero));
+    }
+
+    _mm256_store_si256((__m256i*)lanes, sum64);
+    _mm256_store_si256((__m256i*)largest, most);
+    sumSquares += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    for (k = 0; k < 32; k++)
+        maxDiff = max(maxDiff, (int)largest[k]);
+
+    diffRowSse42(first + c, second + c, diff == nullptr ? nullptr : diff + c,
+        cols - c, sumSquares, maxDiff);
+}
+
+TARGET_AVX2 static void minRowAvx2(const pixel* first, const pixel* second,
+    pixel* out, int cols)
+{
+    int c = 0;
+
+    for (; c + 32 <= cols; c += 32)
+    {
+        _mm256_storeu_si256((__m256i*)(out + c), _mm256_min_epu8(
+            _mm256_loadu_si256((const __m256i*)(first + c)),
+            _mm256_loadu_si256((const __m256i*)(second + c))));
+    }
+
+    minRowScalar(first + c, second + c, out + c, cols - c);
+}
+
+TARGET_AVX2 static void maxRowAvx2(const pixel* first, const pixel* second,
+    pixel* out, int cols)
+{
+    int c = 0;
+
+    for (; c + 32 <= cols; c += 32)
+    {
+        _mm256_storeu_si256((__m256i*)(out + c), _mm256_max_epu8(
+            _mm256_loadu_si256((const __m256i*)(first + c)),
+            _mm256_loadu_si256((const __m256i*)(second + c))));
+    }
+
+    maxRowScalar(first + c, second + c, out + c, cols - c);
+}
+
+TARGET_AVX2 static void lumaRowAvx2(const pixel* red, const pixel* green,
+    const pixel* blue, short* gray, int cols)
+{
+    __m256i sum;
+    int c = 0;
+
+    for (; c + 16 <= cols; c += 16)
+    {
+        sum = _mm256_add_epi16(
+            _mm256_mullo_epi16(widen16(red + c), _mm256_set1_epi16(3)),
+            _mm256_mullo_epi16(widen16(green + c), _mm256_set1_epi16(6)));
+        sum = _mm256_add_epi16(sum, _mm256_add_epi16(widen16(blue + c),
+            _mm256_set1_epi16(5)));
+        _mm256_storeu_si256((__m256i*)(gray + c),
+            _mm256_mulhi_epu16(sum, _mm256_set1_epi16(6554)));
+    }
+
+    lumaRowScalar(red + c, green + c, blue + c, gray + c, cols - c);
+}
+
+TARGET_AVX2 static void gradientRowAvx2(const short* above,
+    const short* row, const short* below, pixel* out, int cols, int side,
+    int center, int shift, bool l2)
+{
+    __m256i sides = _mm256_set1_epi16((short)side);
+    __m256i centers = _mm256_set1_epi16((short)center);
+    __m128i count = _mm_cvtsi32_si128(shift);
+    __m256i a0, a1, a2, m0, m2, b0, b1, b2, gx, gy, magnitude;
+    int c = 0;
+
+    for (; c + 16 <= cols; c += 16)
+    {
+        a0 = _mm256_loadu_si256((const __m256i*)(above + c));
+        a1 = _mm256_loadu_si256((const __m256i*)(above + c + 1));
+        a2 = _mm256_loadu_si256((const __m256i*)(above + c + 2));
+        m0 = _mm256_loadu_si256((const __m256i*)(row + c));
+        m2 = _mm256_loadu_si256((const __m256i*)(row + c + 2));
+        b0 = _mm256_loadu_si256((const __m256i*)(below + c));
+        b1 = _mm256_loadu_si256((const __m256i*)(below + c + 1));
+        b2 = _mm256_loadu_si256((const __m256i*)(below + c + 2));
+
+        gx = _mm256_add_epi16(_mm256_mullo_epi16(sides, _mm256_add_epi16(
+            _mm256_sub_epi16(a2, a0), _mm256_sub_epi16(b2, b0))),
+            _mm256_mullo_epi16(centers, _mm256_sub_epi16(m2, m0)));
+        gy = _mm256_add_epi16(_mm256_mullo_epi16(sides, _mm256_add_epi16(
+            _mm256_sub_epi16(b0, a0), _mm256_sub_epi16(b2, a2))),
+            _mm256_mullo_epi16(centers, _mm256_sub_epi16(b1, a1)));
+        gx = _mm256_abs_epi16(gx);
+        gy = _mm256_abs_epi16(gy);
+
+        if (l2)
+            magnitude = _mm256_add_epi16(_mm256_mulhrs_epi16(
+                _mm256_max_epi16(gx, gy), _mm256_set1_epi16(31488)),
+                _mm256_mulhrs_epi16(_mm256_min_epi16(gx, gy),
+                _mm256_set1_epi16(13056)));
+        else
+            magnitude = _mm256_add_epi16(gx, gy);
+
+        magnitude = _mm256_srl_epi16(magnitude, count);
+        _mm_storeu_si128((__m128i*)(out + c), narrow16(magnitude));
+    }
+
+    gradientRowScalar(above + c, row + c, below + c, out + c, cols - c, side,
+        center, shift, l2);
+}
+
+TARGET_AVX2 static void medianRowAvx2(const pixel* const* window,
+    pixel* out, int radius, int first, int last)
+{
+    const medianNetwork& net = medianNetworkFor(radius);
+    int side = 2 * radius + 1;
+    __m256i v[25], lo;
+    int c = first, y, x, i;
+
+    for (; c + 32 <= last; c += 32)
+    {
+        for (y = 0; y < side; y++)
+            for (x = 0; x < side; x++)
+                v[y * side + x] = _mm256_loadu_si256(
+                    (const __m256i*)(window[y] + c + x));
+
+        for (i = 0; i < net.count; i++)
+        {
+            lo = _mm256_min_epu8(v[net.low[i]], v[net.high[i]]);
+            v[net.high[i]] = _mm256_max_epu8(v[net.low[i]], v[net.high[i]]);
+            v[net.low[i]] = lo;
+        }
+
+        _mm256_storeu_si256((__m256i*)(out + c), v[net.size / 2]);
+    }
+
+    medianRowScalar(window, out, radius, c, last);
+}
+
+/**
+ * @brief the blend of overRowScalar on 16 pixels widened to 16 bit lanes
+ */
+TARGET_AVX2 static inline __m256i overLanesAvx2(__m256i over, __m256i alpha,
+    __m256i base)
+{
+    __m256i x = _mm256_add_epi16(_mm256_mullo_epi16(over, alpha),
+        _mm256_mullo_epi16(base, _mm256_sub_epi16(_mm256_set1_epi16(255),
+        alpha)));
+
+    x = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+}
+
+TARGET_AVX2 static void overRowAvx2(const pixel* over, const pixel* alpha,
+    pixel* base, int cols)
+{
+    __m256i zero = _mm256_setzero_si256(), opaque = _mm256_set1_epi8(-1);
+    __m256i a, o, b, lo, hi;
+    int c = 0;
+
+    for (; c + 32 <= cols; c += 32)
+    {
+        a = _mm256_loadu_si256((const __m256i*)(alpha + c));
+        if (_mm256_testz_si256(a, a))           // transparent, skip it
+            continue;
+
+        o = _mm256_loadu_si256((const __m256i*)(over + c));
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, opaque)) == -1)
+        {
+            _mm256_storeu_si256((__m256i*)(base + c), o);   // opaque, copy
+            continue;
+        }
+
+        // unpack and pack both work within 128 bit lanes, so they undo
+        // each other and the pixels come back in order
+        b = _mm256_loadu_si256((const __m256i*)(base + c));
+        lo = overLanesAvx2(_mm256_unpacklo_epi8(o, zero),
+            _mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero));
+        hi = overLanesAvx2(_mm256_unpackhi_epi8(o, zero),
+            _mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero));
+        _mm256_storeu_si256((__m256i*)(base + c), _mm256_packus_epi16(lo, hi));
+    }
+
+    overRowSse42(over + c, alpha + c, base + c, cols - c);
+}
+
+TARGET_AVX2 static void halveRowAvx2(const pixel* above, const pixel* below,
+    pixel* out, int cols)
+{
+    __m256i ones = _mm256_set1_epi8(1), two = _mm256_set1_epi16(2), lo, hi;
+    int c = 0;
+
+    for (; c + 64 <= cols; c += 64)
+    {
+        lo = _mm256_add_epi16(_mm256_maddubs_epi16(_mm256_loadu_si256(
+            (const __m256i*)(above + c)), ones), _mm256_maddubs_epi16(
+            _mm256_loadu_si256((const __m256i*)(below + c)), ones));
+        hi = _mm256_add_epi16(_mm256_maddubs_epi16(_mm256_loadu_si256(
+            (const __m256i*)(above + c + 32)), ones), _mm256_maddubs_epi16(
+            _mm256_loadu_si256((const __m256i*)(below + c + 32)), ones));
+        lo = _mm256_srli_epi16(_mm256_add_epi16(lo, two), 2);
+        hi = _mm256_srli_epi16(_mm256_add_epi16(hi, two), 2);
+
+        // pack works within 128 bit lanes, the permute puts them in order
+        _mm256_storeu_si256((__m256i*)(out + c / 2), _mm256_permute4x64_epi64(
+            _mm256_packus_epi16(lo, hi), 0xd8));
+    }
+
+    halveRowSse42(above + c, below + c, out + c / 2, cols - c);
+}
+
+
+/******************************************************************************
+ *                          AVX-512 Kernels
+ *****************************************************************************/
+TARGET_AVX512 static void addRowAvx512(pixel* row, int cols, int value)
+{
+    __m512i amount = _mm512_set1_epi8((char)min(abs(value), 255));
+    __m512i v;
+    int c = 0;
+
+    for (; c + 64 <= cols; c += 64)
+    {
+        v = _mm512_loadu_si512((const void*)(row + c));
+        v = value >= 0 ? _mm512_adds_epu8(v, amount) :
+            _mm512_subs_epu8(v, amount);
+        _mm512_storeu_si512((void*)(row + c), v);
+    }
+
+    addRowScalar(row + c, cols - c, value);
+}
+
+TARGET_AVX512 static void negateRowAvx512(pixel* row, int cols)
+{
+    __m512i ones = _mm512_set1_epi8(-1);
+    __m512i v;
+    int c = 0;
+
+    for (; c + 64 <= cols; c += 64)
+    {
+        v = _mm512_loadu_si512((const void*)(row + c));
+        _mm512_storeu_si512((void*)(row + c), _mm512_xor_si512(v, ones));
+    }
+
+    negateRowScalar(row + c, cols - c);
+}
+
+TARGET_AVX512 static void swapRowAvx512(const sample16* in, sample16* out,
+    int count)
+{
+    __m512i v;
+    int i = 0;
+
+    for (; i + 32 <= count; i += 32)    // shifts need no shuffle mask
+    {
+        v = _mm512_loadu_si512((const void*)(in + i));
+        _mm512_storeu_si512((void*)(out + i), _mm512_or_si512(
+            _mm512_slli_epi16(v, 8), _mm512_srli_epi16(v, 8)));
+    }
+
+    swapRowScalar(in + i, out + i, count - i);
+}
+
+TARGET_AVX512 static void addRow16Avx512(sample16* row, int cols, int value,
+    int maxValue)
+{
+    __m512i amount = _mm512_set1_epi16((short)min(abs(value), 65535));
+    __m512i largest = _mm512_set1_epi16((short)maxValue);
+    __m512i v;
+    int c = 0;
+
+    for (; c + 32 <= cols; c += 32)
+    {
+        v = _mm512_loadu_si512((const void*)(row + c));
+        v = value >= 0 ? _mm512_adds_epu16(v, amount) :
+            _mm512_subs_epu16(v, amount);
+        _mm512_storeu_si512((void*)(row + c), _mm512_min_epu16(v, largest));
+    }
+
+    addRow16Scalar(row + c, cols - c, value, maxValue);
+}
+
+TARGET_AVX512 static void negateRow16Avx512(sample16* row, int cols,
+    int maxValue)
+{
+    __m512i largest = _mm512_set1_epi16((short)maxValue);
+    __m512i v;
+    int c = 0;
+
+    for (; c + 32 <= cols; c += 32)
+    {
+        v = _mm512_loadu_si512((const void*)(row + c));
+        _mm512_storeu_si512((void*)(row + c), _mm512_subs_epu16(largest, v));
+    }
+
+    negateRow16Scalar(row + c, cols - c, maxValue);
+}
+
+TARGET_AVX512 static void minRowAvx512(const pixel* first,
+    const pixel* second, pixel* out, int cols)
+{
+    int c = 0;
+
+    for (; c + 64 <= cols; c += 64)
+    {
+        _mm512_storeu_si512((void*)(out + c), _mm512_min_epu8(
+            _mm512_loadu_si512((const void*)(first + c)),
+            _mm512_loadu_si512((const void*)(second + c))));
+    }
+
+    minRowScalar(first + c, second + c, out + c, cols - c);
+}
+
+TARGET_AVX512 static void maxRowAvx512(const pixel* first,
+    const pixel* second, pixel* out, int cols)
+{
+    int c = 0;
+
+    for (; c + 64 <= cols; c += 64)
+    {
+        _mm512_storeu_si512((void*)(out + c), _mm512_max_epu8(
+            _mm512_loadu_si512((const void*)(first + c)),
+            _mm512_loadu_si512((const void*)(second + c))));
+    }
+
+    maxRowScalar(first + c, second + c, out + c, cols - c);
+}
+
+TARGET_AVX512 static void medianRowAvx512(const pixel* const* window,
+    pixel* out, int radius, int first, int last)
+{
+    const medianNetwork& net = medianNetworkFor(radius);
+    int side = 2 * radius + 1;
+    __m512i v[25], lo;
+    int c = first, y, x, i;
+
+    for (; c + 64 <= last; c += 64)
+    {
+        for (y = 0; y < side; y++)
+            for (x = 0; x < side; x++)
+                v[y * side + x] = _mm512_loadu_si512(
+                    (const void*)(window[y] + c + x));
+
+        for (i = 0; i < net.count; i++)
+        {
+            lo = _mm512_min_epu8(v[net.low[i]], v[net.high[i]]);
+            v[net.high[i]] = _mm512_max_epu8(v[net.low[i]], v[net.high[i]]);
+            v[net.low[i]] = lo;
+        }
+
+        _mm512_storeu_si512((void*)(out + c), v[net.size / 2]);
+    }
+
+    medianRowScalar(window, out, radius, c, last);
+}
+
+/**
+ * @brief the blend of overRowScalar on 32 pixels widened to 16 bit lanes
+ */
+TARGET_AVX512 static inline __m512i overLanesAvx512(__m512i over,
+    __m512i alpha, __m512i base)
+{
+    __m512i x = _mm512_add_epi16(_mm512_mullo_epi16(over, alpha),
+        _mm512_mullo_epi16(base, _mm512_sub_epi16(_mm512_set1_epi16(255),
+        alpha)));
+
+    x = _mm512_add_epi16(x, _mm512_set1_epi16(128));
+    return _mm512_srli_epi16(_mm512_add_epi16(x, _mm512_srli_epi16(x, 8)), 8);
+}
+
+TARGET_AVX512 static void overRowAvx512(const pixel* over, const pixel* alpha,
+    pixel* base, int cols)
+{
+    __m512i zero = _mm512_setzero_si512(), opaque = _mm512_set1_epi8(-1);
+    __m512i a, o, b, lo, hi;
+    int c = 0;
+
+    for (; c + 64 <= cols; c += 64)
+    {
+        a = _mm512_loadu_si512((const void*)(alpha + c));
+        if (_mm512_test_epi8_mask(a, a) == 0)   // transparent, skip it
+            continue;
+
+        o = _mm512_loadu_si512((const void*)(over + c));
+        if (_mm512_cmpeq_epi8_mask(a, opaque) == ~0ULL)
+        {
+            _mm512_storeu_si512((void*)(base + c), o);      // opaque, copy
+            continue;
+        }
+
+        b = _mm512_loadu_si512((const void*)(base + c));
+        lo = overLanesAvx512(_mm512_unpacklo_epi8(o, zero),
+            _mm512_unpacklo_epi8(a, zero), _mm512_unpacklo_epi8(b, zero));
+        hi = overLanesAvx512(_mm512_unpackhi_epi8(o, zero),
+            _mm512_unpackhi_epi8(a, zero), _mm512_unpackhi_epi8(b, zero));
+        _mm512_storeu_si512((void*)(base + c), _mm512_packus_epi16(lo, hi));
+    }
+
+    overRowAvx2(over + c, alpha + c, base + c, cols - c);
+}
+
+TARGET_AVX512 static void halveRowAvx512(const pixel* above,
+    const pixel* below, pixel* out, int cols)
+{
+    __m512i ones = _mm512_set1_epi8(1), two = _mm512_set1_epi16(2), lo, hi;
+    __m512i order = _mm512_setr_epi64(0, 2, 4, 6, 1, 3, 5, 7);
+    int c = 0;
+
+    for (; c + 128 <= cols; c += 128)
+    {
+        lo = _mm512_add_epi16(_mm512_maddubs_epi16(_mm512_loadu_si512(
+            (const void*)(above + c)), ones), _mm512_maddubs_epi16(
+            _mm512_loadu_si512((const void*)(below + c)), ones));
+        hi = _mm512_add_epi16(_mm512_maddubs_epi16(_mm512_loadu_si512(
+            (const void*)(above + c + 64)), ones), _mm512_maddubs_epi16(
+            _mm512_loadu_si512((const void*)(below + c + 64)), ones));
+        lo = _mm512_srli_epi16(_mm512_add_epi16(lo, two), 2);
+        hi = _mm512_srli_epi16(_mm512_add_epi16(hi, two), 2);
+        _mm512_storeu_si512((void*)(out + c / 2),
+            _mm512_maskz_permutexvar_epi64(0xff, order,
+            _mm512_packus_epi16(lo, hi)));
+    }
+
+    halveRowAvx2(above + c, below + c, out + c / 2, cols - c);
+}
+#endif
+
+
+/******************************************************************************
+ *                          Dispatch
+ *****************************************************************************/
+/**
+ * @brief the kernels in use, the best level is picked before main runs
+ */
+kernelTable kernels = kernelsFor(detectIsa());
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Asks the processor, through cpuid, which instruction sets it supports and
+ * returns the widest one the kernels have a version for. The AVX levels also
+ * check through xgetbv that the operating system saves the wide registers.
+ *
+ * @returns the best instruction set level of this processor
+ *
+ * @par Example:
+   @verbatim
+   isaLevel level = detectIsa();
+   @endverbatim
+ *
+ *****************************************************************************/
+isaLevel detectIsa()
+{
+#ifdef SIMD_X86
+    unsigned int leaf1[4] = { 0 }, leaf7[4] = { 0 };
+    unsigned long long xcr0 = 0;
+    bool sse42, osAvx, osAvx512;
+
+#ifdef _MSC_VER
+    __cpuid((int*)leaf1, 1);
+    __cpuidex((int*)leaf7, 7, 0);
+    if (leaf1[2] & (1u << 27))  // OSXSAVE
+        xcr0 = _xgetbv(0);
+#else
+    unsigned int eax, edx;
+    __get_cpuid(1, &leaf1[0], &leaf1[1], &leaf1[2], &leaf1[3]);
+    __get_cpuid_count(7, 0, &leaf7[0], &leaf7[1], &leaf7[2], &leaf7[3]);
+    if (leaf1[2] & (1u << 27))  // OSXSAVE
+    {
+        __asm__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+        xcr0 = ((unsigned long long)edx << 32) | eax;
+    }
+#endif
+
+    sse42 = (leaf1[2] & (1u << 20)) && (leaf1[2] & (1u << 9));  // SSE4.2, SSSE3
+    osAvx = (xcr0 & 0x06) == 0x06;          // XMM and YMM state
+    osAvx512 = (xcr0 & 0xe6) == 0xe6;       // and the opmask and ZMM state
+
+    if (osAvx512 && (leaf7[1] & (1u << 16)) && (leaf7[1] & (1u << 30)))
+        return ISA_AVX512;                  // AVX512F and AVX512BW
+    if (osAvx && (leaf7[1] & (1u << 5)))
+        return ISA_AVX2;
+    if (sse42)
+        return ISA_SSE42;
+#endif
+    return ISA_SCALAR;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Converts an instruction set name given with --isa to its level.
+ *
+ * @param[in] name - scalar, sse4.2, avx2 or avx512
+ * @param[out] level - the matching level
+ *
+ * @returns true if the name is known, false otherwise
+ *
+ * @par Example:
+   @verbatim
+   isaFromName("avx2", level);
+   @endverbatim
+ *
+ *****************************************************************************/
+bool isaFromName(string name, isaLevel& level)
+{
+    if (name == "scalar")
+        level = ISA_SCALAR;
+    else if (name == "sse4.2" || name == "sse42")
+        level = ISA_SSE42;
+    else if (name == "avx2")
+        level = ISA_AVX2;
+    else if (name == "avx512")
+        level = ISA_AVX512;
+    else
+        return false;
+
+    return true;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Builds the kernel table for an instruction set level. The table starts
+ * with the scalar kernels and each level up to the requested one replaces
+ * the kernels it has a version of.
+ *
+ * @param[in] level - the instruction set level to use
+ *
+ * @returns the table of kernels for that level
+ *
+ * @par Example:
+   @verbatim
+   kernels = kernelsFor(ISA_SSE42);
+   @endverbatim
+ *
+ *****************************************************************************/
+kernelTable kernelsFor(isaLevel level)
+{
+    kernelTable table;
+
+    table.level = ISA_SCALAR;
+    table.addRow = addRowScalar;
+    table.negateRow = negateRowScalar;
+    table.smoothRow = smoothRowScalar;
+    table.sharpenRow = sharpenRowScalar;
+    table.interleaveRow = interleaveRowScalar;
+    table.deinterleaveRow = deinterleaveRowScalar;
+    table.diffRow = diffRowScalar;
+    table.medianRow = medianRowScalar;
+    table.minRow = minRowScalar;
+    table.maxRow = maxRowScalar;
+    table.lumaRow = lumaRowScalar;
+    table.gradientRow = gradientRowScalar;
+    table.swapRow = swapRowScalar;
+    table.addRow16 = addRow16Scalar;
+    table.negateRow16 = negateRow16Scalar;
+    table.smoothRow16 = smoothRow16Scalar;
+    table.sharpenRow16 = sharpenRow16Scalar;
+    table.overRow = overRowScalar;
+    table.halveRow = halveRowScalar;
+
+#ifdef SIMD_X86
+    if (level >= ISA_SSE42)
+    {
+        table.level = ISA_SSE42;
+        table.addRow = addRowSse42;
+        table.negateRow = negateRowSse42;
+        table.smoothRow = smoothRowSse42;
+        table.sharpenRow = sharpenRowSse42;
+        table.interleaveRow = interleaveRowSse42;
+        table.deinterleaveRow = deinterleaveRowSse42;
+        table.diffRow = diffRowSse42;
+        table.medianRow = medianRowSse42;
+        table.minRow = minRowSse42;
+        table.maxRow = maxRowSse42;
+        table.lumaRow = lumaRowSse42;
+        table.gradientRow = gradientRowSse42;
+        table.swapRow = swapRowSse42;
+        table.addRow16 = addRow16Sse42;
+        table.negateRow16 = negateRow16Sse42;
+        table.overRow = overRowSse42;
+        table.halveRow = halveRowSse42;
+    }
+
+    if (level >= ISA_AVX2)
+    {
+        table.level = ISA_AVX2;
+        table.addRow = addRowAvx2;
+        table.negateRow = negateRowAvx2;
+        table.smoothRow = smoothRowAvx2;
+        table.sharpenRow = sharpenRowAvx2;
+        table.diffRow = diffRowAvx2;
+        table.medianRow = medianRowAvx2;
+        table.minRow = minRowAvx2;
+        table.maxRow = maxRowAvx2;
+        table.lumaRow = lumaRowAvx2;
+        table.gradientRow = gradientRowAvx2;
+        table.swapRow = swapRowAvx2;
+        table.addRow16 = addRow16Avx2;
+        table.negateRow16 = negateRow16Avx2;
+        table.overRow = overRowAvx2;
+        table.halveRow = halveRowAvx2;
+    }
+
+    if (level >= ISA_AVX512)
+    {
+        table.level = ISA_AVX512;
+        table.addRow = addRowAvx512;
+        table.negateRow = negateRowAvx512;
+        table.medianRow = medianRowAvx512;
+        table.minRow = minRowAvx512;
+        table.maxRow = maxRowAvx512;
+        table.swapRow = swapRowAvx512;
+        table.addRow16 = addRow16Avx512;
+        table.negateRow16 = negateRow16Avx512;
+        table.overRow = overRowAvx512;
+        table.halveRow = halveRowAvx512;
+    }
+#endif
+
+    return table;
+}
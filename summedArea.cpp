@@ -0,0 +1,351 @@
+/** ***************************************************************************
+ * @file
+ *
+ * @brief summed-area tables of a color plane and the box blur, local
+ *        deviation and region statistics that are read from them.
+ *****************************************************************************/
+
+#include "netPBM.h"
+#include <cstdio>
+#include <iomanip>
+#include <vector>
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Builds the summed-area table (integral image) of a color plane. Entry
+ * [r][c] of the table holds the sum of every pixel above and to the left of
+ * pixel [r][c], so the table has one more row and column than the plane and
+ * its first row and column are 0. The entries are 64 bit, which holds the
+ * sum of squares of any plane that fits in memory. When squares is true a
+ * second table of the squared pixels is built as well, for variances.
+ *
+ * The table is built with a parallel scan in two passes. The first pass sums
+ * along each row, with the rows split across threads. The second pass adds
+ * each row of the table to the one below it, with the columns split across
+ * threads, so every thread walks its own strip of columns down the table.
+ *
+ * @param[in] plane - the color plane to sum
+ * @param[in] rows - number of rows in the plane
+ * @param[in] cols - number of columns in the plane
+ * @param[in] squares - true to also build the table of squared pixels
+ * @param[out] table - the summed-area table
+ *
+ * @returns true if the table was built, false if memory ran out
+ *
+ * @par Example:
+   @verbatim
+   buildSummedArea(image.redgray, image.rows, image.cols, true, table);
+   @endverbatim
+ *
+ *****************************************************************************/
+bool buildSummedArea(pixel** plane, int rows, int cols, bool squares,
+    summedArea& table)
+{
+    size_t stride = (size_t)cols + 1;
+    size_t entries = ((size_t)rows + 1) * stride;
+
+    freeSummedArea(table);
+    table.rows = rows;
+    table.cols = cols;
+    table.sums = new (nothrow) unsigned long long[entries];
+    if (squares)
+        table.squares = new (nothrow) unsigned long long[entries];
+
+    if (table.sums == nullptr || (squares && table.squares == nullptr))
+    {
+        freeSummedArea(table);
+        return false;
+    }
+
+    memset(table.sums, 0, stride * sizeof(unsigned long long));
+    if (squares)
+        memset(table.squares, 0, stride * sizeof(unsigned long long));
+
+    parallelFor(0, rows, [&](int rowStart, int rowEnd)     // along the rows
+        {
+            for (int r = rowStart; r < rowEnd; r++)
+            {
+                unsigned long long* sum = table.sums + (r + 1) * stride;
+                unsigned long long* square = squares ?
+                    table.squares + (r + 1) * stride : nullptr;
+                unsigned long long run = 0, runSquares = 0;
+
+                sum[0] = 0;
+                for (int c = 0; c < cols; c++)
+                {
+                    run += plane[r][c];
+                    sum[c + 1] = run;
+                }
+
+                if (square == nullptr)
+                    continue;
+
+                square[0] = 0;
+                for (int c = 0; c < cols; c++)
+                {
+                    runSquares += (unsigned long long)(plane[r][c] * plane[r][c]);
+                    square[c + 1] = runSquares;
+                }
+            }
+        });
+
+    parallelFor(0, (int)stride, [&](int colStart, int colEnd)    // down
+        {
+            for (int r = 1; r <= rows; r++)
+            {
+                unsigned long long* above = table.sums + (r - 1) * stride;
+                unsigned long long* sum = table.sums + r * stride;
+
+                for (int c = colStart; c < colEnd; c++)
+                    sum[c] += above[c];
+
+                if (!squares)
+                    continue;
+
+                above = table.squares + (r - 1) * stride;
+                sum = table.squares + r * stride;
+                for (int c = colStart; c < colEnd; c++)
+                    sum[c] += above[c];
+            }
+        });
+
+    return true;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Releases the memory of a summed-area table and resets it to empty.
+ *
+ * @param[in,out] table - the summed-area table to free
+ *
+ * @par Example:
+   @verbatim
+   freeSummedArea(table);
+   @endverbatim
+ *
+ *****************************************************************************/
+void freeSummedArea(summedArea& table)
+{
+    delete[] table.sums;
+    delete[] table.squares;
+
+    table.sums = nullptr;
+    table.squares = nullptr;
+    table.rows = 0;
+    table.cols = 0;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Finds the mean and variance of the pixels in rows [top, bottom) and
+ * columns [left, right) from a summed-area table, with four lookups per
+ * table no matter how large the region is. The region is clipped to the
+ * plane. The variance is 0 when the table has no squares.
+ *
+ * @param[in] table - summed-area table of the plane
+ * @param[in] top - first row of the region
+ * @param[in] left - first column of the region
+ * @param[in] bottom - one past the last row of the region
+ * @param[in] right - one past the last column of the region
+ * @param[out] mean - mean of the pixels in the region
+ * @param[out] variance - variance of the pixels in the region
+ *
+ * @returns the number of pixels in the clipped region
+ *
+ * @par Example:
+   @verbatim
+   regionStats(table, 0, 0, 16, 16, mean, variance);
+   @endverbatim
+ *
+ *****************************************************************************/
+long long regionStats(const summedArea& table, int top, int left, int bottom,
+    int right, double& mean, double& variance)
+{
+    size_t stride = (size_t)table.cols + 1;
+    unsigned long long sum, squares;
+    long long count;
+
+    top = max(top, 0);
+    left = max(left, 0);
+    bottom = min(bottom, table.rows);
+    right = min(right, table.cols);
+    count = (long long)max(bottom - top, 0) * max(right - left, 0);
+
+    mean = variance = 0;
+    if (count == 0)
+        return 0;
+
+    sum = table.sums[bottom * stride + right] - table.sums[top * stride + right]
+        - table.sums[bottom * stride + left] + table.sums[top * stride + left];
+    mean = (double)sum / count;
+
+    if (table.squares != nullptr)
+    {
+        squares = table.squares[bottom * stride + right] -
+            table.squares[top * stride + right] -
+            table.squares[bottom * stride + left] +
+            table.squares[top * stride + left];
+        variance = max((double)squares / count - mean * mean, 0.0);
+    }
+
+    return count;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Replaces every pixel with the mean of the square of 2 * radius + 1 rows
+ * and columns around it, or with the standard deviation of that square when
+ * deviation is true. Each plane gets one summed-area table, and every pixel
+ * is then read from it in constant time, so a large radius costs no more
+ * than a small one. Near the edges the square is clipped to the image and
+ * only the pixels inside it are counted.
+ *
+ * @param[in,out] image - structure for image information
+ * @param[in] radius - radius of the square, 1 when 0 is given
+ * @param[in] deviation - true for the local standard deviation, false for
+ *                        the local mean
+ *
+ * @returns true if every plane was filtered, false if memory ran out
+ *
+ * @par Example:
+   @verbatim
+   boxFilter(image, 10, false);
+
+   Output:
+   an image blurred with a 21x21 box
+   @endverbatim
+ *
+ *****************************************************************************/
+bool boxFilter(image& image, int radius, bool deviation)
+{
+    pixel** planes[3] = { image.redgray, image.green, image.blue };
+    summedArea table;
+    int k;
+
+    if (radius <= 0)
+        radius = 1;
+
+    for (k = 0; k < 3; k++)
+    {
+        if (planes[k] == nullptr)
+            continue;
+
+        if (!buildSummedArea(planes[k], image.rows, image.cols, deviation,
+            table))
+            return false;
+
+        parallelFor(0, image.rows, [&](int rowStart, int rowEnd)
+            {
+                double mean, variance;
+
+                for (int r = rowStart; r < rowEnd; r++)
+                {
+                    for (int c = 0; c < image.cols; c++)
+                    {
+                        regionStats(table, r - radius, c - radius,
+                            r + radius + 1, c + radius + 1, mean, variance);
+                        planes[k][r][c] = (pixel)crop((int)((deviation ?
+                            sqrt(variance) : mean) + 0.5));
+                    }
+                }
+            });
+    }
+
+    freeSummedArea(table);
+
+    return true;
+}
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Measures the mean and standard deviation of each color over a list of
+ * rectangles, read from one summed-area table per color that is built once
+ * for all of them. The regions are written "left,top,WxH" and separated by
+ * ':'; the whole image is measured when the list is empty. One line per
+ * region is added to lastReport for the caller to print, and the image
+ * itself is left unchanged.
+ *
+ * @param[in] image - structure for image information
+ * @param[in] regions - list of regions such as "0,0,64x64:32,32,16x16"
+ *
+ * @returns true if the statistics were measured, false if memory ran out
+ *
+ * @par Example:
+   @verbatim
+   regionStatistics(image, "0,0,64x64");
+
+   Output:
+   0,0,64x64 mean 120.5317 98.0410 77.2646 std dev 30.1127 28.9305 25.5082
+   @endverbatim
+ *
+ *****************************************************************************/
+bool regionStatistics(image& image, string regions)
+{
+    pixel** planes[3] = { image.redgray, image.green, image.blue };
+    int channels = image.green == nullptr ? 1 : 3;
+    vector<summedArea> tables(channels);
+    ostringstream report;
+    istringstream list;
+    string region;
+    int k;
+
+    if (regions == "")
+        regions = "0,0," + to_string(image.cols) + "x" + to_string(image.rows);
+
+    for (k = 0; k < channels; k++)
+    {
+        if (!buildSummedArea(planes[k], image.rows, image.cols, true, tables[k]))
+        {
+            for (summedArea& table : tables)
+                freeSummedArea(table);
+            return false;
+        }
+    }
+
+    list.str(regions);
+    while (getline(list, region, ':'))
+    {
+        int left = 0, top = 0, width = 0, height = 0;
+        double mean[3], variance[3];
+
+        if (sscanf(region.c_str(), "%d,%d,%dx%d", &left, &top, &width,
+            &height) != 4)
+        {
+            report << region << " is not a region, use left,top,WxH\n";
+            continue;
+        }
+
+        for (k = 0; k < channels; k++)
+            regionStats(tables[k], top, left, top + height, left + width,
+                mean[k], variance[k]);
+
+        report << region << " mean" << fixed << setprecision(4);
+        for (k = 0; k < channels; k++)
+            report << " " << mean[k];
+        report << " std dev";
+        for (k = 0; k < channels; k++)
+            report << " " << sqrt(variance[k]);
+        report << "\n";
+    }
+
+    for (summedArea& table : tables)
+        freeSummedArea(table);
+    lastReport += report.str();
+
+    return true;
+}
@@ -1,140 +1,354 @@
-/** ***************************************************************************
- * @file
- *
- * @brief main execution of program and program logic
- *****************************************************************************/
- /** ***************************************************************************
-  * @mainpage Take Home Programming Exam 1 - Image Manipulation
-  *
-  * @section course_section Course Information
-  *
-  * @authors Heidi Anderson
-  *
-  * @date October 15, 2023
-  *
-  * @par Instructor
-  *         Roger Schrader
-  *
-  * @par Course
-  *         CSC 215 - Section M02 - 1:00 pm
-  *
-  * @par Location
-  *         McLaury - Room 205
-  *
-  * @section program_section Program Information
-  *
-  * @details This program reads in an image and will perform an operation based
-  * on the user's input. if "--sharpen" is given the program will perform the 
-  * sharpen operation. Same follows with "--smooth", "--contrast", 
-  * "--grayscale", "--negate", and "--brighten". The program will also convert
-  * the image to binary or ascii given what option the user gives. (Either 
-  * "--ascii" or "--binary") After performing the operation the program will
-  * write out the new modified image. 
-  *
-  * Because of space, the rest of the details have been omitted.
-  *
-  * @section compile_section Compiling and Usage
-  *
-  * @par Compiling Instructions:
-  *      None
-  *
-  * @par Usage
-    @verbatim
-    c:\> thpe01.exe [option] --[ascii | binary] basename image.ppm
-        --smooth - smooth operation
-        --sharpen - sharpen operation
-        --contrast - contrast operation
-        --grayscale - grayscale operation
-        --negate - negate operation
-        --brighten # - brighten operation and brighten value.
-    @endverbatim
-  *
-  * @par Modifications and Development Timeline:
-  *     <a href="https://gitlab.cse.sdsmt.edu/101061875/csc215f23programs/-/commits/main/" target=_blank>
-  *     Gitlab Commit Log</a>
-  *
-  *****************************************************************************/
-#include <iostream>
-#include <iomanip>
-#include <string>
-#include "netPBM.h"
-
-using namespace std;
-
-/** ***************************************************************************
- * @author Heidi Anderson
- *
- * @par Description:
- * This first checks the number of command-line arguments passed ('argc'). If 
- * there are fewer than 4 or more than 6 arguments, or if 'argc' is 0, it will
- * print out an error message and exit with a status of '0'. Depending on the 
- * number of arguments, it parses the input arguments. It also validates the
- * 'option' and 'outputType' arguments. If they are not recognized it prints 
- * and error message and exits with a code '0'.
- * 
- * The the function reads the image data form the file specified by 'fileName'
- * into the 'image' object using the 'readImage' function. If the image cannot
- * be read, it exits with a status of '1'. Depending on the option, the function
- * applies various images processing operations. 
- * 
- * After processing the image based on the specified operation, the function 
- * writes the processed image data to an output file specified by 'baseName' 
- * and 'outputType' using the 'writeImage' function. If the image cannot be
- * written it exits with a status '1'.
- *
- * @param[in] argc - the number of arguments from the command prompt.
- * @param[in] argv - a 2d array of characters containing the arguments.
- *
- * @returns 0 - after completion of execution
- * @returns 0 - if there is an error in reading or writing
- * 
- ******************************************************************************/
-int main(int argc, char** argv)
-{
-    string outtype, option = argv[1], baseName = argv[argc - 2], 
-           inputImage = argv[argc - 1], outputFile = " ";
-    int brightVal = 0;
-    image image;
-    ifstream fin;
-    ofstream fout;
-    char* outputType = argv[argc - 3];
-    
-    errorCheck(argc, argv);
-
-    if (argc == 6)
-    {
-        brightVal = stoi(argv[2]);
-    }
-
-    openInput(inputImage, fin);
-    
-    readHeader(fin, image);
-
-    image.redgray = alloc2d(image.rows, image.cols);
-    image.green = alloc2d(image.rows, image.cols);
-    image.blue = alloc2d(image.rows, image.cols);
-    
-    asciiOrBinary(fin, image);
-    
-    if (option == "--brighten")
-        brighten(image, brightVal);
-    else if (option == "--negate")
-        negateImage(image);
-    else if (option == "--grayscale")
-        grayscale(image);
-    else if (option == "--contrast")
-        contrast(image);
-    else if (option == "--smooth")
-        smooth(image);
-    else if (option == "--sharpen")
-        sharpen(image);
-
-    if (option == "--grayscale" || option == "--contrast")
-        outputFile = baseName + ".pgm";
-    else
-        outputFile = baseName + ".ppm";
-
-    output(outputType, outputFile, fout, image, option);
-        
-    return 0;
+/** ***************************************************************************
+ * @file
+ *
+ * @brief main execution of program and program logic
+ *****************************************************************************/
+ /** ***************************************************************************
+  * @mainpage Take Home Programming Exam 1 - Image Manipulation
+  *
+  * @section course_section Course Information
+  *
+  * @authors Heidi Anderson
+  *
+  * @date October 15, 2023
+  *
+  * @par Instructor
+  *         Roger Schrader
+  *
+  * @par Course
+  *         CSC 215 - Section M02 - 1:00 pm
+  *
+  * @par Location
+  *         McLaury - Room 205
+  *
+  * @section program_section Program Information
+  *
+  * @details This program reads in an image and will perform an operation based
+  * on the user's input. if "--sharpen" is given the program will perform the 
+  * sharpen operation. Same follows with "--smooth", "--contrast", 
+  * "--grayscale", "--negate", "--brighten", "--equalize", "--clahe",
+  * "--median", "--erode", "--dilate", "--open", "--close",
+  * "--boxblur", "--stddev", "--stats", "--unsharp", "--edges", "--crop",
+  * "--bilateral", "--over", "--and", "--or" and "--xor". P1/P4 bitmaps are
+  * kept at one bit per pixel.
+  * Images with a max value over 255 keep 16 bit samples through brighten,
+  * negate, grayscale, contrast, smooth, sharpen and crop, and are reduced to
+  * 8 bits for the other operations and for QOI.
+  * The program will also convert the image to binary or ascii given what
+  * option the user gives. (Either "--ascii", "--binary" or "--qoi") After
+  * performing the operation the program will write out the new modified
+  * image.
+  *
+  * If "-" is given for both the basename and the image, the program reads a
+  * sequence of concatenated images from stdin and writes the results to
+  * stdout. Reading, processing and writing run on their own threads so the
+  * program can sit in the middle of a Unix pipeline.
+  *
+  * "--compare" reads two images and prints their max abs difference, MSE,
+  * PSNR and SSIM, and writes the absolute difference image if a basename is
+  * given for it.
+  *
+  * P7 PAM images are read with or without an alpha channel, and binary
+  * output of an image with alpha is written as PAM. "--over" blends another
+  * image onto the input through its alpha channel, at an offset given after
+  * an '@', such as "logo.pam@20,10".
+  *
+  * "--pyramid #" writes the image as a Deep Zoom pyramid for a web viewer:
+  * basename.dzi and a directory basename_files with a directory of # pixel
+  * square tiles for each level. Each level is halved from the one above it
+  * as the rows go by, so only one band of tiles per level is in memory.
+  *
+  * "--info" prints the type, size, max value and comment of every image in
+  * the files and directories given, reading only their headers. With
+  * "--index file" the results are kept in a tab separated index, and a later
+  * scan only opens the images whose size or last write time changed.
+  *
+  * "--shard #" splits a large image into # strips of rows, each processed
+  * by its own worker process. Neighboring workers trade the rows a 3x3
+  * filter reads across their boundary, and for binary output each worker
+  * writes its rows straight into the output file. Negate, brighten,
+  * grayscale, smooth and sharpen can be sharded; other operations run in
+  * one process.
+  *
+  * "--incremental" keeps a hash of every 64 pixel tile of the input in
+  * basename.tiles. When an edited version of the same image is processed
+  * again, only the tiles that changed, and the tiles whose 3x3 filter reads
+  * them, are processed and written over their place in the existing binary
+  * output, so the work follows the size of the edit. It works for the same
+  * operations as "--shard".
+  *
+  * "--autotune" times every operation on a synthetic image with each kernel
+  * version, thread count and band of rows per thread, and saves the fastest
+  * in .thpe01-hostname.tsv in the home directory, or the file named by
+  * THPE01_PROFILE. Every later run loads the settings for its operation
+  * from that profile at startup.
+  *
+  * Input images compressed with gzip or zstd are found by their magic
+  * number and decompressed on a separate thread while they are read. A
+  * basename ending in .gz or .zst writes a compressed image, for example
+  * "result.gz" writes result.ppm.gz.
+  *
+  * Everything but the command line is built as the netPBM static library,
+  * which thpe01 links. Other programs can link it too and use decodeImage,
+  * processImage, encodeImage and transformImage to work on images held in
+  * memory. Those functions throw an imageError that says what went wrong
+  * instead of printing a message or ending the program, and processImage
+  * returns what an operation such as --stats reports. The library itself
+  * never prints; it leaves what a driver such as --compare or --info reports
+  * in lastReport and the reason for a failure in lastFailure, and thpe01
+  * prints them.
+  *
+  * Because of space, the rest of the details have been omitted.
+  *
+  * @section compile_section Compiling and Usage
+  *
+  * @par Compiling Instructions:
+  *      Build the netPBM project before thpe01, the solution does this.
+  *      Compression is off by default. Build with /p:ImageCompression=true
+  *      to read and write .gz and .zst images; that defines HAVE_ZLIB and
+  *      HAVE_ZSTD and has vcpkg install and link zlib and zstd from
+  *      vcpkg.json, which needs "vcpkg integrate install" once. Other build
+  *      systems define the same two and link zlib and libzstd.
+  *
+  * @par Usage
+    @verbatim
+    c:\> thpe01.exe [option] --[ascii | binary | qoi] basename image.ppm
+    c:\> thpe01.exe --compare first.ppm second.ppm [diffbase]
+    c:\> thpe01.exe --info [--index catalog.tsv] path...
+    c:\> thpe01.exe --autotune
+        --smooth - smooth operation
+        --sharpen - sharpen operation
+        --contrast - contrast operation
+        --grayscale - grayscale operation
+        --negate - negate operation
+        --brighten # - brighten operation and brighten value.
+        --equalize - histogram equalization operation
+        --clahe [#] - adaptive equalization, # limits the contrast.
+        --median [#] - median filter with radius #, 1 if omitted.
+        --erode WxH - minimum over a W by H rectangle, 3x3 if omitted.
+        --dilate WxH - maximum over a W by H rectangle.
+        --open WxH - erode then dilate, removes small bright specks.
+        --close WxH - dilate then erode, fills small dark holes.
+        --boxblur # - mean of the square of radius #, any size.
+        --stddev # - standard deviation of the square of radius #.
+        --stats left,top,WxH[:...] - mean and std dev of regions.
+        --unsharp r,a,t - unsharp mask, radius r, amount a, threshold t.
+        --edges [sobel|scharr][,l1|l2] - gradient magnitude edge map.
+        --bilateral s,r[,exact] - edge preserving smooth, sigma_s and sigma_r.
+        --over file[@col,row] - alpha blend an overlay onto the image.
+        --pyramid # - Deep Zoom tiles # pixels square, 256 if omitted.
+        --crop left,top,WxH - keep a rectangle of the image.
+        --and mask.pbm - black where the bitmap and the mask are black.
+        --or mask.pbm - black where the bitmap or the mask is black.
+        --xor mask.pbm - black where only one of them is black.
+        --isa name - use the scalar, sse4.2, avx2 or avx512 kernels.
+        --shard # - split the image across # worker processes.
+        --incremental - only process the tiles changed since the last run.
+
+    $ cat a.ppm b.ppm | thpe01 [option] --[ascii | binary | qoi] - - > out.ppm
+    @endverbatim
+  *
+  * @par Modifications and Development Timeline:
+  *     <a href="https://gitlab.cse.sdsmt.edu/101061875/csc215f23programs/-/commits/main/" target=_blank>
+  *     Gitlab Commit Log</a>
+  *
+  *****************************************************************************/
+#include <iostream>
+#include <iomanip>
+#include <limits>
+#include <string>
+#include "netPBM.h"
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+using namespace std;
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Options that may appear anywhere, like "--isa", are handled first by
+ * globalOptions. This then checks the number of command-line arguments
+ * passed ('argc'). If there are fewer than 4 or more than 6 arguments, or if
+ * 'argc' is 0, it will print out an error message and exit with a status of
+ * '1'. Depending on the number of arguments, it parses the input arguments.
+ * It also validates the 'option' and 'outputType' arguments. If they are not
+ * recognized it prints and error message and exits with a code '1'.
+ * 
+ * The the function reads the image data form the file specified by 'fileName'
+ * into the 'image' object using the 'readImage' function. If the image cannot
+ * be read, it exits with a status of '1'. Depending on the option, the function
+ * applies various images processing operations. If the operation fails
+ * nothing is written and it exits with a status of '1'.
+ * 
+ * After processing the image based on the specified operation, the function 
+ * writes the processed image data to an output file specified by 'baseName' 
+ * and 'outputType' using the 'writeImage' function. If the image cannot be
+ * written it exits with a status '1'.
+ *
+ * @param[in] argc - the number of arguments from the command prompt.
+ * @param[in] argv - a 2d array of characters containing the arguments.
+ *
+ * @returns 0 - after completion of execution
+ * @returns 1 - if there is an error in the arguments, the operation, reading
+ *              or writing
+ * 
+ ******************************************************************************/
+int main(int argc, char** argv)
+{
+    string outtype, option, baseName, inputImage, outputFile = " ";
+    string parameter;
+    image image;
+    ifstream fin;
+    ofstream fout;
+    char* outputType;
+    int shards;
+    bool incremental;
+    
+    if (globalOptions(argc, argv, shards, incremental) != 0)
+    {
+        return 1;
+    }
+
+    if (argc >= 4 && argc <= 5 && string(argv[1]) == "--compare")
+    {
+        int status = compareImages(argv[2], argv[3], argc == 5 ? argv[4] :
+            "");
+
+        cout << lastReport;                     // the measures
+        if (status != 0)
+            printFailure("Unable to compare the images");
+        return status;
+    }
+
+    if (argc == 2 && string(argv[1]) == "--autotune")   // profile this host
+    {
+        int status = tuneOperations();
+
+        cout << lastReport;                     // the fastest settings
+        if (status != 0)
+            printFailure("Unable to tune the operations");
+        return status;
+    }
+
+    if (argc >= 3 && string(argv[1]) == "--info")  // headers only
+    {
+        vector<string> paths(argv + 2, argv + argc);
+        string indexFile;
+
+        if (paths.size() >= 3 && paths[0] == "--index")
+        {
+            indexFile = paths[1];
+            paths.erase(paths.begin(), paths.begin() + 2);
+        }
+        int status = catalogImages(paths, indexFile, cout);
+
+        if (status != 0)
+            printFailure("Unable to list the images");
+        cerr << lastReport;                     // headers read and reused
+        return status;
+    }
+
+    if (errorCheck(argc, argv) != 0)
+    {
+        return 1;
+    }
+
+    option = argv[1];
+    baseName = argv[argc - 2];
+    inputImage = argv[argc - 1];
+    outputType = argv[argc - 3];
+
+    if (argc == 6)
+    {
+        parameter = argv[2];
+    }
+
+    if (baseName == "-" && inputImage == "-")   // stdin to stdout pipeline
+    {
+        int status;
+
+#ifdef _WIN32
+        _setmode(_fileno(stdin), _O_BINARY);    // no newline translation
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        ios::sync_with_stdio(false);
+        status = streamImages(option, parameter, outputType, cin, cout);
+
+        cerr << lastReport;                     // such as --stats numbers
+        if (status != 0)
+            printFailure("Unable to write the standard output");
+        return status;
+    }
+
+    if (!openInput(inputImage, fin) || !readImage(fin, image))
+    {
+        printFailure(inputImage + " is not a readable image");
+        return 1;
+    }
+
+    fin.ignore(numeric_limits<streamsize>::max());  // a damaged compressed
+    if (fin.bad())                                  // file shows at its end
+    {
+        printFailure(inputImage + " is not a readable image");
+        freeImage(image);
+        return 1;
+    }
+
+    if (option == "--pyramid")                  // tiles instead of one image
+    {
+        bool written = writePyramid(image, atoi(parameter.c_str()),
+            outputType, baseName);
+        if (!written)
+            printFailure("Unable to write the pyramid " + baseName);
+        freeImage(image);
+        return written ? 0 : 1;
+    }
+
+    if (incremental)                            // patch the last output
+    {
+        handoff patched = incrementalUpdate(image, option, parameter,
+            outputType, baseName);
+        if (patched == HANDOFF_FAILED)
+            printFailure("Unable to update " + baseName);
+        else if (patched == HANDOFF_DONE)
+            cerr << lastReport;                 // tiles changed and processed
+        if (patched != HANDOFF_DECLINED)
+        {
+            freeImage(image);
+            return patched == HANDOFF_DONE ? 0 : 1;
+        }
+    }
+
+    if (shards > 1)                             // split across processes
+    {
+        handoff sharded = shardImage(image, option, parameter, outputType,
+            baseName, shards);
+        if (sharded == HANDOFF_FAILED)
+            printFailure("Unable to shard " + option);
+        if (sharded != HANDOFF_DECLINED)
+            return sharded == HANDOFF_DONE ? 0 : 1;
+    }
+
+    if (!tunedOperation(image, option, parameter))
+    {
+        printFailure("Unable to apply " + option + " " + parameter);
+        freeImage(image);
+        return 1;
+    }
+    cerr << lastReport;                         // such as --stats numbers
+
+    outputFile = outputName(baseName, outputType, image);
+    if (!output(outputType, outputFile, fout, image))
+    {
+        printFailure("Unable to write " + outputFile);
+        freeImage(image);
+        return 1;
+    }
+    freeImage(image);
+
+    return 0;
 }
\ No newline at end of file
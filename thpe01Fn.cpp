@@ -1,155 +1,336 @@
-/** ***************************************************************************
- * @file 
- *
- * @brief demonstrates function for outputting the usage statement
- *****************************************************************************/
-
-#include "netPBM.h"
-
- /** ***************************************************************************
-  * @author Heidi Anderson
-  *
-  * @par Description:
-  * Crops a number to be between 0 and 255 inclusive
-  *
-  * @param[in] num - number to be cropped
-  *
-  * @returns returns the cropped number
-  *
-  * @par Example:
-    @verbatim
-    crop(-14)
-   
-    Output:
-    0
-    @endverbatim
-  * 
-  *****************************************************************************/
-int crop(int num)
-{
-    if ( num < 0 )    // crop to zero
-    {
-        num = 0;
-    }
-
-    if ( num > 255 )  // crop to 255
-    {
-        num = 255;
-    }
-
-    return num;
-}
-
-
-
-/** ***************************************************************************
- * @author Heidi Anderson
- *
- * @par Description:
- * Does error checking for command line arguments
- *
- * @param[in,out] argc - number of arguments
- * @param[in,out] argv - character array of arguments
- *
- * @returns returns 0 if successful
- *
- * @par Example:
-   @verbatim
-   errorCheck(1, argv)
-   
-   Output:
-< thpe01.exe [option] --outputtype basename image.ppm
-< Output Type      Output Description
-<     --ascii      integer text numbers will be written for the data
-<     --binary     integer numbers will be written in binary form
-< Option Code      Option Description
-<     --smooth     Blur a color image
-<     --sharpen    Enhance the lines in a color image
-<     --negate     Create a negative of a color image
-<     --brighten # Add the provide (+/-) number to each pixel
-<     --grayscale  Convert image to grayscale
-<     --contrast   Convert a color image to grayscale and scale the pixel values
-   @endverbatim
- * 
- *****************************************************************************/
-int errorCheck(int& argc, char**& argv)
-{
-    string outputType = argv[argc - 3];
-    string option = argv[1];
-
-    if (argc < 4 || argc > 6 || argc == 0)  // invalid num of args
-    {
-        usageStatement();
-        exit(0);
-    }
-
-    if (outputType != "--ascii" && outputType != "--binary") // invalid output
-    {
-        cout << "Invalid output type" << endl;
-        usageStatement();
-        exit(0);
-    }
-
-    if (option != "--negate" && option != "--smooth" &&     // invalid option
-        option != "--sharpen" && option != "--grayscale" && 
-        option != "--brighten" && option != "--contrast" && 
-        option != "--ascii" && option != "--binary")
-    {
-        cout << "Invalid option" << endl;
-        usageStatement();
-        exit(0);
-    }
-
-    return 0;
-}
-
-
-
-/** ***************************************************************************
- * @author Heidi Anderson
- *
- * @par Description:
- * This function is designed to provide users with information about how to
- * use the command-line. It print's the program's available options with their
- * descriptions to guide users on how to interact with the program.
- *
- * @returns returns 0 if successful
- *
- * @par Example:
-   @verbatim
-   usageStatement();
-   
-   Output:
-< thpe01.exe [option] --outputtype basename image.ppm
-< Output Type      Output Description
-<     --ascii      integer text numbers will be written for the data
-<     --binary     integer numbers will be written in binary form
-< Option Code      Option Description
-<     --smooth     Blur a color image
-<     --sharpen    Enhance the lines in a color image
-<     --negate     Create a negative of a color image
-<     --brighten # Add the provide (+/-) number to each pixel
-<     --grayscale  Convert image to grayscale
-<     --contrast   Convert a color image to grayscale and scale the pixel values
-   @endverbatim
- * 
- ******************************************************************************/
-int usageStatement()
-{
-    cout << "thpe01.exe [option] --outputtype basename image.ppm" << endl;
-    cout << endl;
-    cout << "Output Type      Output Description" << endl;
-    cout << "    --ascii      integer text numbers will be written for the data" << endl;
-    cout << "    --binary     integer numbers will be written in binary form" << endl;
-    cout << endl;
-    cout << "Option Code      Option Description" << endl;
-    cout << "    --smooth     Blur a color image" << endl;
-    cout << "    --sharpen    Enhance the lines in a color image" << endl;
-    cout << "    --negate     Create a negative of a color image" << endl;
-    cout << "    --brighten # Add the provide (+/-) number to each pixel" << endl;
-    cout << "    --grayscale  Convert image to grayscale" << endl;
-    cout << "    --contrast   Convert a color image to grayscale and scale the pixel values" << endl;
-
-    return 0;
-
-}
\ No newline at end of file
+/** ***************************************************************************
+ * @file 
+ *
+ * @brief demonstrates function for outputting the usage statement
+ *****************************************************************************/
+
+#include "netPBM.h"
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Does error checking for command line arguments. Errors print the usage
+ * statement and are returned rather than ending the program, so main
+ * decides how to stop.
+ *
+ * @param[in,out] argc - number of arguments
+ * @param[in,out] argv - character array of arguments
+ *
+ * @returns returns 0 if successful, 1 if the arguments are not valid
+ *
+ * @par Example:
+   @verbatim
+   errorCheck(1, argv)
+   
+   Output:
+< thpe01.exe [option] --outputtype basename image.ppm
+< thpe01.exe --compare first.ppm second.ppm [diffbase]
+< thpe01.exe --info [--index catalog.tsv] path...
+< thpe01.exe --autotune
+< Output Type      Output Description
+<     --ascii      integer text numbers will be written for the data
+<     --binary     integer numbers will be written in binary form
+<     --qoi        lossless compressed QOI image will be written
+< Option Code      Option Description
+<     --smooth     Blur a color image
+<     --sharpen    Enhance the lines in a color image
+<     --negate     Create a negative of a color image
+<     --brighten # Add the provide (+/-) number to each pixel
+<     --grayscale  Convert image to grayscale
+<     --contrast   Convert a color image to grayscale and scale the pixel values
+<     --equalize   Convert to grayscale and equalize the histogram
+<     --clahe [#]  Convert to grayscale and equalize each tile, # limits contrast
+<     --median [#] Remove noise with the median of the # radius square
+<     --erode WxH  Take the minimum over a W by H rectangle, 3x3 if omitted
+<     --dilate WxH Take the maximum over a W by H rectangle, 3x3 if omitted
+<     --open WxH   Erode then dilate, removing bright specks
+<     --close WxH  Dilate then erode, filling dark holes
+<     --boxblur #  Blur with the mean of the # radius square, any size
+<     --stddev #   Replace each pixel with the std dev of the # radius square
+<     --stats list Print mean and std dev of regions left,top,WxH[:...]
+<     --unsharp r,a,t Sharpen by a times the difference from the r radius blur,
+<                  where the difference is at least t
+<     --edges [k,m] Edge map, k is sobel or scharr and m is l1 or l2
+<     --bilateral s,r[,exact] Smooth within sigma_s pixels, keeping edges
+<                  of more than sigma_r gray levels
+<     --over file[@c,r] Blend an image with alpha onto this one at column c,
+<                  row r
+<     --pyramid #  Write basename.dzi and Deep Zoom tiles # pixels square
+<     --crop l,t,WxH Keep the W by H rectangle at column l, row t
+<     --and file   Black where a P1/P4 bitmap and the mask file are black
+<     --or file    Black where a P1/P4 bitmap or the mask file is black
+<     --xor file   Black where only one of a bitmap and the mask is black
+< Global Option    Option Description
+<     --isa name   Use the scalar, sse4.2, avx2 or avx512 kernels
+<     --shard #    Split the image across # worker processes
+<     --incremental  Only process the tiles that changed since the last run
+   @endverbatim
+ * 
+ *****************************************************************************/
+int errorCheck(int& argc, char**& argv)
+{
+    string outputType, option;
+    const string options[] = { "--negate", "--smooth", "--sharpen",
+        "--grayscale", "--brighten", "--contrast", "--equalize", "--clahe",
+        "--median", "--erode", "--dilate", "--open", "--close", "--boxblur",
+        "--stddev", "--stats", "--unsharp", "--edges", "--crop", "--and",
+        "--or", "--xor", "--bilateral", "--over", "--pyramid", "--ascii",
+        "--binary", "--qoi" };
+
+    if (argc < 4 || argc > 6 || argc == 0)  // invalid num of args
+    {
+        usageStatement();
+        return 1;
+    }
+
+    outputType = argv[argc - 3];
+    option = argv[1];
+
+    if (outputType != "--ascii" && outputType != "--binary" &&  // invalid output
+        outputType != "--qoi")
+    {
+        cout << "Invalid output type" << endl;
+        usageStatement();
+        return 1;
+    }
+
+    if (find(begin(options), end(options), option) == end(options))
+    {                                                       // invalid option
+        cout << "Invalid option" << endl;
+        usageStatement();
+        return 1;
+    }
+
+    return 0;
+}
+
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Handles the options that can appear anywhere on the command line and
+ * removes them from the arguments, so errorCheck and main only see the
+ * usual [option] --outputtype basename image.ppm layout. "--isa name"
+ * replaces the kernels picked from cpuid with the ones for the named
+ * instruction set, which lets every kernel version be tested and timed on
+ * one machine. A name that is unknown or that the processor does not
+ * support prints an error message and is returned as an error. "--shard #"
+ * sets the number of worker processes the image is split across, and
+ * "--incremental" asks for only the tiles that changed to be processed.
+ * Last, the settings the --autotune profile of this host has for the
+ * operation are loaded by useProfile, keeping the kernels --isa picked;
+ * its threads and band size only apply inside tunedOperation.
+ *
+ * @param[in,out] argc - number of arguments
+ * @param[in,out] argv - character array of arguments
+ * @param[out] shards - number of worker processes, 1 if not given
+ * @param[out] incremental - true if "--incremental" was given
+ *
+ * @returns returns 0 if successful, 1 if the instruction set can not be used
+ *          or the number of workers is not valid
+ *
+ * @par Example:
+   @verbatim
+   globalOptions(argc, argv, shards, incremental);
+   @endverbatim
+ *
+ *****************************************************************************/
+int globalOptions(int& argc, char**& argv, int& shards, bool& incremental)
+{
+    isaLevel level;
+    bool isaGiven = false;
+    int i, j, used;
+
+    shards = 1;
+    incremental = false;
+    for (i = 1; i < argc - 1; i++)
+    {
+        used = 2;
+        if (string(argv[i]) == "--incremental")
+        {
+            incremental = true;
+            used = 1;
+        }
+        else if (string(argv[i]) == "--shard")
+        {
+            shards = atoi(argv[i + 1]);
+            if (shards < 1)
+            {
+                cout << "Invalid number of shards: " << argv[i + 1] << endl;
+                usageStatement();
+                return 1;
+            }
+        }
+        else if (string(argv[i]) == "--isa")
+        {
+            if (!isaFromName(argv[i + 1], level))
+            {
+                cout << "Invalid instruction set: " << argv[i + 1] << endl;
+                usageStatement();
+                return 1;
+            }
+
+            if (level > detectIsa())
+            {
+                cout << "This processor does not support " << argv[i + 1]
+                    << endl;
+                return 1;
+            }
+
+            kernels = kernelsFor(level);
+            isaGiven = true;
+        }
+        else
+            continue;
+
+        for (j = i; j + used < argc; j++)   // remove the option and its value
+            argv[j] = argv[j + used];
+        argc -= used;
+        i--;
+    }
+
+    if (argc > 1)               // the tuned settings for the operation
+        useProfile(argv[1], isaGiven);
+
+    return 0;
+}
+
+
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * This function is designed to provide users with information about how to
+ * use the command-line. It print's the program's available options with their
+ * descriptions to guide users on how to interact with the program.
+ *
+ * @returns returns 0 if successful
+ *
+ * @par Example:
+   @verbatim
+   usageStatement();
+   
+   Output:
+< thpe01.exe [option] --outputtype basename image.ppm
+< thpe01.exe --compare first.ppm second.ppm [diffbase]
+< thpe01.exe --info [--index catalog.tsv] path...
+< thpe01.exe --autotune
+< Output Type      Output Description
+<     --ascii      integer text numbers will be written for the data
+<     --binary     integer numbers will be written in binary form
+<     --qoi        lossless compressed QOI image will be written
+< Option Code      Option Description
+<     --smooth     Blur a color image
+<     --sharpen    Enhance the lines in a color image
+<     --negate     Create a negative of a color image
+<     --brighten # Add the provide (+/-) number to each pixel
+<     --grayscale  Convert image to grayscale
+<     --contrast   Convert a color image to grayscale and scale the pixel values
+<     --equalize   Convert to grayscale and equalize the histogram
+<     --clahe [#]  Convert to grayscale and equalize each tile, # limits contrast
+<     --median [#] Remove noise with the median of the # radius square
+<     --erode WxH  Take the minimum over a W by H rectangle, 3x3 if omitted
+<     --dilate WxH Take the maximum over a W by H rectangle, 3x3 if omitted
+<     --open WxH   Erode then dilate, removing bright specks
+<     --close WxH  Dilate then erode, filling dark holes
+<     --boxblur #  Blur with the mean of the # radius square, any size
+<     --stddev #   Replace each pixel with the std dev of the # radius square
+<     --stats list Print mean and std dev of regions left,top,WxH[:...]
+<     --unsharp r,a,t Sharpen by a times the difference from the r radius blur,
+<                  where the difference is at least t
+<     --edges [k,m] Edge map, k is sobel or scharr and m is l1 or l2
+<     --bilateral s,r[,exact] Smooth within sigma_s pixels, keeping edges
+<                  of more than sigma_r gray levels
+<     --over file[@c,r] Blend an image with alpha onto this one at column c,
+<                  row r
+<     --pyramid #  Write basename.dzi and Deep Zoom tiles # pixels square
+<     --crop l,t,WxH Keep the W by H rectangle at column l, row t
+<     --and file   Black where a P1/P4 bitmap and the mask file are black
+<     --or file    Black where a P1/P4 bitmap or the mask file is black
+<     --xor file   Black where only one of a bitmap and the mask is black
+< Global Option    Option Description
+<     --isa name   Use the scalar, sse4.2, avx2 or avx512 kernels
+<     --shard #    Split the image across # worker processes
+<     --incremental  Only process the tiles that changed since the last run
+   @endverbatim
+ * 
+ ******************************************************************************/
+int usageStatement()
+{
+    cout << "thpe01.exe [option] --outputtype basename image.ppm" << endl;
+    cout << "thpe01.exe --compare first.ppm second.ppm [diffbase]" << endl;
+    cout << "thpe01.exe --info [--index catalog.tsv] path..." << endl;
+    cout << "thpe01.exe --autotune" << endl;
+    cout << endl;
+    cout << "Output Type      Output Description" << endl;
+    cout << "    --ascii      integer text numbers will be written for the data" << endl;
+    cout << "    --binary     integer numbers will be written in binary form" << endl;
+    cout << "    --qoi        lossless compressed QOI image will be written" << endl;
+    cout << endl;
+    cout << "Option Code      Option Description" << endl;
+    cout << "    --smooth     Blur a color image" << endl;
+    cout << "    --sharpen    Enhance the lines in a color image" << endl;
+    cout << "    --negate     Create a negative of a color image" << endl;
+    cout << "    --brighten # Add the provide (+/-) number to each pixel" << endl;
+    cout << "    --grayscale  Convert image to grayscale" << endl;
+    cout << "    --contrast   Convert a color image to grayscale and scale the pixel values" << endl;
+    cout << "    --equalize   Convert to grayscale and equalize the histogram" << endl;
+    cout << "    --clahe [#]  Convert to grayscale and equalize each tile, # limits contrast" << endl;
+    cout << "    --median [#] Remove noise with the median of the # radius square" << endl;
+    cout << "    --erode WxH  Take the minimum over a W by H rectangle, 3x3 if omitted" << endl;
+    cout << "    --dilate WxH Take the maximum over a W by H rectangle, 3x3 if omitted" << endl;
+    cout << "    --open WxH   Erode then dilate, removing bright specks" << endl;
+    cout << "    --close WxH  Dilate then erode, filling dark holes" << endl;
+    cout << "    --boxblur #  Blur with the mean of the # radius square, any size" << endl;
+    cout << "    --stddev #   Replace each pixel with the std dev of the # radius square" << endl;
+    cout << "    --stats list Print mean and std dev of regions left,top,WxH[:...]" << endl;
+    cout << "    --unsharp r,a,t Sharpen by a times the difference from the r radius blur," << endl;
+    cout << "                 where the difference is at least t" << endl;
+    cout << "    --edges [k,m] Edge map, k is sobel or scharr and m is l1 or l2" << endl;
+    cout << "    --bilateral s,r[,exact] Smooth within sigma_s pixels, keeping edges" << endl;
+    cout << "                 of more than sigma_r gray levels" << endl;
+    cout << "    --over file[@c,r] Blend an image with alpha onto this one at column c," << endl;
+    cout << "                 row r" << endl;
+    cout << "    --pyramid #  Write basename.dzi and Deep Zoom tiles # pixels square" << endl;
+    cout << "    --crop l,t,WxH Keep the W by H rectangle at column l, row t" << endl;
+    cout << "    --and file   Black where a P1/P4 bitmap and the mask file are black" << endl;
+    cout << "    --or file    Black where a P1/P4 bitmap or the mask file is black" << endl;
+    cout << "    --xor file   Black where only one of a bitmap and the mask is black" << endl;
+    cout << endl;
+    cout << "Global Option    Option Description" << endl;
+    cout << "    --isa name   Use the scalar, sse4.2, avx2 or avx512 kernels" << endl;
+    cout << "    --shard #    Split the image across # worker processes" << endl;
+    cout << "    --incremental  Only process the tiles that changed since the last run" << endl;
+
+    return 0;
+
+}
+
+/** ***************************************************************************
+ * @author Heidi Anderson
+ *
+ * @par Description:
+ * Prints why a library call failed. The library leaves the reason in
+ * lastFailure instead of printing it; when it gave none, the message passed
+ * in is printed. lastFailure is cleared so the next failure starts fresh.
+ *
+ * @param[in] otherwise - message to print when lastFailure is empty
+ *
+ * @par Example:
+   @verbatim
+   printFailure("Unable to read nothere.ppm");
+
+   Output:
+   Unable to open input file: nothere.ppm
+   @endverbatim
+ *
+ *****************************************************************************/
+void printFailure(string otherwise)
+{
+    cerr << (lastFailure != "" ? lastFailure : otherwise) << endl;
+    lastFailure = "";
+}